@@ -57,6 +57,127 @@ void tmt::debug::Gizmos::DrawTriangles(DebugTriangle* triangles, int triCt)
     matrix = glm::mat4(1.0);
 }
 
+using tmt::render::Vertex;
+
+static tmt::render::Material* gizmoMaterial(bool lines)
+{
+    static render::Material* lineMaterial = nullptr;
+    static render::Material* triangleMaterial = nullptr;
+
+    var& material = lines ? lineMaterial : triangleMaterial;
+    if (!material)
+    {
+        material = new render::Material(defaultShader);
+        material->features = 0;
+        material->state.primitive = lines ? render::MaterialState::Lines : render::MaterialState::Triangles;
+    }
+
+    return material;
+}
+
+static void pushGizmo(const tmt::debug::DebugCall& call, const std::vector<glm::vec3>& points,
+                      const std::vector<u16>& indices, bool lines)
+{
+    var geometry = tmt::render::allocateTransient(points.size(), indices.size(), Vertex::getVertexLayout());
+    if (!geometry.IsValid())
+        return;
+
+    var vertices = geometry.GetVertices<Vertex>();
+    for (size_t i = 0; i < points.size(); ++i)
+    {
+        vertices[i] = Vertex{points[i]};
+    }
+
+    std::copy(indices.begin(), indices.end(), geometry.indices.begin());
+
+    var material = gizmoMaterial(lines);
+    material->GetUniform("u_color")->v4 = glm::vec4(call.color.r, call.color.g, call.color.b, call.color.a);
+
+    // Gizmos show up on every camera
+    geometry.mesh->draw(call.matrix, material, glm::vec3(0), static_cast<u32>(-1));
+}
+
+void tmt::debug::Gizmos::Flush()
+{
+    std::vector<glm::vec3> points;
+    std::vector<u16> indices;
+
+    for (auto& call : debugCalls)
+    {
+        points.clear();
+        indices.clear();
+
+        switch (call.type)
+        {
+            case Line:
+                points = {call.origin, call.direction};
+                indices = {0, 1};
+                pushGizmo(call, points, indices, true);
+                break;
+            case Box:
+            {
+                var half = call.direction * 0.5f;
+                for (int i = 0; i < 8; ++i)
+                {
+                    points.push_back(call.origin + half * glm::vec3(i & 1 ? 1 : -1, i & 2 ? 1 : -1, i & 4 ? 1 : -1));
+                }
+
+                indices = {0, 1, 2, 3, 4, 5, 6, 7, 0, 2, 1, 3, 4, 6, 5, 7, 0, 4, 1, 5, 2, 6, 3, 7};
+                pushGizmo(call, points, indices, true);
+            }
+            break;
+            case Sphere:
+            {
+                constexpr int segments = 24;
+
+                // One circle per axis plane
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    u16 start = points.size();
+                    for (int i = 0; i < segments; ++i)
+                    {
+                        float angle = glm::two_pi<float>() * i / segments;
+                        var c = glm::vec2(glm::cos(angle), glm::sin(angle)) * call.radius;
+
+                        var p = axis == 0   ? glm::vec3(0, c.x, c.y)
+                                : axis == 1 ? glm::vec3(c.x, 0, c.y)
+                                            : glm::vec3(c.x, c.y, 0);
+                        points.push_back(call.origin + p);
+
+                        indices.push_back(start + i);
+                        indices.push_back(start + (i + 1) % segments);
+                    }
+                }
+
+                pushGizmo(call, points, indices, true);
+            }
+            break;
+            case Triangle:
+            case TriangleList:
+            {
+                int count = static_cast<int>(call.radius);
+                for (int i = 0; i < count; ++i)
+                {
+                    for (int k = 0; k < 3; ++k)
+                    {
+                        indices.push_back(points.size());
+                        points.push_back(call.triangles[i][k]);
+                    }
+                }
+
+                pushGizmo(call, points, indices, false);
+
+                // DrawTriangle allocates its own triangle, lists belong to the caller
+                if (call.type == Triangle)
+                    delete call.triangles;
+            }
+            break;
+            case Text:
+                break;
+        }
+    }
+}
+
 void tmt::debug::DebugUi::AddImguiEvent(std::function<void()> func)
 {
     debugFuncs.push_back(func);
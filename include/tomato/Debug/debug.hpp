@@ -80,6 +80,9 @@ namespace tmt::debug
         static void _DrawText(glm::vec2 pos, string text);
         static void DrawTriangle(glm::vec3 v1, glm::vec3 v2, glm::vec3 v3);
         static void DrawTriangles(DebugTriangle* triangles, int triangleCount);
+
+        // Builds this frame's gizmo geometry in transient buffers and queues the draws
+        static void Flush();
     };
     ;
 
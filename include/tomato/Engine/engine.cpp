@@ -12,11 +12,13 @@
  * This function performs the following initialization steps in order:
  * 1. Sets the global application pointer
  * 2. Creates the resource manager for asset loading
- * 3. Initializes the rendering system with the specified window size
- * 4. Sets up input handling (keyboard, mouse, gamepad)
- * 5. Creates and populates the engine info structure
- * 6. Initializes audio system
- * 7. Initializes object/scene management system
+ * 3. Starts the worker thread pool
+ * 4. Initializes the rendering system with the specified window size
+ * 5. Sets up input handling (keyboard, mouse, gamepad)
+ * 6. Creates and populates the engine info structure
+ * 7. Initializes audio system
+ * 8. Initializes object/scene management system
+ * 9. Starts watching loaded assets for changes (debug builds only)
  * 
  * @param app Pointer to the Application instance
  * @param ws Window size as a 2D vector (width, height)
@@ -31,6 +33,9 @@ tmt::engine::EngineInfo* tmt::engine::init(Application* app, glm::vec2 ws)
     // Create resource manager for loading textures, models, audio, etc.
     var resourceManager = new fs::ResourceManager();
 
+    // Start worker threads used to spread per-frame work (camera recording, etc.)
+    job::init();
+
     // Initialize the rendering system (OpenGL/graphics context, shaders, etc.)
     var rendererInfo = render::init(ws.x, ws.y);
 
@@ -48,6 +53,11 @@ tmt::engine::EngineInfo* tmt::engine::init(Application* app, glm::vec2 ws)
     // Initialize object management and scene graph
     obj::init();
 
+#ifdef DEBUG
+    // Reload shaders, textures and models when their files change, release builds opt in themselves
+    resourceManager->StartWatching();
+#endif
+
     return engineInfo;
 }
 
@@ -57,18 +67,23 @@ tmt::engine::EngineInfo* tmt::engine::init(Application* app, glm::vec2 ws)
  * This function updates all engine subsystems in the correct order to ensure
  * proper game state progression. The update order is important:
  * 
- * 1. Debug UI (debug builds only) - updated first to capture input
- * 2. Mouse tracking - calculates mouse position and delta for this frame
- * 3. Object system - updates game objects and components
- * 4. Render system - processes draw calls and renders the frame
- * 5. Input system - processes keyboard/mouse/gamepad state for next frame
- * 6. Audio system - updates sound playback
- * 7. Time tracking - calculates delta time for frame-rate independent movement
+ * 1. Asset reloads - swaps in assets the watcher finished loading, before anything uses them
+ * 2. Debug UI (debug builds only) - updated first to capture input
+ * 3. Mouse tracking - calculates mouse position and delta for this frame
+ * 4. Object system - updates game objects and components
+ * 5. Transform hierarchy - recomputes world transforms of objects moved this frame
+ * 6. Render system - processes draw calls and renders the frame
+ * 7. Input system - processes keyboard/mouse/gamepad state for next frame
+ * 8. Audio system - updates sound playback
+ * 9. Time tracking - calculates delta time for frame-rate independent movement
  * 
  * Should be called once per frame in the main game loop.
  */
 void tmt::engine::update()
 {
+    // Frame boundary, nothing is recorded against the old handles yet
+    fs::ResourceManager::pInstance->ApplyReloads();
+
 #ifdef DEBUG
     // Update debug UI overlay in debug builds
     debug::DebugUi::Update();
@@ -89,7 +104,10 @@ void tmt::engine::update()
 
     // Update all game objects and their components
     obj::update();
-    
+
+    // Propagate this frame's transform changes once, world queries after this are array reads
+    transformHierarchy.Update();
+
     // Process rendering: draw calls, shader updates, frame presentation
     render::update();
     
@@ -109,19 +127,27 @@ void tmt::engine::update()
  * @brief Cleanly shutdown the engine and free all resources
  * 
  * Performs cleanup in the following order:
- * 1. Destroys the main scene and all game objects
- * 2. Shuts down the rendering system (destroys shaders, textures, buffers)
+ * 1. Stops the asset watcher
+ * 2. Destroys the main scene and all game objects
+ * 3. Shuts down the rendering system (destroys shaders, textures, buffers)
+ * 4. Stops the worker thread pool
  * 
  * This should be called before application exit to prevent memory leaks
  * and ensure proper cleanup of GPU resources.
  */
 void tmt::engine::shutdown()
 {
+    // Stop reloading before the assets it would reload are destroyed
+    fs::ResourceManager::pInstance->StopWatching();
+
     // Clean up the main scene and all game objects
     delete mainScene;
     
     // Shutdown rendering system and free GPU resources
     render::shutdown();
+
+    // Join worker threads
+    job::shutdown();
 }
 
 /**
@@ -1,7 +1,16 @@
 #include "fs.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <ranges>
 
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
 #include "globals.hpp"
 
 using namespace tmt::fs;
@@ -10,22 +19,15 @@ ResourceManager* ResourceManager::pInstance;
 
 std::vector<u8> tmt::fs::readToBuffer(string path)
 {
-    // Open the file for reading
-    std::ifstream fin(path);
-
-    // Create an empty vector
-    std::vector<u8> v;
+    // Binary, so bytes that look like whitespace are kept
+    std::ifstream fin(path, std::ios::binary | std::ios::ate);
+    if (!fin)
+        return {};
 
-    // Read the contents of the file and store them in the
-    // vector
-    char c;
-    while (fin >> c)
-    {
-        v.push_back(c);
-    }
+    std::vector<u8> v(static_cast<size_t>(fin.tellg()));
 
-    // Close the file
-    fin.close();
+    fin.seekg(0, std::ios::beg);
+    fin.read(reinterpret_cast<char*>(v.data()), v.size());
 
     return v;
 }
@@ -40,6 +42,271 @@ void ResourceManager::ReloadShaders()
     }
 }
 
+namespace
+{
+    struct WatchedAsset
+    {
+        const void* owner;
+        ResourceManager::ReloadFunc reload;
+    };
+
+    struct WatchedFile
+    {
+        std::vector<WatchedAsset> assets;
+        std::filesystem::file_time_type lastWrite;
+    };
+
+    std::mutex watchMutex;
+    std::map<string, WatchedFile> watchedFiles;
+    struct ReadyReload
+    {
+        string path;
+        const void* owner;
+        std::function<void()> apply;
+    };
+
+    std::vector<ReadyReload> readyReloads;
+
+    std::thread watchThread;
+    std::atomic<bool> watching = false;
+
+#ifdef __linux__
+    int inotifyFd = -1;
+    std::map<int, string> watchedDirectories;
+#endif
+
+    // Editors often save in several writes, a file is reloaded once it has been quiet this long
+    constexpr var settleTime = std::chrono::milliseconds(100);
+    constexpr var pollInterval = std::chrono::milliseconds(250);
+
+    string normalizePath(const string& path)
+    {
+        std::error_code error;
+        var normal = std::filesystem::weakly_canonical(path, error);
+
+        return error ? path : normal.string();
+    }
+
+    // Expects watchMutex to be held
+    void watchDirectory(const string& path)
+    {
+#ifdef __linux__
+        if (inotifyFd < 0)
+            return;
+
+        var directory = std::filesystem::path(path).parent_path().string();
+        for (const auto& watched : watchedDirectories | std::views::values)
+        {
+            if (watched == directory)
+                return;
+        }
+
+        int wd = inotify_add_watch(inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+        if (wd >= 0)
+            watchedDirectories[wd] = directory;
+#endif
+    }
+
+    void reloadFile(const string& path)
+    {
+        std::vector<WatchedAsset> assets;
+        {
+            std::lock_guard lock(watchMutex);
+            if (!IN_MAP(watchedFiles, path))
+                return;
+
+            assets = watchedFiles[path].assets;
+        }
+
+        // The slow part, reading and decoding, stays on this thread
+        for (const auto& asset : assets)
+        {
+            var apply = asset.reload();
+            if (!apply)
+                continue;
+
+            std::lock_guard lock(watchMutex);
+
+            // The owner may have been unwatched, and freed, while its loader ran
+            var file = watchedFiles.find(path);
+            if (file == watchedFiles.end() ||
+                std::ranges::none_of(file->second.assets,
+                                     [&asset](const WatchedAsset& watched) { return watched.owner == asset.owner; }))
+                continue;
+
+            readyReloads.push_back({path, asset.owner, std::move(apply)});
+        }
+    }
+
+    void watchLoop()
+    {
+        std::map<string, std::chrono::steady_clock::time_point> changed;
+
+        while (watching)
+        {
+            var now = std::chrono::steady_clock::now();
+
+#ifdef __linux__
+            if (inotifyFd >= 0)
+            {
+                pollfd pfd = {inotifyFd, POLLIN, 0};
+
+                if (poll(&pfd, 1, static_cast<int>(settleTime.count())) > 0)
+                {
+                    alignas(inotify_event) char buffer[4096];
+                    ssize_t length;
+
+                    while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0)
+                    {
+                        for (char* p = buffer; p < buffer + length;)
+                        {
+                            var event = reinterpret_cast<const inotify_event*>(p);
+                            p += sizeof(inotify_event) + event->len;
+
+                            if (event->len == 0)
+                                continue;
+
+                            std::lock_guard lock(watchMutex);
+                            if (!IN_MAP(watchedDirectories, event->wd))
+                                continue;
+
+                            var path = normalizePath(watchedDirectories[event->wd] + "/" + event->name);
+                            if (IN_MAP(watchedFiles, path))
+                                changed[path] = std::chrono::steady_clock::now();
+                        }
+                    }
+                }
+            }
+            else
+#endif
+            {
+                std::this_thread::sleep_for(pollInterval);
+
+                std::lock_guard lock(watchMutex);
+                for (auto& [path, file] : watchedFiles)
+                {
+                    std::error_code error;
+                    var lastWrite = std::filesystem::last_write_time(path, error);
+
+                    if (!error && lastWrite != file.lastWrite)
+                    {
+                        file.lastWrite = lastWrite;
+                        changed[path] = now;
+                    }
+                }
+            }
+
+            now = std::chrono::steady_clock::now();
+            for (var it = changed.begin(); it != changed.end();)
+            {
+                if (now - it->second < settleTime)
+                {
+                    ++it;
+                    continue;
+                }
+
+                reloadFile(it->first);
+                it = changed.erase(it);
+            }
+        }
+    }
+}
+
+void ResourceManager::Watch(string path, const void* owner, ReloadFunc reload)
+{
+    path = normalizePath(path);
+
+    std::lock_guard lock(watchMutex);
+
+    var& file = watchedFiles[path];
+    if (file.assets.empty())
+    {
+        std::error_code error;
+        file.lastWrite = std::filesystem::last_write_time(path, error);
+
+        watchDirectory(path);
+    }
+
+    file.assets.push_back({owner, std::move(reload)});
+}
+
+void ResourceManager::Unwatch(const void* owner)
+{
+    std::lock_guard lock(watchMutex);
+
+    for (auto& file : watchedFiles | std::views::values)
+    {
+        std::erase_if(file.assets, [owner](const WatchedAsset& asset) { return asset.owner == owner; });
+    }
+
+    // Reloads already queued would run against the freed owner
+    std::erase_if(readyReloads, [owner](const ReadyReload& ready) { return ready.owner == owner; });
+}
+
+void ResourceManager::StartWatching()
+{
+    if (watching)
+        return;
+
+#ifdef __linux__
+    {
+        std::lock_guard lock(watchMutex);
+
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyFd < 0)
+            std::cout << "inotify unavailable, polling for asset changes instead" << std::endl;
+
+        for (const auto& path : watchedFiles | std::views::keys)
+        {
+            watchDirectory(path);
+        }
+    }
+#endif
+
+    watching = true;
+    watchThread = std::thread(watchLoop);
+}
+
+void ResourceManager::StopWatching()
+{
+    if (!watching)
+        return;
+
+    watching = false;
+    watchThread.join();
+
+#ifdef __linux__
+    std::lock_guard lock(watchMutex);
+
+    if (inotifyFd >= 0)
+        close(inotifyFd);
+
+    inotifyFd = -1;
+    watchedDirectories.clear();
+#endif
+}
+
+void ResourceManager::ApplyReloads()
+{
+    std::vector<ReadyReload> ready;
+    {
+        std::lock_guard lock(watchMutex);
+        ready.swap(readyReloads);
+    }
+
+    for (auto& reload : ready)
+    {
+        reload.apply();
+
+        std::cout << "Reloaded " << reload.path << std::endl;
+
+        for (const auto& callback : onReloaded)
+        {
+            callback(reload.path);
+        }
+    }
+}
+
 TRES::TResFolder::TResFolder(BinaryReader* reader, TResFileBase* parent)
 {
     type = TRS_Folder;
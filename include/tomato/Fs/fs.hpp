@@ -636,14 +636,17 @@ namespace tmt::fs
         ResourceManager();
 
 
-        std::map<string, audio::Sound*> loaded_sounds;
-        std::map<string, render::SubShader*> loaded_sub_shaders;
-        std::map<string, render::Shader*> loaded_shaders;
-        std::map<string, render::ComputeShader*> loaded_compute_shaders;
-        std::map<string, render::Texture*> loaded_textures;
-        std::map<string, render::Font*> loaded_fonts;
-        std::map<string, render::Mesh*> loaded_meshes;
-        std::map<string, render::SceneDescription*> loaded_scene_descs;
+        // Keyed by interned path or name, lookups hash once instead of walking string compares
+        std::unordered_map<StringId, audio::Sound*> loaded_sounds;
+        std::unordered_map<StringId, render::SubShader*> loaded_sub_shaders;
+        std::unordered_map<StringId, render::Shader*> loaded_shaders;
+        std::unordered_map<StringId, render::ComputeShader*> loaded_compute_shaders;
+        std::unordered_map<StringId, render::Texture*> loaded_textures;
+        std::unordered_map<StringId, render::Font*> loaded_fonts;
+        std::unordered_map<StringId, render::Mesh*> loaded_meshes;
+        std::unordered_map<StringId, render::SceneDescription*> loaded_scene_descs;
+        // Images embedded in model files, keyed by a hash of their bytes so every asset embedding one shares it
+        std::unordered_map<u64, render::Texture*> loaded_embedded_textures;
 
         void ReloadShaders();
 
@@ -652,6 +655,24 @@ namespace tmt::fs
             ReloadShaders();
         }
 
+        // Runs on the watcher thread to read and decode the changed file. The function it returns runs on
+        // the main thread in ApplyReloads and swaps the result into the existing asset
+        using ReloadFunc = std::function<std::function<void()>()>;
+
+        // owner is only used to Unwatch when the asset is destroyed
+        void Watch(string path, const void* owner, ReloadFunc reload);
+        void Unwatch(const void* owner);
+
+        // Watches with inotify on Linux and by polling modification times elsewhere
+        void StartWatching();
+        void StopWatching();
+
+        // Call at a frame boundary, nothing is being drawn with the assets it replaces
+        void ApplyReloads();
+
+        // Called after ApplyReloads swapped an asset in, with the file that changed
+        std::vector<std::function<void(const string& path)>> onReloaded;
+
     };
 
     struct TRES
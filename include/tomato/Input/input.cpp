@@ -287,14 +287,14 @@ void tmt::input::ForceInputState(InputState state)
  * - "LookHorizontal": Mouse X delta or right stick X
  * - "LookVertical": Mouse Y delta or right stick Y
  * 
- * @param axis Name of the virtual axis
+ * @param axis Name of the virtual axis, compared by hash
  * @return float Axis value typically in range [-1, 1]
  */
-float tmt::input::GetAxis(string axis)
+float tmt::input::GetAxis(StringId axis)
 {
     var a = 0.0f;
 
-    if (axis == "Horizontal")
+    if (axis == "Horizontal"_sid)
     {
         if (currentInputState == KeyboardMouse)
         {
@@ -322,7 +322,7 @@ float tmt::input::GetAxis(string axis)
             a = Gamepad::GetAxis(GLFW_GAMEPAD_AXIS_LEFT_X);
         }
     }
-    else if (axis == "Vertical")
+    else if (axis == "Vertical"_sid)
     {
         if (currentInputState == KeyboardMouse)
         {
@@ -347,7 +347,7 @@ float tmt::input::GetAxis(string axis)
             a = -Gamepad::GetAxis(GLFW_GAMEPAD_AXIS_LEFT_Y);
         }
     }
-    else if (axis == "LookHorizontal")
+    else if (axis == "LookHorizontal"_sid)
     {
         if (currentInputState == KeyboardMouse)
         {
@@ -358,7 +358,7 @@ float tmt::input::GetAxis(string axis)
             a = -Gamepad::GetAxis(GLFW_GAMEPAD_AXIS_RIGHT_X);
         }
     }
-    else if (axis == "LookVertical")
+    else if (axis == "LookVertical"_sid)
     {
         if (currentInputState == KeyboardMouse)
         {
@@ -379,19 +379,19 @@ float tmt::input::GetAxis(string axis)
 }
 
 
-glm::vec2 tmt::input::GetAxis2(string axis)
+glm::vec2 tmt::input::GetAxis2(StringId axis)
 {
     glm::vec2 a(0, 0);
 
-    if (axis == "Move")
+    if (axis == "Move"_sid)
     {
-        a.x = GetAxis("Horizontal");
-        a.y = GetAxis("Vertical");
+        a.x = GetAxis("Horizontal"_sid);
+        a.y = GetAxis("Vertical"_sid);
     }
-    else if (axis == "Look")
+    else if (axis == "Look"_sid)
     {
-        a.x = -GetAxis("LookHorizontal");
-        a.y = GetAxis("LookVertical");
+        a.x = -GetAxis("LookHorizontal"_sid);
+        a.y = GetAxis("LookVertical"_sid);
     }
 
     return a;
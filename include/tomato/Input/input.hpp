@@ -209,10 +209,10 @@ namespace tmt::input
      * - "LookHorizontal": Mouse X delta or right stick X
      * - "LookVertical": Mouse Y delta or right stick Y
      * 
-     * @param axis Name of the virtual axis
+     * @param axis Name of the virtual axis, "Horizontal"_sid skips hashing at runtime
      * @return float Axis value in range [-1, 1]
      */
-    float GetAxis(string axis);
+    float GetAxis(StringId axis);
     
     /**
      * @brief Get a 2D virtual axis by name
@@ -220,7 +220,7 @@ namespace tmt::input
      * @param axis Name of the 2D axis (e.g., "Movement", "Look")
      * @return glm::vec2 2D axis value
      */
-    glm::vec2 GetAxis2(string axis);
+    glm::vec2 GetAxis2(StringId axis);
 
     /**
      * @brief Get the name of the connected gamepad
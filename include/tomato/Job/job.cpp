@@ -0,0 +1,153 @@
+/**
+ * @file job.cpp
+ * @brief Implementation of the worker thread pool
+ */
+
+#include "job.hpp"
+#include "globals.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+namespace
+{
+    /**
+     * @brief One parallelFor call, shared with the workers so a late worker never sees the next batch's state
+     */
+    struct Batch
+    {
+        std::function<void(u32)> func;
+        u32 count = 0;
+        std::atomic<u32> next = 0;
+        std::atomic<u32> done = 0;
+    };
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::mutex submitMutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+
+    std::shared_ptr<Batch> current;
+    u64 generation = 0;
+    bool running = false;
+
+    thread_local bool isWorker = false;
+
+    void runBatch(Batch& batch)
+    {
+        u32 i;
+        while ((i = batch.next.fetch_add(1)) < batch.count)
+        {
+            batch.func(i);
+
+            if (batch.done.fetch_add(1) + 1 == batch.count)
+            {
+                std::lock_guard lock(mutex);
+                finished.notify_all();
+            }
+        }
+    }
+
+    void workerLoop()
+    {
+        isWorker = true;
+        u64 seen = 0;
+
+        while (true)
+        {
+            std::shared_ptr<Batch> batch;
+
+            {
+                std::unique_lock lock(mutex);
+                wake.wait(lock, [&seen] { return !running || generation != seen; });
+
+                if (!running)
+                    return;
+
+                seen = generation;
+                batch = current;
+            }
+
+            if (batch)
+                runBatch(*batch);
+        }
+    }
+}
+
+void tmt::job::init(u32 threadCount)
+{
+    if (running)
+        return;
+
+    if (threadCount == 0)
+    {
+        var hardware = std::thread::hardware_concurrency();
+        threadCount = hardware > 1 ? hardware - 1 : 0;
+    }
+
+    running = true;
+
+    for (u32 i = 0; i < threadCount; ++i)
+    {
+        workers.emplace_back(workerLoop);
+    }
+}
+
+void tmt::job::parallelFor(u32 count, const std::function<void(u32)>& func)
+{
+    if (count == 0)
+        return;
+
+    if (workers.empty() || count == 1 || isWorker)
+    {
+        for (u32 i = 0; i < count; ++i)
+        {
+            func(i);
+        }
+
+        return;
+    }
+
+    std::lock_guard submitLock(submitMutex);
+
+    var batch = std::make_shared<Batch>();
+    batch->func = func;
+    batch->count = count;
+
+    {
+        std::lock_guard lock(mutex);
+        current = batch;
+        generation++;
+    }
+    wake.notify_all();
+
+    // The caller works too instead of idling until the workers finish
+    runBatch(*batch);
+
+    std::unique_lock lock(mutex);
+    finished.wait(lock, [&batch] { return batch->done.load() == batch->count; });
+    current = nullptr;
+}
+
+u32 tmt::job::getWorkerCount()
+{
+    return workers.size();
+}
+
+void tmt::job::shutdown()
+{
+    {
+        std::lock_guard lock(mutex);
+        running = false;
+    }
+    wake.notify_all();
+
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    workers.clear();
+}
@@ -0,0 +1,49 @@
+/**
+ * @file job.hpp
+ * @brief Worker thread pool for splitting per-frame work across cores
+ *
+ * Provides:
+ * - A fixed pool of worker threads started with the engine
+ * - parallelFor, which blocks the caller until every index has run
+ */
+
+#ifndef JOB_H
+#define JOB_H
+
+#include "utils.hpp"
+
+
+namespace tmt::job
+{
+
+    /**
+     * @brief Start the worker threads
+     *
+     * @param threadCount Number of workers, 0 uses hardware_concurrency - 1
+     */
+    void init(u32 threadCount = 0);
+
+    /**
+     * @brief Run func(i) for every i in [0, count) on the workers and the calling thread
+     *
+     * Blocks until all indices have finished. Runs as a plain loop when the pool
+     * is not running, when count is 1 or when called from inside a job.
+     *
+     * @param count Number of indices to run
+     * @param func Work for one index, must be safe to call concurrently
+     */
+    void parallelFor(u32 count, const std::function<void(u32)>& func);
+
+    /**
+     * @brief Get the number of worker threads (not counting the calling thread)
+     * @return u32 Worker count, 0 before init
+     */
+    u32 getWorkerCount();
+
+    /**
+     * @brief Stop and join all worker threads
+     */
+    void shutdown();
+}
+
+#endif
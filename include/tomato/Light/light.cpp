@@ -62,6 +62,11 @@ tmt::light::SkyboxObject::SkyboxObject()
     skyboxMesh = GetPrimitive(prim::Cube);
 }
 
+tmt::light::SkyboxObject::~SkyboxObject()
+{
+    render::destroyRenderProxy(skyboxProxy);
+}
+
 void tmt::light::SkyboxObject::Update()
 {
     if (cubemap)
@@ -69,7 +74,17 @@ void tmt::light::SkyboxObject::Update()
 
         skyboxMaterial->GetUniform("map")->tex = cubemap->realTexture;
 
-        skyboxMesh->draw(glm::mat4(1.0), skyboxMaterial, glm::vec3{0}, layer);
+        if (!render::getRenderProxy(skyboxProxy))
+        {
+            skyboxProxy = render::createRenderProxy(skyboxMesh, skyboxMaterial, layer);
+        }
+
+        render::getRenderProxy(skyboxProxy)->SetLayers(layer, 0);
+    }
+    else if (render::getRenderProxy(skyboxProxy))
+    {
+        render::destroyRenderProxy(skyboxProxy);
+        skyboxProxy = -1;
     }
 
 
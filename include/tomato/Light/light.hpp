@@ -40,6 +40,7 @@ namespace tmt::light
     struct SkyboxObject : obj::Object
     {
         SkyboxObject();
+        ~SkyboxObject();
 
         void Update() override;
 
@@ -48,6 +49,7 @@ namespace tmt::light
     private:
         render::Material* skyboxMaterial = nullptr;
         render::Mesh* skyboxMesh = nullptr;
+        u32 skyboxProxy = -1;
     };
 
 }
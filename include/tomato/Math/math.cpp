@@ -257,3 +257,361 @@ float tmt::math::angleBetween(glm::vec2 a, glm::vec2 b)
 
     return angle;
 }
+
+/**
+ * @brief Transform an AABB by an affine matrix
+ *
+ * Uses the center/extent form so only one matrix multiply and an absolute
+ * value of the rotation part are needed instead of transforming 8 corners.
+ *
+ * @param m Affine transform to apply
+ * @return AABB Enclosing box in the transformed space
+ */
+tmt::math::AABB tmt::math::AABB::Transform(const glm::mat4& m) const
+{
+    if (!IsValid())
+        return *this;
+
+    var center = (min + max) * 0.5f;
+    var extent = (max - min) * 0.5f;
+
+    var newCenter = glm::vec3(m * glm::vec4(center, 1.0f));
+    var newExtent = glm::vec3(0);
+    for (int i = 0; i < 3; ++i)
+    {
+        newExtent += glm::abs(glm::vec3(m[i])) * extent[i];
+    }
+
+    AABB box;
+    box.min = newCenter - newExtent;
+    box.max = newCenter + newExtent;
+    return box;
+}
+
+/**
+ * @brief Extract frustum planes from a view-projection matrix (Gribb/Hartmann)
+ *
+ * @param viewProj Combined projection * view matrix
+ * @return Frustum Normalised planes
+ */
+tmt::math::Frustum tmt::math::Frustum::FromMatrix(const glm::mat4& viewProj)
+{
+    var row = [&viewProj](int r) { return glm::vec4(viewProj[0][r], viewProj[1][r], viewProj[2][r], viewProj[3][r]); };
+
+    Frustum f;
+    f.planes[0] = row(3) + row(0);
+    f.planes[1] = row(3) - row(0);
+    f.planes[2] = row(3) + row(1);
+    f.planes[3] = row(3) - row(1);
+    f.planes[4] = row(3) + row(2);
+    f.planes[5] = row(3) - row(2);
+
+    for (auto& plane : f.planes)
+    {
+        var len = glm::length(glm::vec3(plane));
+        if (len > 0)
+            plane /= len;
+    }
+
+    return f;
+}
+
+/**
+ * @brief Test a box against the frustum using its positive vertex per plane
+ *
+ * @param box World space box
+ * @return true if the box is not fully outside any plane
+ */
+bool tmt::math::Frustum::Intersects(const AABB& box) const
+{
+    for (const auto& plane : planes)
+    {
+        var p = glm::vec3(plane.x >= 0 ? box.max.x : box.min.x, plane.y >= 0 ? box.max.y : box.min.y,
+                          plane.z >= 0 ? box.max.z : box.min.z);
+
+        if (glm::dot(glm::vec3(plane), p) + plane.w < 0)
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Add an identity transform in a new slot at the end of the arrays
+ *
+ * The parent is always stored earlier, so the arrays stay valid for Update()
+ * even before they are re-sorted by depth.
+ *
+ * @param parent Parent transform, or INVALID_HANDLE for a root
+ * @return Handle Stable handle of the new transform
+ */
+tmt::math::TransformHierarchy::Handle tmt::math::TransformHierarchy::Create(Handle parent)
+{
+    Handle handle;
+    if (!freeHandles.empty())
+    {
+        handle = freeHandles.back();
+        freeHandles.pop_back();
+    }
+    else
+    {
+        handle = static_cast<Handle>(slots.size());
+        slots.push_back(0);
+    }
+
+    u32 slot = static_cast<u32>(handles.size());
+    slots[handle] = slot;
+
+    positions.emplace_back(0);
+    rotations.emplace_back(1, 0, 0, 0);
+    scales.emplace_back(1);
+    worldMatrices.emplace_back(1);
+    worldRotations.emplace_back(1, 0, 0, 0);
+    parents.push_back(parent != INVALID_HANDLE ? slots[parent] : NO_PARENT);
+    dirty.push_back(0);
+    updatedIn.push_back(0);
+    handles.push_back(handle);
+
+    MarkDirty(slot);
+    unsorted = true;
+
+    return handle;
+}
+
+/**
+ * @brief Remove a transform
+ *
+ * The slot is only marked dead here and compacted away by the next Sort().
+ * Children keep their local transform and become roots.
+ *
+ * @param handle Transform to remove
+ */
+void tmt::math::TransformHierarchy::Destroy(Handle handle)
+{
+    u32 slot = slots[handle];
+
+    for (u32 i = 0; i < parents.size(); ++i)
+    {
+        if (parents[i] == slot)
+        {
+            parents[i] = NO_PARENT;
+            MarkDirty(i);
+        }
+    }
+
+    parents[slot] = NO_PARENT;
+    handles[slot] = INVALID_HANDLE;
+    freeHandles.push_back(handle);
+
+    unsorted = true;
+}
+
+/**
+ * @brief Move a transform under another parent
+ *
+ * Parenting a transform under its own subtree is rejected, it would make a cycle.
+ *
+ * @param handle Transform to move
+ * @param parent New parent, or INVALID_HANDLE to make it a root
+ */
+void tmt::math::TransformHierarchy::SetParent(Handle handle, Handle parent)
+{
+    u32 slot = slots[handle];
+    u32 parentSlot = parent != INVALID_HANDLE ? slots[parent] : NO_PARENT;
+
+    for (u32 p = parentSlot; p != NO_PARENT; p = parents[p])
+    {
+        if (p == slot)
+        {
+            std::cout << "Cannot parent a transform to one of its own children" << std::endl;
+            return;
+        }
+    }
+
+    if (parents[slot] == parentSlot)
+        return;
+
+    parents[slot] = parentSlot;
+    MarkDirty(slot);
+
+    unsorted = true;
+}
+
+tmt::math::TransformHierarchy::Handle tmt::math::TransformHierarchy::GetParent(Handle handle) const
+{
+    u32 parent = parents[slots[handle]];
+    return parent != NO_PARENT ? handles[parent] : INVALID_HANDLE;
+}
+
+void tmt::math::TransformHierarchy::SetLocalPosition(Handle handle, glm::vec3 position)
+{
+    u32 slot = slots[handle];
+    positions[slot] = position;
+    MarkDirty(slot);
+}
+
+void tmt::math::TransformHierarchy::SetLocalRotation(Handle handle, glm::quat rotation)
+{
+    u32 slot = slots[handle];
+    rotations[slot] = rotation;
+    MarkDirty(slot);
+}
+
+void tmt::math::TransformHierarchy::SetLocalScale(Handle handle, glm::vec3 scale)
+{
+    u32 slot = slots[handle];
+    scales[slot] = scale;
+    MarkDirty(slot);
+}
+
+void tmt::math::TransformHierarchy::SetLocal(Handle handle, glm::vec3 position, glm::quat rotation, glm::vec3 scale)
+{
+    u32 slot = slots[handle];
+    positions[slot] = position;
+    rotations[slot] = rotation;
+    scales[slot] = scale;
+    MarkDirty(slot);
+}
+
+void tmt::math::TransformHierarchy::MarkDirty(u32 slot)
+{
+    dirty[slot] = 1;
+    anyDirty = true;
+}
+
+/**
+ * @brief Recompute dirty world transforms in one forward pass
+ *
+ * Parents come before their children, so a child sees its parent's dirty flag
+ * and new world matrix by the time it is visited. Clean subtrees are skipped.
+ */
+void tmt::math::TransformHierarchy::Update()
+{
+    ++updateCount;
+
+    if (unsorted)
+        Sort();
+
+    if (!anyDirty)
+        return;
+
+    for (size_t i = 0; i < parents.size(); ++i)
+    {
+        u32 parent = parents[i];
+        if (parent != NO_PARENT && dirty[parent])
+            dirty[i] = 1;
+
+        if (!dirty[i])
+            continue;
+
+        var local = glm::translate(glm::mat4(1.0f), positions[i]) * glm::toMat4(rotations[i]) *
+                    glm::scale(glm::mat4(1.0f), scales[i]);
+
+        if (parent == NO_PARENT)
+        {
+            worldMatrices[i] = local;
+            worldRotations[i] = rotations[i];
+        }
+        else
+        {
+            worldMatrices[i] = worldMatrices[parent] * local;
+            worldRotations[i] = worldRotations[parent] * rotations[i];
+        }
+
+        updatedIn[i] = updateCount;
+    }
+
+    std::fill(dirty.begin(), dirty.end(), 0);
+    anyDirty = false;
+}
+
+/**
+ * @brief Drop dead slots and reorder the rest by depth
+ *
+ * A counting sort by depth, stable so siblings keep their relative order.
+ * Only runs on frames where the hierarchy changed shape.
+ */
+void tmt::math::TransformHierarchy::Sort()
+{
+    unsorted = false;
+
+    // Reparenting can put a parent after its child, so depths are found by walking up
+    const u32 unknown = UINT32_MAX;
+    std::vector<u32> depths(parents.size(), unknown);
+    std::vector<u32> chain;
+    u32 maxDepth = 0;
+
+    for (u32 i = 0; i < parents.size(); ++i)
+    {
+        if (handles[i] == INVALID_HANDLE)
+            continue;
+
+        u32 slot = i;
+        while (depths[slot] == unknown && parents[slot] != NO_PARENT)
+        {
+            chain.push_back(slot);
+            slot = parents[slot];
+        }
+
+        u32 depth = depths[slot] == unknown ? depths[slot] = 0 : depths[slot];
+        while (!chain.empty())
+        {
+            depths[chain.back()] = ++depth;
+            chain.pop_back();
+        }
+
+        maxDepth = std::max(maxDepth, depths[i]);
+    }
+
+    std::vector<u32> starts(maxDepth + 2, 0);
+    for (u32 i = 0; i < parents.size(); ++i)
+    {
+        if (handles[i] != INVALID_HANDLE)
+            ++starts[depths[i] + 1];
+    }
+    for (u32 d = 1; d < starts.size(); ++d)
+    {
+        starts[d] += starts[d - 1];
+    }
+
+    u32 count = starts.back();
+    std::vector<u32> order(count);
+    std::vector<u32> remap(parents.size(), NO_PARENT);
+    for (u32 i = 0; i < parents.size(); ++i)
+    {
+        if (handles[i] == INVALID_HANDLE)
+            continue;
+
+        u32 slot = starts[depths[i]]++;
+        order[slot] = i;
+        remap[i] = slot;
+    }
+
+    var permute = [&order](auto& values)
+    {
+        std::remove_reference_t<decltype(values)> sorted(order.size());
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            sorted[i] = values[order[i]];
+        }
+        values.swap(sorted);
+    };
+
+    permute(positions);
+    permute(rotations);
+    permute(scales);
+    permute(worldMatrices);
+    permute(worldRotations);
+    permute(parents);
+    permute(dirty);
+    permute(updatedIn);
+    permute(handles);
+
+    for (u32 i = 0; i < count; ++i)
+    {
+        if (parents[i] != NO_PARENT)
+            parents[i] = remap[parents[i]];
+
+        slots[handles[i]] = i;
+    }
+}
@@ -316,6 +316,164 @@ namespace tmt::math
         low = static_cast<uint32_t>(packed & 0xFFFFFFFF); // Extract low 32 bits
     }
 
+    // === Bounding Volumes ===
+
+    /**
+     * @brief Axis-aligned bounding box
+     *
+     * Default-constructed boxes are empty (min > max) so the first Expand()
+     * snaps them to a point.
+     */
+    struct AABB
+    {
+        glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+        glm::vec3 max = glm::vec3(std::numeric_limits<float>::lowest());
+
+        /**
+         * @brief Grow the box to contain a point
+         * @param p Point to include
+         */
+        void Expand(glm::vec3 p)
+        {
+            min = glm::min(min, p);
+            max = glm::max(max, p);
+        }
+
+        /**
+         * @brief Whether the box contains at least one point
+         */
+        bool IsValid() const { return min.x <= max.x && min.y <= max.y && min.z <= max.z; }
+
+        /**
+         * @brief Transform the box and return the axis-aligned box enclosing the result
+         * @param m Affine transform to apply
+         * @return AABB Enclosing box in the transformed space
+         */
+        AABB Transform(const glm::mat4& m) const;
+    };
+
+    /**
+     * @brief View frustum as six inward-facing planes (xyz = normal, w = distance)
+     */
+    struct Frustum
+    {
+        glm::vec4 planes[6];
+
+        /**
+         * @brief Extract the frustum planes from a view-projection matrix
+         *
+         * Uses the -1..1 clip depth convention, which is also a conservative fit
+         * for 0..1 depth projections.
+         *
+         * @param viewProj Combined projection * view matrix
+         * @return Frustum Normalised planes (left, right, bottom, top, near, far)
+         */
+        static Frustum FromMatrix(const glm::mat4& viewProj);
+
+        /**
+         * @brief Conservative box test
+         * @param box World space box
+         * @return true if any part of the box may be inside the frustum
+         */
+        bool Intersects(const AABB& box) const;
+    };
+
+    // === Transform Hierarchy ===
+
+    /**
+     * @brief Local and world transforms of a whole hierarchy in flat arrays
+     *
+     * Transforms are addressed by stable handles. Internally they are stored in
+     * slots sorted by depth, so every parent is stored before its children and a
+     * single forward pass over the arrays updates the whole hierarchy. Setters only
+     * mark a transform dirty; Update() recomputes dirty transforms and everything
+     * below them once per frame, and world queries read the cached results.
+     */
+    struct TransformHierarchy
+    {
+        using Handle = u32;
+        static constexpr Handle INVALID_HANDLE = UINT32_MAX;
+
+        /**
+         * @brief Add an identity transform
+         * @param parent Parent transform, or INVALID_HANDLE for a root
+         * @return Handle Stable handle of the new transform
+         */
+        Handle Create(Handle parent = INVALID_HANDLE);
+
+        /**
+         * @brief Remove a transform, its children become roots
+         * @param handle Transform to remove
+         */
+        void Destroy(Handle handle);
+
+        /**
+         * @brief Move a transform under another parent, keeping its local transform
+         * @param handle Transform to move
+         * @param parent New parent, or INVALID_HANDLE to make it a root
+         */
+        void SetParent(Handle handle, Handle parent);
+        Handle GetParent(Handle handle) const;
+
+        void SetLocalPosition(Handle handle, glm::vec3 position);
+        void SetLocalRotation(Handle handle, glm::quat rotation);
+        void SetLocalScale(Handle handle, glm::vec3 scale);
+        void SetLocal(Handle handle, glm::vec3 position, glm::quat rotation, glm::vec3 scale);
+
+        glm::vec3 GetLocalPosition(Handle handle) const { return positions[slots[handle]]; }
+        glm::quat GetLocalRotation(Handle handle) const { return rotations[slots[handle]]; }
+        glm::vec3 GetLocalScale(Handle handle) const { return scales[slots[handle]]; }
+
+        /**
+         * @brief Recompute the world transforms of every dirty subtree
+         *
+         * Reorders the slots first if the hierarchy changed shape since the last update.
+         */
+        void Update();
+
+        /**
+         * @brief World queries, valid as of the last Update()
+         */
+        const glm::mat4& GetWorldMatrix(Handle handle) const { return worldMatrices[slots[handle]]; }
+        glm::vec3 GetWorldPosition(Handle handle) const { return glm::vec3(worldMatrices[slots[handle]][3]); }
+        glm::quat GetWorldRotation(Handle handle) const { return worldRotations[slots[handle]]; }
+
+        /**
+         * @brief Whether the last Update() recomputed this transform's world matrix
+         */
+        bool WasUpdated(Handle handle) const { return updatedIn[slots[handle]] == updateCount; }
+
+        /**
+         * @brief Number of live transforms
+         */
+        size_t Size() const { return slots.size() - freeHandles.size(); }
+
+    private:
+        static constexpr u32 NO_PARENT = UINT32_MAX;
+
+        void MarkDirty(u32 slot);
+        void Sort();
+
+        // Per slot, depth sorted
+        std::vector<glm::vec3> positions;
+        std::vector<glm::quat> rotations;
+        std::vector<glm::vec3> scales;
+        std::vector<glm::mat4> worldMatrices;
+        std::vector<glm::quat> worldRotations;
+        std::vector<u32> parents; ///< Slot of the parent, NO_PARENT for roots
+        std::vector<u8> dirty;
+        std::vector<u32> updatedIn; ///< Value of updateCount when the world matrix was last recomputed
+        std::vector<Handle> handles; ///< Handle stored in each slot, INVALID_HANDLE once destroyed
+
+        // Per handle
+        std::vector<u32> slots;
+        std::vector<Handle> freeHandles;
+
+        u32 updateCount = 0;
+        bool anyDirty = false;
+        bool unsorted = false;
+    };
+
 
 }
 
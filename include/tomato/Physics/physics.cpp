@@ -345,9 +345,9 @@ void PhysicalWorld::Update()
 
                             for (size_t triIndex = 0; triIndex < mesh->indexCount; triIndex += 3)
                             {
-                                glm::vec3 v0 = mesh->vertices[mesh->indices[triIndex + 0]].position;
-                                glm::vec3 v1 = mesh->vertices[mesh->indices[triIndex + 1]].position;
-                                glm::vec3 v2 = mesh->vertices[mesh->indices[triIndex + 2]].position;
+                                glm::vec3 v0 = mesh->GetPosition(mesh->GetIndex(triIndex + 0));
+                                glm::vec3 v1 = mesh->GetPosition(mesh->GetIndex(triIndex + 1));
+                                glm::vec3 v2 = mesh->GetPosition(mesh->GetIndex(triIndex + 2));
 
                                 if (pointInTriangle(pta, v0, v1, v2, colObj->GetGlobalScale()))
                                 {
@@ -375,9 +375,9 @@ void PhysicalWorld::Update()
 
                             for (size_t triIndex = 0; triIndex < mesh->indexCount; triIndex += 3)
                             {
-                                glm::vec3 v0 = mesh->vertices[mesh->indices[triIndex + 0]].position;
-                                glm::vec3 v1 = mesh->vertices[mesh->indices[triIndex + 1]].position;
-                                glm::vec3 v2 = mesh->vertices[mesh->indices[triIndex + 2]].position;
+                                glm::vec3 v0 = mesh->GetPosition(mesh->GetIndex(triIndex + 0));
+                                glm::vec3 v1 = mesh->GetPosition(mesh->GetIndex(triIndex + 1));
+                                glm::vec3 v2 = mesh->GetPosition(mesh->GetIndex(triIndex + 2));
                                 if (pointInTriangle(ptb, v0, v1, v2, colObj->GetGlobalScale()))
                                 {
                                     faceIdA = triIndex / 3;
@@ -34,8 +34,11 @@ tmt::render::Mesh* tmt::prim::GetPrimitive(PrimitiveType type)
             {
                 vertCount = cube_mesh::vertexCount_0;
                 indCount = cube_mesh::indexCount_0;
-                vertices = cube_mesh::vertices_0;
-                indices = cube_mesh::indices_0;
+                // Meshes own (and may release) their arrays, don't hand over the static data
+                vertices = new render::Vertex[vertCount];
+                indices = new u16[indCount];
+                std::copy(cube_mesh::vertices_0, cube_mesh::vertices_0 + vertCount, vertices);
+                std::copy(cube_mesh::indices_0, cube_mesh::indices_0 + indCount, indices);
             }
             break;
             case Sphere:
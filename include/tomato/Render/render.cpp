@@ -3,7 +3,32 @@
 #include "vertex.h"
 
 #include <ft2build.h>
+#include <bimg/bimg.h>
+#include <bx/file.h>
 #include <bx/timer.h>
+#include <glfw/deps/stb_image_write.h>
+#include <glm/gtc/packing.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <deque>
+#include <iomanip>
+#include <limits>
+#include <mutex>
+#include <ranges>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TM_OCCLUSION_SSE
+#define TM_POSE_SSE
+#define TM_SKIN_SSE
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define TM_POSE_NEON
+#define TM_SKIN_NEON
+#endif
 
 
 #include FT_FREETYPE_H
@@ -113,21 +138,50 @@ SubShader::SubShader(string name, ShaderType type)
     this->type = type;
     Reload();
 
+    // buildShader.py writes the declared keyword mask next to sources that have variants
+    std::ifstream manifest(GetPath(name) + ".variants");
+    if (manifest)
+        manifest >> declaredFeatures;
+
     fs::ResourceManager::pInstance->loaded_sub_shaders[name] = this;
+
+    var binaryPath = GetBinaryPath();
+    if (!binaryPath.empty())
+    {
+        ResMgr->Watch(binaryPath, this, [this, binaryPath]() -> std::function<void()>
+        {
+            var binary = fs::readToBuffer(binaryPath);
+            if (binary.empty())
+                return {};
+
+            return [this, binary]()
+            {
+                Reload(binary);
+
+                // Every program linked against the old handle has to be linked again
+                for (var shader : ResMgr->loaded_shaders | std::views::values)
+                {
+                    if (IN_VECTOR(shader->subShaders, this))
+                        shader->Relink();
+                }
+            };
+        });
+    }
 }
 
-ShaderUniform* SubShader::GetUniform(string name, bool force)
+ShaderUniform* SubShader::GetUniform(StringId id, bool force)
 {
     for (var uni : uniforms)
     {
-        if (uni->name == name)
+        if (uni->id == id)
             return uni;
     }
 
     if (force)
     {
         var ovr = new ShaderUniform();
-        ovr->name = name;
+        ovr->name = id.GetString();
+        ovr->id = id;
 
         return ovr;
     }
@@ -135,63 +189,49 @@ ShaderUniform* SubShader::GetUniform(string name, bool force)
     return {};
 }
 
-void SubShader::Reload()
+ShaderUniform* SubShader::GetUniform(const char* name, bool force)
 {
-    if (isLoaded && isValid(handle))
-    {
-        destroy(handle);
-        uniforms.clear();
-    }
-    isLoaded = true;
+    return GetUniform(string(name), force);
+}
 
-    string shaderPath = "";
+ShaderUniform* SubShader::GetUniform(const string& name, bool force)
+{
+    var uniform = GetUniform(StringId(name), force);
 
-    switch (tmgl::getRendererType())
-    {
-        case tmgl::RendererType::Noop:
-        case tmgl::RendererType::Direct3D11:
-        case tmgl::RendererType::Direct3D12:
-            shaderPath = "runtime/shaders/dx/";
-            break;
-        case tmgl::RendererType::OpenGL:
-            shaderPath = "runtime/shaders/gl/";
-            break;
-        case tmgl::RendererType::Vulkan:
-            shaderPath = "runtime/shaders/spirv/";
-            break;
-        // case tmgl::RendererType::Nvn:
-        // case tmgl::RendererType::WebGPU:
-        case tmgl::RendererType::Count:
-            handle = TMGL_INVALID_HANDLE;
-            return; // count included to keep compiler warnings happy
-    }
+    if (force && uniform)
+        uniform->name = name;
 
-    shaderPath += name;
+    return uniform;
+}
 
-    switch (type)
+void SubShader::Reload()
+{
+    var binaryPath = GetBinaryPath();
+
+    if (binaryPath.empty())
     {
-        case Vertex:
-            shaderPath += ".cvbsh";
-            break;
-        case Fragment:
-            shaderPath += ".cfbsh";
-            break;
-        case Compute:
-            shaderPath += ".ccbsh";
-            break;
-        // default: shaderPath += ".cbsh"; break;
+        isLoaded = true;
+        handle = TMGL_INVALID_HANDLE;
+        return;
     }
 
-    std::ifstream in(shaderPath, std::ifstream::ate | std::ifstream::binary);
-
-    in.seekg(0, std::ios::end);
-    std::streamsize size = in.tellg();
-    in.seekg(0, std::ios::beg);
+    Reload(fs::readToBuffer(binaryPath));
+}
 
-    const tmgl::Memory* mem = tmgl::alloc(size);
-    in.read(reinterpret_cast<char*>(mem->data), size);
+void SubShader::Reload(const std::vector<u8>& binary)
+{
+    if (isLoaded && isValid(handle))
+    {
+        destroy(handle);
+        for (auto uniform : uniforms)
+        {
+            delete uniform;
+        }
+        uniforms.clear();
+    }
+    isLoaded = true;
 
-    in.close();
+    const tmgl::Memory* mem = tmgl::copy(binary.data(), binary.size());
 
     handle = createShader(mem);
 
@@ -221,6 +261,7 @@ void SubShader::Reload()
             var uniform = new ShaderUniform();
 
             uniform->name = info.name;
+            uniform->id = uniform->name;
             uniform->type = info.type;
             uniform->handle = unis[i];
 
@@ -239,6 +280,8 @@ void SubShader::Reload()
 
 SubShader::~SubShader()
 {
+    ResMgr->Unwatch(this);
+
     destroy(handle);
     for (auto uniform : uniforms)
     {
@@ -246,8 +289,29 @@ SubShader::~SubShader()
     }
 }
 
-SubShader* SubShader::CreateSubShader(string name, ShaderType type)
+SubShader* SubShader::CreateSubShader(string name, ShaderType type, u32 features)
 {
+    if (features != 0)
+    {
+        var base = CreateSubShader(name, type);
+
+        features &= base->declaredFeatures;
+        if (features == 0)
+            return base;
+
+        var variantName = GetVariantName(name, features);
+        if (IN_MAP(ResMgr->loaded_sub_shaders, variantName))
+        {
+            return ResMgr->loaded_sub_shaders[variantName];
+        }
+
+        var variant = new SubShader(variantName, type);
+        variant->features = features;
+        variant->declaredFeatures = base->declaredFeatures;
+
+        return variant;
+    }
+
     if (IN_MAP(fs::ResourceManager::pInstance->loaded_sub_shaders, name))
     {
         return ResMgr->loaded_sub_shaders[name];
@@ -256,6 +320,60 @@ SubShader* SubShader::CreateSubShader(string name, ShaderType type)
     return new SubShader(name, type);
 }
 
+string SubShader::GetVariantName(const string& name, u32 features)
+{
+    if (features == 0)
+        return name;
+
+    return name + "_v" + std::to_string(features);
+}
+
+string SubShader::GetBinaryPath() const
+{
+    string shaderPath = GetPath(name);
+
+    if (shaderPath.empty())
+        return "";
+
+    switch (type)
+    {
+        case Vertex:
+            return shaderPath + ".cvbsh";
+        case Fragment:
+            return shaderPath + ".cfbsh";
+        case Compute:
+            return shaderPath + ".ccbsh";
+    }
+
+    return shaderPath;
+}
+
+string SubShader::GetPath(const string& name)
+{
+    string shaderPath = "";
+
+    switch (tmgl::getRendererType())
+    {
+        case tmgl::RendererType::Noop:
+        case tmgl::RendererType::Direct3D11:
+        case tmgl::RendererType::Direct3D12:
+            shaderPath = "runtime/shaders/dx/";
+            break;
+        case tmgl::RendererType::OpenGL:
+            shaderPath = "runtime/shaders/gl/";
+            break;
+        case tmgl::RendererType::Vulkan:
+            shaderPath = "runtime/shaders/spirv/";
+            break;
+        // case tmgl::RendererType::Nvn:
+        // case tmgl::RendererType::WebGPU:
+        case tmgl::RendererType::Count:
+            return ""; // count included to keep compiler warnings happy
+    }
+
+    return shaderPath + name;
+}
+
 Shader::Shader(ShaderInitInfo info)
 {
     program = createProgram(info.vertexProgram->handle, info.fragmentProgram->handle, false);
@@ -263,30 +381,41 @@ Shader::Shader(ShaderInitInfo info)
     subShaders.push_back(info.vertexProgram);
     subShaders.push_back(info.fragmentProgram);
     name = info.name;
+    sortId = ResMgr->loaded_shaders.size();
+
+    u32 compiled = 0;
+    for (auto sub_shader : subShaders)
+    {
+        declaredFeatures |= sub_shader->declaredFeatures;
+        compiled |= sub_shader->features;
+    }
+
+    if (declaredFeatures != 0)
+        features = compiled;
 
     ResMgr->loaded_shaders[info.name] = this;
 }
 
 void Shader::Push(int viewId, MaterialOverride* overrides, size_t oc)
 {
-    std::unordered_map<std::string, MaterialOverride> m_overrides;
-
-    if (overrides != nullptr)
-    {
-        m_overrides.reserve(oc); // Reserve space to avoid reallocation
-        for (size_t i = 0; i < oc; ++i)
-        {
-            m_overrides.emplace(overrides[i].name, overrides[i]);
-        }
-    }
-
     for (auto& shader : subShaders)
     {
         for (auto& uni : shader->uniforms)
         {
-            if (overrides != nullptr && m_overrides.contains(uni->name))
+            // Materials carry a handful of overrides, a scan over integer ids beats building a map per draw
+            MaterialOverride* match = nullptr;
+            for (size_t i = 0; overrides != nullptr && i < oc; ++i)
+            {
+                if (overrides[i].id == uni->id)
+                {
+                    match = &overrides[i];
+                    break;
+                }
+            }
+
+            if (match)
             {
-                const auto& ovr = m_overrides.at(uni->name);
+                const auto& ovr = *match;
                 uni->v4 = ovr.v4;
                 uni->m3 = ovr.m3;
                 uni->m4 = ovr.m4;
@@ -301,6 +430,30 @@ void Shader::Push(int viewId, MaterialOverride* overrides, size_t oc)
     submit(viewId, program);
 }
 
+Shader* Shader::GetVariant(u32 features)
+{
+    if (base)
+        return base->GetVariant(features);
+
+    features &= declaredFeatures;
+    if (features == 0)
+        return this;
+
+    if (IN_MAP(variants, features))
+        return variants[features];
+
+    ShaderInitInfo info = {
+        SubShader::CreateSubShader(subShaders[0]->name, SubShader::Vertex, features),
+        SubShader::CreateSubShader(subShaders[1]->name, SubShader::Fragment, features),
+        SubShader::GetVariantName(name, features)
+    };
+
+    var variant = CreateShader(info);
+    variant->base = this;
+    variants[features] = variant;
+
+    return variant;
+}
 
 Shader::~Shader()
 {
@@ -313,22 +466,26 @@ Shader::~Shader()
 
 void Shader::Reload()
 {
-    if (isValid(program))
-    {
-        destroy(program);
-    }
-
     for (auto sub_shader : subShaders)
     {
         sub_shader->Reload();
     }
 
-    program = createProgram(subShaders[0]->handle, subShaders[1]->handle, false);
-
+    Relink();
 
     std::cout << "Reloaded shader (" << name << ")" << std::endl;
 }
 
+void Shader::Relink()
+{
+    if (isValid(program))
+    {
+        destroy(program);
+    }
+
+    program = createProgram(subShaders[0]->handle, subShaders[1]->handle, false);
+}
+
 Shader* Shader::CreateShader(ShaderInitInfo info)
 {
     if (info.name == "UNDEFINED")
@@ -444,11 +601,11 @@ void MaterialState::SetWrite(u64 flag)
         writeZ = true;
 }
 
-MaterialOverride* Material::GetUniform(string name, bool force)
+MaterialOverride* Material::GetUniform(StringId id, bool force)
 {
     for (auto& override : overrides)
     {
-        if (override.name == name)
+        if (override.id == id)
         {
             return &override;
         }
@@ -457,7 +614,8 @@ MaterialOverride* Material::GetUniform(string name, bool force)
     if (force)
     {
         MaterialOverride ovr;
-        ovr.name = name;
+        ovr.name = id.GetString();
+        ovr.id = id;
         overrides.push_back(ovr);
         return &overrides.back();
     }
@@ -465,6 +623,21 @@ MaterialOverride* Material::GetUniform(string name, bool force)
     return nullptr;
 }
 
+MaterialOverride* Material::GetUniform(const char* name, bool force)
+{
+    return GetUniform(string(name), force);
+}
+
+MaterialOverride* Material::GetUniform(const string& name, bool force)
+{
+    var override = GetUniform(StringId(name), force);
+
+    if (force && override)
+        override->name = name;
+
+    return override;
+}
+
 
 u64 Material::GetMaterialState()
 {
@@ -484,6 +657,7 @@ u64 Material::GetMaterialState()
 
     v |= TMGL_STATE_BLEND_FUNC(state.srcAlpha, state.dstAlpha);
     v |= TMGL_STATE_BLEND_ALPHA;
+    v |= state.primitive;
 
 
     return v;
@@ -520,12 +694,13 @@ void Material::Reload(Shader* shader)
             {
                 for (auto textureOverride : texture_overrides)
                 {
-                    if (textureOverride.name == uniform->name)
+                    if (textureOverride.id == uniform->id)
                         continue;
                 }
 
                 var ovr = MaterialOverride();
                 ovr.name = uniform->name;
+                ovr.id = uniform->id;
                 ovr.shaderType = sub_shader->type;
                 ovr.type = uniform->type;
 
@@ -544,10 +719,23 @@ Material::~Material()
     delete[] overrides.data();
 }
 
+u32 registerMesh(Mesh* mesh)
+{
+    mesh->handle = meshTable.size();
+    meshTable.push_back(mesh);
+
+    return mesh->handle;
+}
+
 Mesh::~Mesh()
 {
-    destroy(ibh);
-    destroy(vbh);
+    if (arena)
+        arena->Free(this);
+    else if (ownsBuffers)
+    {
+        destroy(ibh);
+        destroy(vbh);
+    }
     for (auto vertex_buffer : vertexBuffers)
     {
         destroy(vertex_buffer);
@@ -555,11 +743,44 @@ Mesh::~Mesh()
     destroy(indexBuffer);
 
     delete[] vertices;
-    delete[] indices;
+    delete[] positions;
+    delete[] quantizedPositions;
+    if (indexSize == sizeof(u32))
+        delete[] static_cast<u32*>(indices);
+    else
+        delete[] static_cast<u16*>(indices);
+
+    if (handle < meshTable.size())
+        meshTable[handle] = nullptr;
 }
 
-void Mesh::use()
+void Mesh::use(u32 chunk)
 {
+    if (arena)
+    {
+        if (chunk < chunks.size())
+        {
+            const var& range = chunks[chunk];
+            setVertexBuffer(0, arena->vertexBuffer, baseVertex + range.baseVertex, range.vertexCount);
+            setIndexBuffer(arena->indexBuffer, firstIndex + range.firstIndex, range.indexCount);
+        }
+        else
+        {
+            setVertexBuffer(0, arena->vertexBuffer, baseVertex, vertexCount);
+            setIndexBuffer(arena->indexBuffer, firstIndex, indexCount);
+        }
+
+        return;
+    }
+
+    if (chunk < chunks.size())
+    {
+        const var& range = chunks[chunk];
+        setVertexBuffer(0, vbh, range.baseVertex, range.vertexCount);
+        setIndexBuffer(ibh, range.firstIndex, range.indexCount);
+        return;
+    }
+
     if (origin == mo_loaded)
     {
         setVertexBuffer(0, vbh, 0, vertexCount);
@@ -567,115 +788,564 @@ void Mesh::use()
     }
     else
     {
-        setVertexBuffer(0, vertexBuffers[0], 0, vertexCount);
-        setIndexBuffer(indexBuffer, 0, indexCount);
+        setVertexBuffer(0, vertexBuffers[0], baseVertex, vertexCount);
+        setIndexBuffer(indexBuffer, firstIndex, indexCount);
     }
 }
 
-void Mesh::draw(glm::mat4 transform, Material* material, glm::vec3 spos, u32 layer, u32 renderLayer,
-                std::vector<glm::mat4> anims)
+glm::vec3 Mesh::GetPosition(u32 vertex) const
 {
-    var drawCall = DrawCall();
-
-    drawCall.mesh = this;
-    drawCall.state = material->GetMaterialState();
-    drawCall.matrixMode = material->state.matrixMode;
-    drawCall.sortedPosition = spos;
-    drawCall.layer = math::packU32ToU64(renderLayer, layer);
+    if (vertices)
+        return vertices[vertex].position;
 
-    //drawCall.transformMatrices = std::vector<MatrixArray>(MAX_BONE_MATRICES + 1);
-    drawCall.transformMatrix = transform;
+    if (positions)
+        return positions[vertex];
 
-    drawCall.animationMatrices = anims;
-    /*
-    for (int i = 0; i < anims.size(); ++i)
+    if (quantizedPositions)
     {
-        var m = anims[i];
-        drawCall.transformMatrices[i + 1] = GetMatrixArray(m);
+        var q = glm::vec3(quantizedPositions[vertex * 3 + 0], quantizedPositions[vertex * 3 + 1],
+                          quantizedPositions[vertex * 3 + 2]) / 65535.0f;
+        return bounds.min + q * (bounds.max - bounds.min);
     }
-    
 
-    
-    for (int i = anims.size(); i < MAX_BONE_MATRICES; ++i)
+    return glm::vec3(0);
+}
+
+void Mesh::ReleaseCpuData(MeshCpuData keep)
+{
+    if (keep == mc_keepAll || !vertices)
+        return;
+
+    if (keep == mc_keepPositions)
     {
-        drawCall.transformMatrices[i + 1] = GetMatrixArray(glm::mat4(1.0));
+        positions = new glm::vec3[vertexCount];
+        for (size_t i = 0; i < vertexCount; ++i)
+        {
+            positions[i] = vertices[i].position;
+        }
     }
-    */
+    else if (keep == mc_keepQuantized && bounds.IsValid())
+    {
+        var extent = glm::max(bounds.max - bounds.min, glm::vec3(FLT_EPSILON));
+
+        quantizedPositions = new u16[vertexCount * 3];
+        for (size_t i = 0; i < vertexCount; ++i)
+        {
+            var q = (vertices[i].position - bounds.min) / extent * 65535.0f + 0.5f;
+            quantizedPositions[i * 3 + 0] = static_cast<u16>(q.x);
+            quantizedPositions[i * 3 + 1] = static_cast<u16>(q.y);
+            quantizedPositions[i * 3 + 2] = static_cast<u16>(q.z);
+        }
+    }
+
+    delete[] vertices;
+    vertices = nullptr;
 
+    if (keep == mc_keepNone)
+    {
+        if (indexSize == sizeof(u32))
+            delete[] static_cast<u32*>(indices);
+        else
+            delete[] static_cast<u16*>(indices);
 
-    drawCall.matrixCount = anims.size();
+        indices = nullptr;
+    }
+}
 
-    drawCall.program = material->shader;
-    if (material->overrides.size() > 0)
+u32 GeometryArena::RangeAllocator::Allocate(u32 count)
+{
+    for (size_t i = 0; i < freeRanges.size(); ++i)
     {
-        auto _overrides = new MaterialOverride[material->overrides.size()];
+        var& range = freeRanges[i];
+        if (range.count < count)
+            continue;
+
+        u32 offset = range.offset;
+        range.offset += count;
+        range.count -= count;
 
-        std::copy(material->overrides.begin(), material->overrides.end(), _overrides);
+        if (range.count == 0)
+            freeRanges.erase(freeRanges.begin() + i);
 
-        drawCall.overrides = _overrides;
-        drawCall.overrideCt = material->overrides.size();
+        return offset;
     }
-    else
-        drawCall.overrides = nullptr;
 
-    pushDrawCall(drawCall);
+    Grow(std::max(capacity * 2, capacity + count));
+    return Allocate(count);
 }
 
-Texture* Model::GetTextureFromName(string name)
+void GeometryArena::RangeAllocator::Free(u32 offset, u32 count)
 {
+    if (count == 0)
+        return;
 
-    for (Texture* tex : textures)
+    var it = std::lower_bound(freeRanges.begin(), freeRanges.end(), offset,
+                              [](const Range& range, u32 value) { return range.offset < value; });
+    it = freeRanges.insert(it, Range{offset, count});
+
+    // Merge with the following range, then the previous one
+    if (it + 1 != freeRanges.end() && it->offset + it->count == (it + 1)->offset)
     {
-        if (tex->name == name)
-            return tex;
+        it->count += (it + 1)->count;
+        freeRanges.erase(it + 1);
     }
 
-    return nullptr;
+    if (it != freeRanges.begin() && (it - 1)->offset + (it - 1)->count == it->offset)
+    {
+        (it - 1)->count += it->count;
+        freeRanges.erase(it);
+    }
 }
 
-Material* Model::CreateMaterial(int index, Shader* shader)
+void GeometryArena::RangeAllocator::Grow(u32 newCapacity)
 {
-    return CreateMaterial(materials[index], shader);
+    if (newCapacity <= capacity)
+        return;
+
+    u32 oldCapacity = capacity;
+    capacity = newCapacity;
+
+    Free(oldCapacity, newCapacity - oldCapacity);
 }
 
-Material* Model::CreateMaterial(MaterialDescription* materialDesc, Shader* shader)
+GeometryArena::GeometryArena(const tmgl::VertexLayout& layout)
 {
-    var material = new Material(shader);
+    this->layout = layout;
 
-    material->name = materialDesc->Name;
-    material->GetUniform("u_color", true)->v4 = Color::White.getData();
+    // Buffers resize on update, the allocators just track which ranges are used
+    vertices.Grow(1 << 16);
+    indices.Grow(1 << 18);
 
-    for (auto [uniform, texture] : materialDesc->Textures)
-    {
-        var t = GetTextureFromName(texture);
-        var uni = material->GetUniform(uniform, true);
-        uni->type = tmgl::UniformType::Sampler;
-        uni->tex = t;
-    }
+    vertexBuffer = createDynamicVertexBuffer(vertices.capacity, layout, TMGL_BUFFER_ALLOW_RESIZE);
+    indexBuffer = createDynamicIndexBuffer(indices.capacity, TMGL_BUFFER_ALLOW_RESIZE);
 
-    return material;
+    geometryArenas.push_back(this);
 }
 
-Animation* Model::GetAnimation(string name)
+GeometryArena* GeometryArena::Get(const tmgl::VertexLayout& layout)
 {
-    for (auto animation : animations)
+    // VertexLayout is plain data filled deterministically by begin()/add()/end()
+    for (auto arena : geometryArenas)
     {
-        if (animation->name == name)
-            return animation;
+        if (std::memcmp(&arena->layout, &layout, sizeof(tmgl::VertexLayout)) == 0)
+            return arena;
     }
-    return nullptr;
+
+    return new GeometryArena(layout);
 }
 
-int Model::GetAnimationIndex(string name)
+void GeometryArena::Allocate(Mesh* mesh, const void* vertexData, const u16* indexData)
 {
-    int i = 0;
-    for (auto animation : animations)
-    {
-        if (animation->name == name)
-            return i;
-        i++;
-    }
-    return -1;
+    mesh->arena = this;
+    mesh->baseVertex = vertices.Allocate(mesh->vertexCount);
+    mesh->firstIndex = indices.Allocate(mesh->indexCount);
+
+    update(vertexBuffer, mesh->baseVertex, tmgl::copy(vertexData, mesh->vertexCount * layout.getStride()));
+    update(indexBuffer, mesh->firstIndex, tmgl::copy(indexData, mesh->indexCount * sizeof(u16)));
+
+    meshes.push_back(mesh);
+}
+
+void GeometryArena::Free(Mesh* mesh)
+{
+    var it = VEC_FIND(meshes, mesh);
+    if (it == meshes.end())
+        return;
+
+    vertices.Free(mesh->baseVertex, mesh->vertexCount);
+    indices.Free(mesh->firstIndex, mesh->indexCount);
+
+    meshes.erase(it);
+    mesh->arena = nullptr;
+}
+
+void GeometryArena::Defragment()
+{
+    var sorted = meshes;
+    u32 cursor = 0;
+
+    std::sort(sorted.begin(), sorted.end(), [](Mesh* a, Mesh* b) { return a->baseVertex < b->baseVertex; });
+
+    vertices.freeRanges.clear();
+    for (auto mesh : sorted)
+    {
+        if (mesh->baseVertex > cursor && mesh->vertices)
+        {
+            mesh->baseVertex = cursor;
+            update(vertexBuffer, cursor, tmgl::copy(mesh->vertices, mesh->vertexCount * layout.getStride()));
+        }
+
+        if (mesh->baseVertex > cursor)
+            vertices.freeRanges.push_back({cursor, mesh->baseVertex - cursor});
+
+        cursor = mesh->baseVertex + mesh->vertexCount;
+    }
+
+    if (cursor < vertices.capacity)
+        vertices.freeRanges.push_back({cursor, vertices.capacity - cursor});
+
+    cursor = 0;
+    std::sort(sorted.begin(), sorted.end(), [](Mesh* a, Mesh* b) { return a->firstIndex < b->firstIndex; });
+
+    indices.freeRanges.clear();
+    for (auto mesh : sorted)
+    {
+        if (mesh->firstIndex > cursor && mesh->indices)
+        {
+            mesh->firstIndex = cursor;
+            update(indexBuffer, cursor, tmgl::copy(mesh->indices, mesh->indexCount * sizeof(u16)));
+        }
+
+        if (mesh->firstIndex > cursor)
+            indices.freeRanges.push_back({cursor, mesh->firstIndex - cursor});
+
+        cursor = mesh->firstIndex + mesh->indexCount;
+    }
+
+    if (cursor < indices.capacity)
+        indices.freeRanges.push_back({cursor, indices.capacity - cursor});
+
+    pinnedVertexHoles = vertices.freeRanges.size();
+    pinnedIndexHoles = indices.freeRanges.size();
+}
+
+bool GeometryArena::NeedsDefragment() const
+{
+    // Holes next to meshes without CPU copies survive every pass, only new ones are worth another
+    return vertices.freeRanges.size() > pinnedVertexHoles + 64 || indices.freeRanges.size() > pinnedIndexHoles + 64;
+}
+
+std::vector<SkinnedMeshCache*> pendingSkinCaches;
+
+constexpr u32 SKIN_BATCH_VERTICES = 2048;
+
+bool SkinnedMeshCache::CanCache(const Mesh* mesh)
+{
+    return mesh && mesh->arena && mesh->vertices && mesh->indices && mesh->indexSize == sizeof(u16);
+}
+
+SkinnedMeshCache::SkinnedMeshCache(Mesh* source)
+{
+    this->source = source;
+
+    if (!CanCache(source))
+    {
+        std::cout << "Mesh " << source->name << " can't be skinned on the CPU, it needs its vertices and 16-bit "
+                  << "indices in an arena" << std::endl;
+        return;
+    }
+
+    // Starts out in the bind pose, without bone data the static variant draws it as is
+    skinned.assign(source->vertices, source->vertices + source->vertexCount);
+    for (auto& vertex : skinned)
+    {
+        vertex.boneIds = glm::vec4(-1);
+        vertex.boneWeights = glm::vec4(0);
+    }
+
+    mesh = new Mesh();
+    mesh->vertexCount = source->vertexCount;
+    mesh->indexCount = source->indexCount;
+    mesh->chunks = source->chunks;
+    mesh->bounds = source->bounds;
+    mesh->name = source->name + "_skinned";
+
+    // No CPU vertices, so defragmenting never moves the range from under the uploads
+    source->arena->Allocate(mesh, skinned.data(), static_cast<u16*>(source->indices));
+    registerMesh(mesh);
+}
+
+SkinnedMeshCache::~SkinnedMeshCache()
+{
+    if (queued)
+        std::erase(pendingSkinCaches, this);
+
+    delete mesh;
+}
+
+bool SkinnedMeshCache::SetPalette(const std::vector<glm::mat4>& palette)
+{
+    if (!mesh)
+        return false;
+
+    if (this->palette.size() == palette.size() &&
+        std::memcmp(this->palette.data(), palette.data(), palette.size() * sizeof(glm::mat4)) == 0)
+        return false;
+
+    this->palette.assign(palette.begin(), palette.end());
+
+    if (!queued)
+        pendingSkinCaches.push_back(this);
+
+    queued = true;
+    return true;
+}
+
+#ifdef TM_SKIN_SSE
+static __m128 cross3(__m128 a, __m128 b)
+{
+    __m128 ayzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 byzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 c = _mm_sub_ps(_mm_mul_ps(a, byzx), _mm_mul_ps(ayzx, b));
+
+    return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+#endif
+
+// Same blend as the SKINNED vertex shader: palette matrices summed by weight, positions through the sum and
+// normals through its cofactor. Ids outside the palette count as unweighted
+static void skinVertices(const Vertex* in, Vertex* out, u32 count, const glm::mat4* palette, u32 paletteSize,
+                         math::AABB& bounds)
+{
+    for (u32 v = 0; v < count; ++v)
+    {
+        const var& src = in[v];
+        var& dst = out[v];
+
+        glm::vec3 position, normal;
+
+#if defined(TM_SKIN_SSE)
+        __m128 c0 = _mm_setzero_ps(), c1 = _mm_setzero_ps(), c2 = _mm_setzero_ps(), c3 = _mm_setzero_ps();
+        for (int k = 0; k < 4; ++k)
+        {
+            int id = static_cast<int>(src.boneIds[k]);
+            if (src.boneWeights[k] == 0 || id < 0 || id >= static_cast<int>(paletteSize))
+                continue;
+
+            const float* m = value_ptr(palette[id]);
+            __m128 w = _mm_set1_ps(src.boneWeights[k]);
+
+            c0 = _mm_add_ps(c0, _mm_mul_ps(_mm_loadu_ps(m), w));
+            c1 = _mm_add_ps(c1, _mm_mul_ps(_mm_loadu_ps(m + 4), w));
+            c2 = _mm_add_ps(c2, _mm_mul_ps(_mm_loadu_ps(m + 8), w));
+            c3 = _mm_add_ps(c3, _mm_mul_ps(_mm_loadu_ps(m + 12), w));
+        }
+
+        __m128 p = _mm_add_ps(c3, _mm_mul_ps(c0, _mm_set1_ps(src.position.x)));
+        p = _mm_add_ps(p, _mm_mul_ps(c1, _mm_set1_ps(src.position.y)));
+        p = _mm_add_ps(p, _mm_mul_ps(c2, _mm_set1_ps(src.position.z)));
+
+        __m128 n = _mm_mul_ps(cross3(c1, c2), _mm_set1_ps(src.normal.x));
+        n = _mm_add_ps(n, _mm_mul_ps(cross3(c2, c0), _mm_set1_ps(src.normal.y)));
+        n = _mm_add_ps(n, _mm_mul_ps(cross3(c0, c1), _mm_set1_ps(src.normal.z)));
+
+        alignas(16) float pf[4], nf[4];
+        _mm_store_ps(pf, p);
+        _mm_store_ps(nf, n);
+
+        position = glm::vec3(pf[0], pf[1], pf[2]);
+        normal = glm::vec3(nf[0], nf[1], nf[2]);
+#elif defined(TM_SKIN_NEON)
+        float32x4_t c0 = vdupq_n_f32(0), c1 = vdupq_n_f32(0), c2 = vdupq_n_f32(0), c3 = vdupq_n_f32(0);
+        for (int k = 0; k < 4; ++k)
+        {
+            int id = static_cast<int>(src.boneIds[k]);
+            if (src.boneWeights[k] == 0 || id < 0 || id >= static_cast<int>(paletteSize))
+                continue;
+
+            const float* m = value_ptr(palette[id]);
+            float w = src.boneWeights[k];
+
+            c0 = vmlaq_n_f32(c0, vld1q_f32(m), w);
+            c1 = vmlaq_n_f32(c1, vld1q_f32(m + 4), w);
+            c2 = vmlaq_n_f32(c2, vld1q_f32(m + 8), w);
+            c3 = vmlaq_n_f32(c3, vld1q_f32(m + 12), w);
+        }
+
+        float32x4_t p = vmlaq_n_f32(c3, c0, src.position.x);
+        p = vmlaq_n_f32(p, c1, src.position.y);
+        p = vmlaq_n_f32(p, c2, src.position.z);
+
+        float cf[12];
+        vst1q_f32(cf, c0);
+        vst1q_f32(cf + 4, c1);
+        vst1q_f32(cf + 8, c2);
+
+        glm::vec3 a(cf[0], cf[1], cf[2]), b(cf[4], cf[5], cf[6]), c(cf[8], cf[9], cf[10]);
+
+        position = glm::vec3(vgetq_lane_f32(p, 0), vgetq_lane_f32(p, 1), vgetq_lane_f32(p, 2));
+        normal = cross(b, c) * src.normal.x + cross(c, a) * src.normal.y + cross(a, b) * src.normal.z;
+#else
+        glm::mat4 skin(0.0f);
+        for (int k = 0; k < 4; ++k)
+        {
+            int id = static_cast<int>(src.boneIds[k]);
+            if (src.boneWeights[k] != 0 && id >= 0 && id < static_cast<int>(paletteSize))
+                skin += palette[id] * src.boneWeights[k];
+        }
+
+        glm::vec3 a(skin[0]), b(skin[1]), c(skin[2]);
+
+        position = glm::vec3(skin * glm::vec4(src.position, 1.0f));
+        normal = cross(b, c) * src.normal.x + cross(c, a) * src.normal.y + cross(a, b) * src.normal.z;
+#endif
+
+        float length = glm::length(normal);
+
+        dst.position = position;
+        dst.normal = length > 0 ? normal / length : src.normal;
+
+        bounds.Expand(position);
+    }
+}
+
+void tmt::render::skinMeshCaches()
+{
+    if (pendingSkinCaches.empty())
+        return;
+
+    // Split into fixed size batches so one large mesh spreads across every worker
+    struct SkinBatch
+    {
+        SkinnedMeshCache* cache;
+        u32 first, count;
+        math::AABB bounds;
+    };
+
+    std::vector<SkinBatch> batches;
+    for (auto cache : pendingSkinCaches)
+    {
+        u32 count = cache->source->vertexCount;
+        for (u32 first = 0; first < count; first += SKIN_BATCH_VERTICES)
+        {
+            batches.push_back({cache, first, std::min(SKIN_BATCH_VERTICES, count - first)});
+        }
+    }
+
+    job::parallelFor(batches.size(), [&batches](u32 i)
+    {
+        var& batch = batches[i];
+        const var& palette = batch.cache->palette;
+
+        skinVertices(batch.cache->source->vertices + batch.first, batch.cache->skinned.data() + batch.first,
+                     batch.count, palette.data(), palette.size(), batch.bounds);
+    });
+
+    for (auto cache : pendingSkinCaches)
+    {
+        cache->mesh->bounds = math::AABB();
+    }
+
+    for (const auto& batch : batches)
+    {
+        var& bounds = batch.cache->mesh->bounds;
+        if (!batch.bounds.IsValid())
+            continue;
+
+        bounds.Expand(batch.bounds.min);
+        bounds.Expand(batch.bounds.max);
+    }
+
+    for (auto cache : pendingSkinCaches)
+    {
+        var mesh = cache->mesh;
+        update(mesh->arena->vertexBuffer, mesh->baseVertex,
+               tmgl::copy(cache->skinned.data(), mesh->vertexCount * mesh->arena->layout.getStride()));
+
+        cache->queued = false;
+    }
+
+    pendingSkinCaches.clear();
+}
+
+u32 Mesh::GetIndex(size_t i) const
+{
+    if (!indices)
+        return 0;
+
+    if (indexSize == sizeof(u32))
+        return static_cast<u32*>(indices)[i];
+
+    u32 index = static_cast<u16*>(indices)[i];
+
+    for (const auto& chunk : chunks)
+    {
+        if (i >= chunk.firstIndex && i < chunk.firstIndex + chunk.indexCount)
+            return index + chunk.baseVertex;
+    }
+
+    return index;
+}
+
+void Mesh::draw(glm::mat4 transform, Material* material, glm::vec3 spos, u32 layer, u32 renderLayer,
+                std::vector<glm::mat4> anims)
+{
+    var drawCall = DrawCall();
+
+    drawCall.mesh = handle;
+    drawCall.matrixMode = material->state.matrixMode;
+    drawCall.sortKey = math::packU32ToU64(renderLayer, layer);
+
+    pushDrawCall(drawCall, material, transform, anims);
+}
+
+void Mesh::drawInstanced(const std::vector<glm::mat4>& transforms, const std::vector<glm::vec4>& parameters,
+                         Material* material, u32 layer, u32 renderLayer)
+{
+    var drawCall = DrawCall();
+
+    drawCall.mesh = handle;
+    drawCall.matrixMode = material->state.matrixMode;
+    drawCall.sortKey = math::packU32ToU64(renderLayer, layer);
+
+    pushInstancedDrawCall(drawCall, material, transforms, parameters);
+}
+
+Texture* Model::GetTextureFromName(string name)
+{
+
+    for (Texture* tex : textures)
+    {
+        if (tex->name == name)
+            return tex;
+    }
+
+    return nullptr;
+}
+
+Material* Model::CreateMaterial(int index, Shader* shader)
+{
+    return CreateMaterial(materials[index], shader);
+}
+
+Material* Model::CreateMaterial(MaterialDescription* materialDesc, Shader* shader)
+{
+    var material = new Material(shader);
+
+    material->name = materialDesc->Name;
+    material->GetUniform("u_color", true)->v4 = Color::White.getData();
+
+    for (auto [uniform, texture] : materialDesc->Textures)
+    {
+        var t = GetTextureFromName(texture);
+        var uni = material->GetUniform(uniform, true);
+        uni->type = tmgl::UniformType::Sampler;
+        uni->tex = t;
+    }
+
+    return material;
+}
+
+Animation* Model::GetAnimation(string name)
+{
+    for (auto animation : animations)
+    {
+        if (animation->name == name)
+            return animation;
+    }
+    return nullptr;
+}
+
+int Model::GetAnimationIndex(string name)
+{
+    int i = 0;
+    for (auto animation : animations)
+    {
+        if (animation->name == name)
+            return i;
+        i++;
+    }
+    return -1;
 }
 
 MaterialDescription* Model::GetMaterial(string name)
@@ -1018,7 +1688,10 @@ std::vector<SceneDescription::Node*> SceneDescription::Node::GetAllChildren()
 
 }
 
-SceneDescription::SceneDescription(string path)
+static constexpr u32 SCENE_IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_GenSmoothNormals |
+                                          aiProcess_PopulateArmatureData;
+
+SceneDescription::SceneDescription(string path, const aiScene* imported)
 {
 
     if (!std::filesystem::exists(path))
@@ -1047,15 +1720,19 @@ SceneDescription::SceneDescription(string path)
             models.push_back(new Model(reader, this));
         }
 
+        // Older files end after the models
+        if (static_cast<size_t>(reader->tellg()) + 4 <= reader->fileSize && reader->CheckSignature("TCEL"))
+        {
+            cells = new CellGraph(reader);
+        }
+
         reader->close();
         delete reader;
     }
     else
     {
         Assimp::Importer import;
-        const aiScene* scene = import.ReadFile(path,
-                                               aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_GenSmoothNormals |
-                                               aiProcess_PopulateArmatureData);
+        const aiScene* scene = imported ? imported : import.ReadFile(path, SCENE_IMPORT_FLAGS);
 
         if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
         {
@@ -1112,50 +1789,562 @@ tmt::obj::Object* SceneDescription::ToObject()
     return root;
 }
 
-SceneDescription::~SceneDescription()
+static void deleteNodes(SceneDescription::Node* node)
 {
-    models.clear();
+    for (auto child : node->children)
+    {
+        deleteNodes(child);
+    }
+
+    delete node;
 }
 
-SceneDescription* SceneDescription::CreateSceneDescription(string path)
+SceneDescription::~SceneDescription()
 {
-    if (ResMgr->loaded_scene_descs.contains(path))
+    ResMgr->Unwatch(this);
+
+    if (ResMgr->loaded_scene_descs.contains(path) && ResMgr->loaded_scene_descs[path] == this)
+        ResMgr->loaded_scene_descs.erase(path);
+
+    if (renderer && renderer->cellGraph == cells)
+        renderer->cellGraph = nullptr;
+
+    delete cells;
+
+    for (auto model : models)
     {
-        return ResMgr->loaded_scene_descs[path];
+        delete model;
     }
+    models.clear();
 
-    return new SceneDescription(path);
+    if (rootNode)
+        deleteNodes(rootNode);
 }
 
-BoneObject::BoneObject(Skeleton::Bone* bone)
+CellGraph::CellGraph(fs::BinaryReader* reader)
 {
-    this->bone = bone;
-    name = bone->name;
-    position = bone->position;
-    rotation = bone->rotation;
-    scale = bone->scale;
-}
+    var cellCount = reader->ReadInt32();
 
-void BoneObject::Load(SceneDescription::Node* node)
-{
-    for (auto child : node->children)
+    for (int i = 0; i < cellCount; ++i)
     {
-        if (child->isBone)
+        Cell cell;
+        cell.name = reader->ReadString();
+        cell.bounds.min = reader->ReadVec3();
+        cell.bounds.max = reader->ReadVec3();
+
+        cells.push_back(cell);
+    }
+
+    var portalCount = reader->ReadInt32();
+
+    for (int i = 0; i < portalCount; ++i)
+    {
+        Portal portal;
+        portal.cells[0] = reader->ReadInt32();
+        portal.cells[1] = reader->ReadInt32();
+
+        for (auto& corner : portal.corners)
         {
-            var bone = new BoneObject();
-            bone->name = child->name;
-            bone->position = child->position;
-            bone->rotation = (child->rotation);
-            bone->scale = child->scale;
-            bone->Load(child);
-            bone->SetParent(this);
+            corner = reader->ReadVec3();
         }
+
+        AddPortal(portal);
     }
 }
 
-glm::mat4 BoneObject::GetGlobalOffsetMatrix()
+void CellGraph::AddPortal(const Portal& portal)
 {
-    var offset = GetOffsetMatrix();
+    if (portal.cells[0] >= cells.size() || portal.cells[1] >= cells.size())
+        return;
+
+    u32 index = portals.size();
+    portals.push_back(portal);
+
+    cells[portal.cells[0]].portals.push_back(index);
+    if (portal.cells[1] != portal.cells[0])
+        cells[portal.cells[1]].portals.push_back(index);
+}
+
+u32 CellGraph::FindCell(const glm::vec3& point) const
+{
+    u32 found = -1;
+    float foundVolume = FLT_MAX;
+
+    // Nested cells (a closet inside a hall) resolve to the innermost one
+    for (u32 i = 0; i < cells.size(); ++i)
+    {
+        const var& bounds = cells[i].bounds;
+
+        if (glm::any(glm::lessThan(point, bounds.min)) || glm::any(glm::greaterThan(point, bounds.max)))
+            continue;
+
+        var size = bounds.max - bounds.min;
+        float volume = size.x * size.y * size.z;
+
+        if (volume < foundVolume)
+        {
+            found = i;
+            foundVolume = volume;
+        }
+    }
+
+    return found;
+}
+
+// Keeps the part of the polygon where dot(n, p) + d >= 0
+static void clipPolygon(std::vector<glm::vec3>& polygon, const glm::vec4& plane)
+{
+    std::vector<glm::vec3> clipped;
+
+    for (size_t i = 0; i < polygon.size(); ++i)
+    {
+        const var& a = polygon[i];
+        const var& b = polygon[(i + 1) % polygon.size()];
+
+        float da = glm::dot(glm::vec3(plane), a) + plane.w;
+        float db = glm::dot(glm::vec3(plane), b) + plane.w;
+
+        if (da >= 0)
+            clipped.push_back(a);
+
+        if ((da >= 0) != (db >= 0))
+            clipped.push_back(a + (b - a) * (da / (da - db)));
+    }
+
+    polygon = std::move(clipped);
+}
+
+// Bounds the walk in graphs with many loops, each extra portal only narrows the view further
+static constexpr u32 maxPortalDepth = 16;
+
+// Portal edge planes a cell has already been flooded through, and the walk that got there
+struct CellEntry
+{
+    std::vector<glm::vec4> edges;
+    // Cells the walk into it couldn't go back through, its length also bounds how deep it went
+    std::vector<u32> path;
+};
+
+using CellEntries = std::vector<std::vector<CellEntry>>;
+
+// True when every point is inside the planes, i.e. the view through them is at least as wide
+static bool insidePlanes(const std::vector<glm::vec3>& polygon, const std::vector<glm::vec4>& planes)
+{
+    for (const auto& plane : planes)
+    {
+        for (const auto& point : polygon)
+        {
+            if (glm::dot(glm::vec3(plane), point) + plane.w < -1e-4f)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+// planes always starts with the camera's six frustum planes, followed by the current portal's edges
+static void floodCells(const CellGraph& graph, u32 cell, const glm::vec3& eye, const std::vector<glm::vec4>& planes,
+                       std::vector<u8>& visible, std::vector<u32>& path, CellEntries& entered)
+{
+    visible[cell] = true;
+
+    if (path.size() >= maxPortalDepth)
+        return;
+
+    path.push_back(cell);
+
+    for (u32 index : graph.cells[cell].portals)
+    {
+        const var& portal = graph.portals[index];
+        u32 next = portal.cells[0] == cell ? portal.cells[1] : portal.cells[0];
+
+        if (IN_VECTOR(path, next))
+            continue;
+
+        std::vector<glm::vec3> polygon(std::begin(portal.corners), std::end(portal.corners));
+        for (const auto& plane : planes)
+        {
+            clipPolygon(polygon, plane);
+            if (polygon.size() < 3)
+                break;
+        }
+
+        if (polygon.size() < 3)
+            continue;
+
+        // Standing in the doorway the portal's edges would pass through the eye, keep the current view
+        var normal = glm::cross(portal.corners[1] - portal.corners[0], portal.corners[2] - portal.corners[0]);
+        if (glm::length(normal) > 0 && std::abs(glm::dot(glm::normalize(normal), eye - portal.corners[0])) < 0.01f)
+        {
+            floodCells(graph, next, eye, planes, visible, path, entered);
+            continue;
+        }
+
+        // Densely connected graphs reach the same cell along many paths. An earlier walk into it saw everything
+        // this one can when its view was at least as wide, it skipped no cell this path doesn't also skip and
+        // it had as much depth left
+        bool covered = false;
+        for (const auto& entry : entered[next])
+        {
+            if (entry.path.size() > path.size() || !insidePlanes(polygon, entry.edges))
+                continue;
+
+            covered = std::ranges::all_of(entry.path, [&path](u32 visited) { return IN_VECTOR(path, visited); });
+            if (covered)
+                break;
+        }
+
+        if (covered)
+            continue;
+
+        var center = glm::vec3(0);
+        for (const auto& point : polygon)
+        {
+            center += point;
+        }
+        center /= static_cast<float>(polygon.size());
+
+        std::vector<glm::vec4> narrowed(planes.begin(), planes.begin() + 6);
+
+        for (size_t i = 0; i < polygon.size(); ++i)
+        {
+            var edgeNormal = glm::cross(polygon[i] - eye, polygon[(i + 1) % polygon.size()] - eye);
+            float length = glm::length(edgeNormal);
+            if (length < 1e-6f)
+                continue;
+
+            edgeNormal /= length;
+            var plane = glm::vec4(edgeNormal, -glm::dot(edgeNormal, eye));
+
+            if (glm::dot(edgeNormal, center) + plane.w < 0)
+                plane = -plane;
+
+            narrowed.push_back(plane);
+        }
+
+        entered[next].push_back({std::vector<glm::vec4>(narrowed.begin() + 6, narrowed.end()), path});
+
+        floodCells(graph, next, eye, narrowed, visible, path, entered);
+    }
+
+    path.pop_back();
+}
+
+void CellGraph::GatherVisible(const glm::vec3& eye, const math::Frustum& frustum, std::vector<u8>& visible) const
+{
+    visible.clear();
+
+    var start = FindCell(eye);
+    if (start == static_cast<u32>(-1))
+        return;
+
+    visible.resize(cells.size(), false);
+
+    std::vector<glm::vec4> planes(std::begin(frustum.planes), std::end(frustum.planes));
+    std::vector<u32> path;
+    CellEntries entered(cells.size());
+
+    floodCells(*this, start, eye, planes, visible, path, entered);
+}
+
+// Swaps everything but the mesh's identity (model, idx and meshTable handle) between the two
+static void swapMeshData(Mesh* a, Mesh* b)
+{
+    // Arenas find their meshes by pointer, the ranges follow the data
+    std::vector<GeometryArena*> arenas;
+    for (auto arena : {a->arena, b->arena})
+    {
+        if (arena && !IN_VECTOR(arenas, arena))
+            arenas.push_back(arena);
+    }
+
+    for (auto arena : arenas)
+    {
+        for (auto& mesh : arena->meshes)
+        {
+            if (mesh == a)
+                mesh = b;
+            else if (mesh == b)
+                mesh = a;
+        }
+    }
+
+    std::swap(a->ibh, b->ibh);
+    std::swap(a->vbh, b->vbh);
+    std::swap(a->vertexBuffers, b->vertexBuffers);
+    std::swap(a->indexBuffer, b->indexBuffer);
+    std::swap(a->vertexCount, b->vertexCount);
+    std::swap(a->indexCount, b->indexCount);
+    std::swap(a->vertices, b->vertices);
+    std::swap(a->indices, b->indices);
+    std::swap(a->indexSize, b->indexSize);
+    std::swap(a->origin, b->origin);
+    std::swap(a->chunks, b->chunks);
+    std::swap(a->arena, b->arena);
+    std::swap(a->ownsBuffers, b->ownsBuffers);
+    std::swap(a->baseVertex, b->baseVertex);
+    std::swap(a->firstIndex, b->firstIndex);
+    std::swap(a->positions, b->positions);
+    std::swap(a->quantizedPositions, b->quantizedPositions);
+    std::swap(a->bones, b->bones);
+    std::swap(a->name, b->name);
+    std::swap(a->bounds, b->bounds);
+
+    if (ResMgr->loaded_meshes.contains(a->name) && ResMgr->loaded_meshes[a->name] == b)
+        ResMgr->loaded_meshes[a->name] = a;
+}
+
+// Swapped member by member, so the pose cache sees new channel storage and rebinds
+static void swapAnimationData(Animation* a, Animation* b)
+{
+    std::swap(a->name, b->name);
+    std::swap(a->duration, b->duration);
+    std::swap(a->ticksPerSecond, b->ticksPerSecond);
+    std::swap(a->positionTimes, b->positionTimes);
+    std::swap(a->rotationTimes, b->rotationTimes);
+    std::swap(a->scaleTimes, b->scaleTimes);
+    std::swap(a->positionValues, b->positionValues);
+    std::swap(a->scaleValues, b->scaleValues);
+    std::swap(a->rotationValues, b->rotationValues);
+    std::swap(a->packedPositions, b->packedPositions);
+    std::swap(a->packedRotations, b->packedRotations);
+    std::swap(a->packedScales, b->packedScales);
+    std::swap(a->compressed, b->compressed);
+    std::swap(a->nodeChannels, b->nodeChannels);
+}
+
+// Bone objects hold on to bones, so the old ones are kept and refilled
+static void reloadSkeleton(Skeleton* skeleton, Skeleton* fresh)
+{
+    size_t common = std::min(skeleton->bones.size(), fresh->bones.size());
+
+    for (size_t i = 0; i < common; ++i)
+    {
+        std::swap(*skeleton->bones[i], *fresh->bones[i]);
+        skeleton->bones[i]->skeleton = skeleton;
+
+        // Now holds the old bone's data, nothing outside the fresh skeleton points at it
+        delete fresh->bones[i];
+    }
+
+    // Bones the file no longer has are dropped from the skeleton but not freed, bone objects may still use them
+    skeleton->bones.resize(common);
+    for (size_t i = common; i < fresh->bones.size(); ++i)
+    {
+        fresh->bones[i]->skeleton = skeleton;
+        skeleton->bones.push_back(fresh->bones[i]);
+    }
+    fresh->bones.clear();
+    fresh->joints.clear();
+
+    std::swap(skeleton->boneInfoMap, fresh->boneInfoMap);
+    std::swap(skeleton->rootName, fresh->rootName);
+    std::swap(skeleton->inverseTransform, fresh->inverseTransform);
+
+    skeleton->Compile();
+}
+
+// Whether a model other than owner lists the texture, embedded images are shared between assets
+static bool isSharedTexture(const Model* owner, const Texture* texture)
+{
+    for (const auto& [path, scene] : ResMgr->loaded_scene_descs)
+    {
+        for (auto model : scene->models)
+        {
+            if (model != owner && IN_VECTOR(model->textures, texture))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+// Refills the model's objects in place, anything the new file has more of is moved over. Meshes and clips
+// the file no longer has stay as they were, objects may still draw them
+static void reloadModel(Model* model, Model* fresh)
+{
+    size_t common = std::min(model->meshes.size(), fresh->meshes.size());
+    for (size_t i = 0; i < common; ++i)
+    {
+        swapMeshData(model->meshes[i], fresh->meshes[i]);
+    }
+    for (size_t i = common; i < fresh->meshes.size(); ++i)
+    {
+        fresh->meshes[i]->model = model;
+        model->meshes.push_back(fresh->meshes[i]);
+    }
+    fresh->meshes.resize(common);
+
+    // Materials built from the old textures keep their pointers, only the GPU image changes
+    common = std::min(model->textures.size(), fresh->textures.size());
+    for (size_t i = 0; i < common; ++i)
+    {
+        var texture = model->textures[i];
+        var replacement = fresh->textures[i];
+
+        // Textures from files are shared through loaded_textures and reload on their own. A different name
+        // means the file's textures moved around, and an embedded image other models share has to keep its
+        // data, in both cases the new one is kept next to the old
+        if (texture == replacement)
+            continue;
+
+        if (texture->name != replacement->name || isSharedTexture(model, texture))
+        {
+            if (!IN_VECTOR(model->textures, replacement))
+                model->textures.push_back(replacement);
+            continue;
+        }
+
+        std::swap(texture->handle, replacement->handle);
+        std::swap(texture->format, replacement->format);
+        std::swap(texture->width, replacement->width);
+        std::swap(texture->height, replacement->height);
+
+        if (ResMgr->loaded_textures.contains(texture->name) && ResMgr->loaded_textures[texture->name] == replacement)
+            ResMgr->loaded_textures[texture->name] = texture;
+
+        // The old texture now holds the new image, so it takes over the new image's hash
+        std::erase_if(ResMgr->loaded_embedded_textures,
+                      [texture](const auto& entry) { return entry.second == texture; });
+        for (auto& [hash, embedded] : ResMgr->loaded_embedded_textures)
+        {
+            if (embedded == replacement)
+                embedded = texture;
+        }
+
+        if (!IN_VECTOR(model->textures, replacement))
+            delete replacement;
+    }
+    model->textures.insert(model->textures.end(), fresh->textures.begin() + common, fresh->textures.end());
+    fresh->textures.clear();
+
+    common = std::min(model->materials.size(), fresh->materials.size());
+    for (size_t i = 0; i < common; ++i)
+    {
+        std::swap(*model->materials[i], *fresh->materials[i]);
+    }
+    model->materials.insert(model->materials.end(), fresh->materials.begin() + common, fresh->materials.end());
+    fresh->materials.resize(common);
+
+    common = std::min(model->animations.size(), fresh->animations.size());
+    for (size_t i = 0; i < common; ++i)
+    {
+        swapAnimationData(model->animations[i], fresh->animations[i]);
+    }
+    model->animations.insert(model->animations.end(), fresh->animations.begin() + common, fresh->animations.end());
+    fresh->animations.resize(common);
+
+    if (model->skeleton && fresh->skeleton)
+        reloadSkeleton(model->skeleton, fresh->skeleton);
+
+    std::swap(model->materialIndices, fresh->materialIndices);
+    std::swap(model->name, fresh->name);
+}
+
+void SceneDescription::ReloadFrom(SceneDescription* fresh)
+{
+    // Constructing fresh registered it under the path
+    ResMgr->loaded_scene_descs[path] = this;
+
+    std::swap(name, fresh->name);
+    std::swap(rootNode, fresh->rootNode);
+
+    for (auto scene : {this, fresh})
+    {
+        if (!scene->rootNode)
+            continue;
+
+        scene->rootNode->scene = scene;
+        for (auto node : scene->rootNode->GetAllChildren())
+        {
+            node->scene = scene;
+        }
+    }
+
+    if (renderer && renderer->cellGraph == cells)
+        renderer->cellGraph = fresh->cells;
+    std::swap(cells, fresh->cells);
+
+    size_t common = std::min(models.size(), fresh->models.size());
+    for (size_t i = 0; i < common; ++i)
+    {
+        reloadModel(models[i], fresh->models[i]);
+    }
+    models.insert(models.end(), fresh->models.begin() + common, fresh->models.end());
+    fresh->models.resize(common);
+}
+
+SceneDescription* SceneDescription::CreateSceneDescription(string path)
+{
+    if (ResMgr->loaded_scene_descs.contains(path))
+    {
+        return ResMgr->loaded_scene_descs[path];
+    }
+
+    var description = new SceneDescription(path);
+
+    // A reload loads the file again and moves the result into this description, then frees the old data
+    ResMgr->Watch(path, description, [description, path]() -> std::function<void()>
+    {
+        var replace = [description, path](const aiScene* imported)
+        {
+            var fresh = new SceneDescription(path, imported);
+
+            // A file that failed to load leaves the current data in place
+            if (fresh->rootNode)
+                description->ReloadFrom(fresh);
+
+            delete fresh;
+        };
+
+        // .tmdl files are read straight into GPU buffers, so all of it happens on the main thread
+        if (path.ends_with(".tmdl"))
+            return [replace]() { replace(nullptr); };
+
+        var importer = std::make_shared<Assimp::Importer>();
+        const aiScene* scene = importer->ReadFile(path, SCENE_IMPORT_FLAGS);
+
+        if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+        {
+            std::cout << "ERROR::ASSIMP::" << importer->GetErrorString() << std::endl;
+            return {};
+        }
+
+        return [replace, importer, scene]() { replace(scene); };
+    });
+
+    return description;
+}
+
+BoneObject::BoneObject(Skeleton::Bone* bone)
+{
+    this->bone = bone;
+    name = bone->name;
+    position = bone->position;
+    rotation = bone->rotation;
+    scale = bone->scale;
+}
+
+void BoneObject::Load(SceneDescription::Node* node)
+{
+    for (auto child : node->children)
+    {
+        if (child->isBone)
+        {
+            var bone = new BoneObject();
+            bone->name = child->name;
+            bone->position = child->position;
+            bone->rotation = (child->rotation);
+            bone->scale = child->scale;
+            bone->Load(child);
+            bone->SetParent(this);
+        }
+    }
+}
+
+glm::mat4 BoneObject::GetGlobalOffsetMatrix()
+{
+    var offset = GetOffsetMatrix();
 
     if (parent)
     {
@@ -1261,6 +2450,20 @@ void SkeletonObject::Load(SceneDescription::Node* node)
     }
 
     bones = GetObjectsFromType<BoneObject>();
+
+    if (skeleton)
+    {
+        if (skeleton->joints.empty())
+            skeleton->Compile();
+
+        // Bones from the scene follow their joints like the ones GetBone creates
+        for (auto bone : bones)
+        {
+            bone->joint = skeleton->FindJoint(bone->name);
+        }
+
+        ResetPose();
+    }
 }
 
 BoneObject* SkeletonObject::GetBone(string name)
@@ -1271,7 +2474,28 @@ BoneObject* SkeletonObject::GetBone(string name)
             return bone;
     }
 
-    return nullptr;
+    if (!skeleton)
+        return nullptr;
+
+    var joint = skeleton->FindJoint(name);
+    if (joint < 0)
+        return nullptr;
+
+    var bone = new BoneObject(skeleton->joints[joint]);
+    bone->joint = joint;
+    bone->SetParent(this);
+
+    const var& modelTransforms = GetPose().modelTransforms;
+    if (joint < modelTransforms.size())
+    {
+        glm::vec3 skew;
+        glm::vec4 perspective;
+        decompose(modelTransforms[joint], bone->scale, bone->rotation, bone->position, skew, perspective);
+    }
+
+    bones.push_back(bone);
+
+    return bone;
 }
 
 bool SkeletonObject::IsSkeletonBone(BoneObject* bone)
@@ -1280,112 +2504,127 @@ bool SkeletonObject::IsSkeletonBone(BoneObject* bone)
 }
 
 
+// Animators that updated this frame, evaluated together before submission
+static std::vector<Animator*> pendingAnimators;
+
 Animator::Animator()
 {
-
+    framesSinceSample = static_cast<u32>(reinterpret_cast<uintptr_t>(this) >> 4) % 4;
 }
 
-glm::mat4 Animator::AnimationBone::Update(float animationTime, Object* obj)
+Animator::~Animator()
 {
-    var translation = InterpolatePosition(animationTime);
-    var rotation = InterpolateRotation(animationTime);
-    var scale = InterpolateScaling(animationTime);
-    obj->position = translation;
-    obj->rotation = rotation;
-    obj->scale = scale;
+    if (queued)
+        std::erase(pendingAnimators, this);
 
+    for (auto animation_bone : animationBones)
+    {
+        delete animation_bone;
+    }
 
-    return localTransform;
-}
-
-int Animator::AnimationBone::GetPositionIndex(float animationTime)
-{
-    for (int index = 0; index < channel->positions.size() - 1; ++index)
+    for (auto animation_bone : fadeBones)
     {
-        if (animationTime <= channel->positions[index + 1]->time)
-            return index;
+        delete animation_bone;
     }
-    assert(0);
-}
 
-int Animator::AnimationBone::GetRotationIndex(float animationTime)
-{
-    for (int index = 0; index < channel->rotations.size() - 1; ++index)
+    for (auto layer : layers)
     {
-        if (animationTime <= channel->rotations[index + 1]->time)
-            return index;
+        delete layer;
     }
-    assert(0);
+}
+
+void Animator::AnimationBone::Update(float animationTime, Pose& pose)
+{
+    if (joint < 0)
+        return;
+
+    pose.positions[joint] = InterpolatePosition(animationTime);
+    pose.rotations[joint] = InterpolateRotation(animationTime);
+    pose.scales[joint] = InterpolateScaling(animationTime);
+}
+
+int Animator::AnimationBone::GetPositionIndex(float animationTime)
+{
+    positionCursor = Animation::SeekKey(animation->positionTimes, channel->positions, animationTime, positionCursor);
+    return positionCursor;
+}
+
+int Animator::AnimationBone::GetRotationIndex(float animationTime)
+{
+    rotationCursor = Animation::SeekKey(animation->rotationTimes, channel->rotations, animationTime, rotationCursor);
+    return rotationCursor;
 }
 
 int Animator::AnimationBone::GetScaleIndex(float animationTime)
 {
-    for (int index = 0; index < channel->scales.size() - 1; ++index)
-    {
-        if (animationTime <= channel->scales[index + 1]->time)
-            return index;
-    }
-    assert(0);
+    scaleCursor = Animation::SeekKey(animation->scaleTimes, channel->scales, animationTime, scaleCursor);
+    return scaleCursor;
 }
 
 float Animator::AnimationBone::GetScaleFactor(float lasttime, float nexttime, float animationTime)
 {
-    float scaleFactor = 0.0f;
     float midWayLength = animationTime - lasttime;
     float framesDiff = nexttime - lasttime;
-    scaleFactor = midWayLength / framesDiff;
-    return scaleFactor;
+
+    if (framesDiff <= 0)
+        return 0.0f;
+
+    return glm::clamp(midWayLength / framesDiff, 0.0f, 1.0f);
 }
 
 glm::vec3 Animator::AnimationBone::InterpolatePosition(float animationTime)
 {
-    if (1 == channel->positions.size())
-    {
-        var finalPosition = channel->positions[0]->value;
-        return finalPosition;
-    }
+    const var& range = channel->positions;
+    if (range.count == 0)
+        return glm::vec3{0};
+
+    if (1 == range.count)
+        return animation->GetPosition(*channel, 0);
+
+    const float* times = animation->positionTimes.data() + range.first;
 
     int p0Index = GetPositionIndex(animationTime);
     int p1Index = p0Index + 1;
-    float scaleFactor =
-        GetScaleFactor(channel->positions[p0Index]->time, channel->positions[p1Index]->time, animationTime);
-    glm::vec3 finalPosition =
-        mix(channel->positions[p0Index]->value, channel->positions[p1Index]->value, scaleFactor);
-    return finalPosition;
+    float scaleFactor = GetScaleFactor(times[p0Index], times[p1Index], animationTime);
+
+    return mix(animation->GetPosition(*channel, p0Index), animation->GetPosition(*channel, p1Index), scaleFactor);
 }
 
 glm::quat Animator::AnimationBone::InterpolateRotation(float animationTime)
 {
-    if (1 == channel->rotations.size())
-    {
-        auto finalRotation = normalize(channel->rotations[0]->value);
-        return finalRotation;
-    }
+    const var& range = channel->rotations;
+    if (range.count == 0)
+        return glm::quat{1, 0, 0, 0};
+
+    if (1 == range.count)
+        return normalize(animation->GetRotation(*channel, 0));
+
+    const float* times = animation->rotationTimes.data() + range.first;
 
     int p0Index = GetRotationIndex(animationTime);
     int p1Index = p0Index + 1;
-    float scaleFactor =
-        GetScaleFactor(channel->rotations[p0Index]->time, channel->rotations[p1Index]->time, animationTime);
-    glm::quat finalRotation =
-        glm::slerp(channel->rotations[p0Index]->value, channel->rotations[p1Index]->value, scaleFactor);
-    finalRotation = normalize(finalRotation);
-    return finalRotation;
+    float scaleFactor = GetScaleFactor(times[p0Index], times[p1Index], animationTime);
+
+    return normalize(glm::slerp(animation->GetRotation(*channel, p0Index), animation->GetRotation(*channel, p1Index),
+                                scaleFactor));
 }
 
 glm::vec3 Animator::AnimationBone::InterpolateScaling(float animationTime)
 {
-    if (1 == channel->scales.size())
-    {
-        var finalScale = channel->scales[0]->value;
-        return finalScale;
-    }
+    const var& range = channel->scales;
+    if (range.count == 0)
+        return glm::vec3{1};
+
+    if (1 == range.count)
+        return animation->GetScale(*channel, 0);
+
+    const float* times = animation->scaleTimes.data() + range.first;
 
     int p0Index = GetScaleIndex(animationTime);
     int p1Index = p0Index + 1;
-    float scaleFactor =
-        GetScaleFactor(channel->scales[p0Index]->time, channel->scales[p1Index]->time, animationTime);
-    glm::vec3 finalScale = mix(channel->scales[p0Index]->value, channel->scales[p1Index]->value, scaleFactor);
-    return finalScale;
+    float scaleFactor = GetScaleFactor(times[p0Index], times[p1Index], animationTime);
+
+    return mix(animation->GetScale(*channel, p0Index), animation->GetScale(*channel, p1Index), scaleFactor);
 }
 
 Animator::AnimationBone* Animator::GetBone(string name)
@@ -1408,2053 +2647,5177 @@ void Animator::Update()
 
     if (currentAnimation && skeleton)
     {
-        time += static_cast<float>(currentAnimation->ticksPerSecond) * (deltaTime);
-        if (doLoop)
-            time = fmod(time, (currentAnimation->duration));
-        else if (time >= currentAnimation->duration)
-            time = currentAnimation->duration;
-
-        if (currentAnimation->duration <= 0 && doLoop)
-            time = 0;
+        time = AdvanceTime(currentAnimation, time, doLoop);
 
         if (animationBones.size() < currentAnimation->nodeChannels.size())
             LoadAnimationBones();
+    }
 
-        for (auto animation_bone : animationBones)
+    if (fadeAnimation)
+    {
+        fadeTime = AdvanceTime(fadeAnimation, fadeTime, doLoop);
+        fadeElapsed += deltaTime;
+
+        if (fadeElapsed >= fadeDuration)
         {
-            animation_bone->Update(time, skeleton->bones[animation_bone->boneId]);
+            for (auto animation_bone : fadeBones)
+            {
+                delete animation_bone;
+            }
+            fadeBones.clear();
+            fadeAnimation = nullptr;
         }
+    }
 
-        //CalculateBoneTransform(skeleton->skeleton->GetBone(skeleton->skeleton->rootName), glm::mat4(1.0));
-
-        //skeleton->boneMatrices = pushBoneMatrices;
+    for (auto layer : layers)
+    {
+        if (layer->animation)
+            layer->time = AdvanceTime(layer->animation, layer->time, layer->doLoop);
     }
 
+    if (skeleton && !queued)
+    {
+        queued = true;
+        pendingAnimators.push_back(this);
+    }
 
     Object::Update();
 }
 
-void Animator::LoadAnimationBones()
+float Animator::AdvanceTime(const Animation* animation, float time, bool loop)
 {
+    time += static_cast<float>(animation->ticksPerSecond) * (deltaTime);
+    if (loop)
+        time = fmod(time, (animation->duration));
+    else if (time >= animation->duration)
+        time = animation->duration;
 
-    if (!skeleton)
-    {
-        skeleton = parent->GetObjectFromType<SkeletonObject>();
-    }
-
-    if (skeleton)
-    {
-
-        for (auto node_channel : currentAnimation->nodeChannels)
-        {
-            var animBone = new AnimationBone;
-
-            animBone->channel = node_channel;
-            animBone->animation = currentAnimation;
-            animBone->boneId = skeleton->skeleton->boneInfoMap[node_channel->name].id;
+    if (animation->duration <= 0 && loop)
+        time = 0;
 
-            animationBones.push_back(animBone);
-        }
-    }
+    return time;
 }
 
-void Animator::SetAnimation(Animation* animation)
+static std::vector<Animator::AnimationBone> bindChannels(Animation* animation, const Skeleton* skeleton)
 {
+    std::vector<Animator::AnimationBone> bones;
+    bones.reserve(animation->nodeChannels.size());
 
-    currentAnimation = animation;
-    time = 0;
-    animationBones.clear();
+    for (auto& channel : animation->nodeChannels)
+    {
+        Animator::AnimationBone bone;
+        bone.channel = &channel;
+        bone.animation = animation;
+        bone.joint = skeleton->FindJoint(channel.name);
 
-    LoadAnimationBones();
+        bones.push_back(bone);
+    }
+
+    return bones;
 }
 
-SkeletonObject::SkeletonObject(Skeleton* skl)
+void Animator::SelectLod(const math::Frustum* frustum, glm::vec3 eye)
 {
-    skeleton = skl;
+    var previous = updateInterval;
 
-    for (auto bone : skl->bones)
-    {
-        var obj = new BoneObject(bone);
+    updateInterval = 1;
+    reducedBones = false;
 
-        obj->SetParent(this);
+    if (lod.enabled && frustum && skeleton)
+    {
+        var center = skeleton->GetGlobalPosition();
+        var distance = glm::distance(center, eye);
 
-        bones.push_back(obj);
-    }
+        math::AABB bounds{center - glm::vec3(lod.boundsRadius), center + glm::vec3(lod.boundsRadius)};
 
-    for (auto bone : skl->bones)
-    {
-        var obj = GetBone(bone->name);
-        for (auto child : bone->children)
-        {
-            var realChild = GetChild(child);
-            if (realChild)
-                realChild->SetParent(obj);
-        }
-    }
+        if (lod.pauseWhenInvisible && lod.boundsRadius > 0 && !frustum->Intersects(bounds))
+            updateInterval = 0;
+        else if (distance > lod.quarterRateDistance)
+            updateInterval = 4;
+        else if (distance > lod.halfRateDistance)
+            updateInterval = 2;
 
-    for (auto bone : bones)
-    {
-        //bone->bone->skeleton->boneInfoMap[bone->name].offset = glm::inverse(bone->GetTransform());
+        reducedBones = distance > lod.reducedBoneDistance;
     }
-}
 
-void SkeletonObject::Start()
-{
+    // Coming back into view or changing rate samples straight away. lodTo is from an earlier throttled
+    // period, blending toward it would snap the pose back in time
+    if (updateInterval != previous && updateInterval != 0)
+        framesSinceSample = updateInterval;
 
-    Object::Start();
+    sampleDue = updateInterval != 0 && ++framesSinceSample >= updateInterval;
+    if (sampleDue)
+        framesSinceSample = 0;
 }
 
-void SkeletonObject::Update()
+void Animator::Evaluate()
 {
+    if (!skeleton)
+        return;
 
-    boneMatrices.clear();
-    boneMatrices.resize(bones.size(), glm::mat4(1.0));
-
-    //GetBone(skeleton->rootName)->CalculateBoneMatrix(this, glm::mat4(1.0));
-    for (auto bone : bones)
+    if (updateInterval == 0)
     {
-        if (bone->parent == this)
+        // Paused, a shared pose would be recycled by the cache so take a copy of it first
+        if (&skeleton->GetPose() != &skeleton->pose)
         {
-            CalculateBoneTransform(bone->bone, glm::mat4(1.0));
+            skeleton->pose = skeleton->GetPose();
+            skeleton->UpdatePalette();
         }
+        return;
     }
 
-    Object::Update();
-}
-
-void SkeletonObject::CalculateBoneTransform(const Skeleton::Bone* skeleBone, glm::mat4 parentTransform)
-{
-    string nodeName = skeleBone->name;
-    glm::mat4 nodeTransform = skeleBone->transformation;
-    int idx = 0;
-
-    if (skeleton->boneInfoMap.contains(nodeName))
+    if (updateInterval == 1)
     {
-        idx = skeleton->boneInfoMap[nodeName].id;
+        SamplePose();
     }
+    else
+    {
+        if (sampleDue)
+        {
+            lodFrom = skeleton->pose;
+            SamplePose();
+            lodTo = skeleton->pose;
+        }
 
-    BoneObject* animBone = bones[idx];
+        if (lodTo.positions.size() == skeleton->pose.positions.size())
+        {
+            float t = std::min(1.0f, static_cast<float>(framesSinceSample + 1) / updateInterval);
 
-    if (animBone)
-    {
-        nodeTransform = bones[idx]->GetLocalTransform();
+            blendWeights.assign(lodTo.positions.size(), t);
+            Pose::Blend(lodFrom, lodTo, blendWeights.data(), skeleton->pose);
+        }
     }
 
-    glm::mat4 globalTransform = parentTransform * nodeTransform;
+    skeleton->UpdatePalette();
+}
+
+void Animator::SamplePose()
+{
+    var& pose = skeleton->pose;
+    var jointCount = skeleton->skeleton->joints.size();
 
-    if (skeleton->boneInfoMap.contains(nodeName))
+    // Distant characters leave the lowest joints, fingers and face, where they are
+    const var& heights = skeleton->skeleton->jointHeights;
+    var skip = [&](int joint)
     {
-        var index = skeleton->boneInfoMap[nodeName].id;
-        glm::mat4 offset = skeleton->boneInfoMap[nodeName].offset;
-        boneMatrices[index] = globalTransform * (offset);
+        return reducedBones && joint >= 0 && joint < heights.size() && heights[joint] < lod.reducedBoneHeight;
+    };
 
-        /*
-        var mat = boneMatrices[index];
+    if (currentAnimation)
+    {
+        for (auto animation_bone : animationBones)
+        {
+            if (!skip(animation_bone->joint))
+                animation_bone->Update(time, pose);
+        }
 
-        if (time::getTime() == 1)
+        if (fadeAnimation && fadeDuration > 0)
         {
-            if (mat != glm::mat4(1.0))
+            // Joints the old clip doesn't drive keep the new clip's transform
+            blendPose = pose;
+            for (auto animation_bone : fadeBones)
             {
-                std::cout << nodeName << " has an offset matrix issue." << std::endl;
+                if (!skip(animation_bone->joint))
+                    animation_bone->Update(fadeTime, blendPose);
+            }
 
-                std::cout << std::endl << "-- Transformation Matrix --" << std::endl;
+            blendWeights.assign(jointCount, glm::clamp(1.0f - fadeElapsed / fadeDuration, 0.0f, 1.0f));
+            Pose::Blend(pose, blendPose, blendWeights.data(), pose);
+        }
+    }
 
-                for (int x = 0; x < 4; ++x)
-                {
-                    for (int y = 0; y < 4; ++y)
-                    {
-                        std::cout << globalTransform[x][y] << " ";
-                    }
-                    std::cout << std::endl;
-                }
+    for (auto layer : layers)
+    {
+        if (!layer->animation || layer->weight <= 0)
+            continue;
 
-                std::cout << std::endl << "-- Offset Matrix --" << std::endl;
+        if (layer->bones.empty())
+            layer->bones = bindChannels(layer->animation, skeleton->skeleton);
 
-                for (int x = 0; x < 4; ++x)
-                {
-                    for (int y = 0; y < 4; ++y)
-                    {
-                        std::cout << offset[x][y] << " ";
-                    }
-                    std::cout << std::endl;
-                }
+        blendWeights.resize(jointCount);
+        for (size_t i = 0; i < jointCount; ++i)
+        {
+            blendWeights[i] = layer->weight * (layer->mask.empty() ? 1.0f : layer->mask[i]);
+        }
 
-                std::cout << std::endl << "-- Result Matrix (transformation * offset) --" << std::endl;
+        if (layer->additive)
+        {
+            if (layer->reference.positions.size() != jointCount)
+            {
+                var firstFrame = layer->bones;
 
-                for (int x = 0; x < 4; ++x)
+                layer->reference.Reset(skeleton->skeleton);
+                for (auto& bone : firstFrame)
                 {
-                    for (int y = 0; y < 4; ++y)
-                    {
-                        std::cout << mat[x][y] << " ";
-                    }
-                    std::cout << std::endl;
+                    bone.Update(0, layer->reference);
                 }
+            }
 
-                std::cout << std::endl;
-
-                //boneMatrices[index] = glm::inverse(boneMatrices[index]);
+            blendPose = layer->reference;
+            for (auto& bone : layer->bones)
+            {
+                if (!skip(bone.joint))
+                    bone.Update(layer->time, blendPose);
             }
+
+            pose.Add(blendPose, layer->reference, blendWeights.data());
         }
-        */
-    }
+        else
+        {
+            blendPose = pose;
+            for (auto& bone : layer->bones)
+            {
+                if (!skip(bone.joint))
+                    bone.Update(layer->time, blendPose);
+            }
 
-    for (string child : skeleBone->children)
-    {
-        CalculateBoneTransform(skeleton->GetBone(child), globalTransform);
+            Pose::Blend(pose, blendPose, blendWeights.data(), pose);
+        }
     }
 }
 
-
-Model::Model(string path)
+struct PoseCacheKey
 {
-    if (path.ends_with(".tmdl"))
-    {
+    const Skeleton* skeleton;
+    const Animation* animation;
+    // Sample indices only line up between animators sampling at the same rate
+    u32 rate;
+    u64 sample;
 
+    auto operator<=>(const PoseCacheKey&) const = default;
+};
 
-        var reader = new fs::BinaryReader(path);
+// A pose sampled once this frame and shared read only by every animator with the same key
+struct PoseCacheEntry
+{
+    PoseCacheKey key;
+    float time;
 
+    Pose pose;
+    std::vector<glm::mat4> palette;
+    std::vector<Animator::AnimationBone> channels;
+};
 
-        reader->close();
+struct PoseCache
+{
+    // Entries are kept between frames so their buffers are reused, only the first used ones are live
+    std::vector<std::unique_ptr<PoseCacheEntry>> entries;
+    u32 used = 0;
 
-    }
-    else
+    std::map<PoseCacheKey, PoseCacheEntry*> lookup;
+
+    // Channels bound once per skeleton and clip, entries copy them so each keeps its own cursors
+    struct Binding
     {
+        // Rebinds when the clip at this address isn't the one that was bound
+        const Animation::NodeChannel* nodeChannels = nullptr;
+        std::vector<Animator::AnimationBone> channels;
+        bool used = false;
+    };
 
+    std::map<std::pair<const Skeleton*, const Animation*>, Binding> bindings;
 
-        Assimp::Importer import;
-        const aiScene* scene = import.ReadFile(path,
-                                               aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_GenUVCoords);
+    PoseCacheEntry* Get(const PoseCacheKey& key, float time)
+    {
+        if (IN_MAP(lookup, key))
+            return lookup[key];
 
-        if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
-        {
-            std::cout << "ERROR::ASSIMP::" << import.GetErrorString() << std::endl;
-            return;
-        }
+        if (used == entries.size())
+            entries.push_back(std::make_unique<PoseCacheEntry>());
 
-        LoadFromAiScene(scene);
+        var entry = entries[used++].get();
+        entry->key = key;
+        entry->time = time;
+        entry->channels = GetChannels(key.skeleton, key.animation);
 
-        import.FreeScene();
+        lookup[key] = entry;
+
+        return entry;
     }
-}
 
-Skeleton::Bone* Skeleton::GetBone(string name)
-{
-    /*
-    for (auto value : bones)
+    void Clear()
     {
-        if (value->name == name)
-            return value;
+        used = 0;
+        lookup.clear();
+
+        // Bindings nothing sampled last frame are dropped, so the map doesn't outlive the clips
+        std::erase_if(bindings, [](const auto& binding) { return !binding.second.used; });
+        for (auto& [key, binding] : bindings)
+        {
+            binding.used = false;
+        }
     }
-    */
-    if (boneInfoMap.contains(name) && bones.size() > 0)
+
+private:
+    const std::vector<Animator::AnimationBone>& GetChannels(const Skeleton* skeleton, const Animation* animation)
     {
-        var id = boneInfoMap[name].id;
+        var& binding = bindings[{skeleton, animation}];
 
-        if (bones.size() > id)
-            return bones[id];
+        if (binding.nodeChannels != animation->nodeChannels.data() ||
+            binding.channels.size() != animation->nodeChannels.size())
+        {
+            binding.nodeChannels = animation->nodeChannels.data();
+            binding.channels = bindChannels(const_cast<Animation*>(animation), skeleton);
+        }
+
+        binding.used = true;
+
+        return binding.channels;
     }
+};
 
-    return nullptr;
-}
+static PoseCache poseCache;
 
-Skeleton::Bone* Skeleton::GetParent(Bone* b)
+// One clip at one time into pose and palette with the animators' channel sampling
+static void samplePose(const Skeleton* skeleton, Animation* animation, float time,
+                       std::vector<Animator::AnimationBone>& channels, Pose& pose, std::vector<glm::mat4>& palette)
 {
-    for (auto value : bones)
+    // Cursors start at zero, fresh channels seek with one binary search
+    if (channels.empty())
+        channels = bindChannels(animation, skeleton);
+
+    pose.Reset(skeleton);
+    for (auto& bone : channels)
     {
-        if (value->name != b->name)
-        {
-            for (auto child : value->children)
-            {
-                if (child == b->name)
-                    return value;
-            }
-        }
+        bone.Update(time, pose);
     }
-    return nullptr;
-}
 
-Model::Model(const aiScene* scene)
-{
-    LoadFromAiScene(scene);
+    pose.Resolve(skeleton, palette);
 }
 
-Model::Model(const aiScene* scene, SceneDescription* description)
+// Channels were copied from the cache's binding by PoseCache::Get
+static void evaluateSharedPose(PoseCacheEntry* entry)
 {
-    LoadFromAiScene(scene, description);
+    samplePose(entry->key.skeleton, const_cast<Animation*>(entry->key.animation), entry->time, entry->channels,
+               entry->pose, entry->palette);
 }
 
-void Model::LoadFromAiScene(const aiScene* scene, SceneDescription* description)
+void tmt::render::evaluateAnimators()
 {
-    name = "TMDL_" + std::string(scene->mName.C_Str());
-    skeleton = new Skeleton();
-
-    skeleton->inverseTransform = math::convertMat4(scene->mRootNode->mTransformation.Inverse());
+    poseCache.Clear();
 
+    math::Frustum frustum;
+    glm::vec3 eye{0};
+    bool hasCamera = !renderer->cameraCache.empty();
 
-    int maxBones = INT_MAX;
-    SceneDescription::Node* modelNode;
-    if (description)
+    if (hasCamera)
     {
+        var camera = Camera::GetMainCamera();
 
-        modelNode = new SceneDescription::Node;
-        modelNode->name = name;
-        modelNode->scene = description;
-        modelNode->SetParent(description->rootNode);
-
+        frustum = math::Frustum::FromMatrix(camera->GetProjection_m4() * camera->GetView_m4());
+        eye = camera->position;
     }
 
-    for (int i = 0; i < scene->mNumMeshes; ++i)
+    // Animators sharing poses are grouped first, so each unique pose is sampled by exactly one job
+    std::vector<PoseCacheEntry*> shared(pendingAnimators.size(), nullptr);
+
+    for (size_t i = 0; i < pendingAnimators.size(); ++i)
     {
-        var msh = scene->mMeshes[i];
+        var animator = pendingAnimators[i];
+        var clip = animator->currentAnimation;
 
-        std::vector<Vertex> vertices;
+        animator->SelectLod(hasCamera ? &frustum : nullptr, eye);
 
-        for (int j = 0; j < msh->mNumVertices; ++j)
-        {
-            aiVector3D pos(0), norm(0), uv(0);
-            pos = msh->mVertices[j];
-            if (msh->HasNormals())
-                norm = msh->mNormals[j];
-            if (msh->HasTextureCoords(0))
-                uv = msh->mTextureCoords[0][j];
+        // Cache entries only live for a frame, so sharing animators aren't throttled, only paused
+        if (animator->updateInterval == 0)
+            continue;
 
-            var vertex = Vertex{};
+        if (animator->sharedPoseRate == 0 || !clip || !animator->skeleton || clip->ticksPerSecond <= 0)
+            continue;
 
-            vertex.position = glm::vec3{pos.x, pos.y, pos.z};
-            vertex.normal = glm::vec3{norm.x, norm.y, norm.z};
-            vertex.uv0 = glm::vec2{uv.x, uv.y};
-            vertices.push_back(vertex);
-        }
+        // Blended poses are specific to the instance
+        if (animator->fadeAnimation || !animator->layers.empty())
+            continue;
 
-        std::vector<u16> indices;
+        float ticksPerSample = static_cast<float>(clip->ticksPerSecond) / animator->sharedPoseRate;
+        var sample = static_cast<u64>(std::max(animator->time, 0.0f) / ticksPerSample);
 
-        for (unsigned int j = 0; j < msh->mNumFaces; j++)
-        {
-            aiFace face = msh->mFaces[j];
-            for (unsigned int k = 0; k < face.mNumIndices; k++)
-                indices.push_back(face.mIndices[k]);
-        }
+        PoseCacheKey key{animator->skeleton->skeleton, clip, animator->sharedPoseRate, sample};
+        shared[i] = poseCache.Get(key, sample * ticksPerSample);
+    }
 
-        for (int j = 0; j < msh->mNumBones; ++j)
-        {
-            var b = msh->mBones[j];
+    job::parallelFor(poseCache.used, [](u32 i) { evaluateSharedPose(poseCache.entries[i].get()); });
 
-            Skeleton::Bone* bone = nullptr;
+    // Each job writes only to its own animator's bones and palette, so the result doesn't depend on scheduling
+    job::parallelFor(pendingAnimators.size(), [&shared](u32 i)
+    {
+        if (shared[i])
+            pendingAnimators[i]->skeleton->SharePose(&shared[i]->pose, &shared[i]->palette);
+        else
+            pendingAnimators[i]->Evaluate();
+    });
 
-            int boneId = -1;
-            string boneName = b->mName.C_Str();
+    for (auto animator : pendingAnimators)
+    {
+        animator->queued = false;
+    }
+    pendingAnimators.clear();
+}
 
-            if (boneName.starts_with("Armature_"))
-            {
-                boneName.erase(boneName.find("Armature_"), strlen("Armature_"));
-            }
+// Widest texture row a bake uses, a multiple of three so a bone's rows never wrap
+constexpr u32 VAT_MAX_WIDTH = 4095;
+// The vertex shader's s_vat stage, the fragment shader's samplers start at 0
+constexpr u8 VAT_SAMPLER = 1;
 
-            if (!skeleton->boneInfoMap.contains(boneName))
-            {
-                BoneInfo boneInfo;
-                boneInfo.id = skeleton->boneInfoMap.size();
-                boneInfo.offset = math::convertMat4(b->mOffsetMatrix);
+VertexAnimationTexture* VertexAnimationTexture::Bake(Skeleton* skeleton, Animation* animation, float frameRate,
+                                                     Mode mode, const Mesh* mesh)
+{
+    if (!skeleton || !animation || frameRate <= 0)
+        return nullptr;
 
-                skeleton->boneInfoMap[boneName] = boneInfo;
-                boneId = boneInfo.id;
-            }
-            else
-            {
-                boneId = skeleton->boneInfoMap[boneName].id;
+    if (mode == Vertices && (!mesh || !mesh->vertices))
+    {
+        std::cout << "Baking vertex positions needs a mesh with its CPU vertices" << std::endl;
+        return nullptr;
+    }
 
-                skeleton->boneInfoMap[boneName].offset = math::convertMat4(b->mOffsetMatrix);
-            }
+    float ticksPerSecond = animation->ticksPerSecond > 0 ? static_cast<float>(animation->ticksPerSecond) : 1.0f;
+    float seconds = animation->duration / ticksPerSecond;
 
-            if (skeleton->GetBone(boneName) == nullptr)
-            {
+    var vat = new VertexAnimationTexture();
+    vat->mode = mode;
+    vat->frameRate = frameRate;
+    // The last frame lands on the clip's end, so looping playback lerps back into the first
+    vat->frameCount = std::max(2u, static_cast<u32>(std::ceil(seconds * frameRate)) + 1);
+    vat->texelsPerFrame = mode == Bones ? skeleton->bones.size() * 3 : mesh->vertexCount * 2;
+    vat->width = std::max(1u, std::min(vat->texelsPerFrame, VAT_MAX_WIDTH));
+    vat->rowsPerFrame = (vat->texelsPerFrame + vat->width - 1) / vat->width;
+    vat->texels.assign(static_cast<size_t>(vat->frameCount) * vat->rowsPerFrame * vat->width, glm::vec4(0));
 
-                bone = new Skeleton::Bone;
-                bone->name = boneName;
-                bone->skeleton = skeleton;
+    // Frames only write their own rows, so every frame samples on its own worker
+    job::parallelFor(vat->frameCount, [&](u32 frame)
+    {
+        std::vector<Animator::AnimationBone> channels;
+        std::vector<glm::mat4> palette;
+        Pose pose;
 
-                skeleton->bones.push_back(bone);
-            }
-            else
-            {
-                bone = skeleton->GetBone(boneName);
-            }
+        float time = std::min(frame / frameRate * ticksPerSecond, animation->duration);
+        samplePose(skeleton, animation, time, channels, pose, palette);
 
-            for (int k = 0; k < b->mNumWeights; ++k)
+        var out = vat->texels.data() + static_cast<size_t>(frame) * vat->rowsPerFrame * vat->width;
+
+        if (mode == Bones)
+        {
+            for (size_t bone = 0; bone < palette.size(); ++bone)
             {
-                var weight = b->mWeights[k];
+                // Rows of the matrix, the shader rebuilds it with mtxFromRows
+                var rows = transpose(palette[bone]);
 
-                bone->weights.push_back(Skeleton::Bone::VertexWeight{weight.mVertexId, weight.mWeight});
-                vertices[weight.mVertexId].SetBoneData(boneId, weight.mWeight);
+                out[bone * 3] = rows[0];
+                out[bone * 3 + 1] = rows[1];
+                out[bone * 3 + 2] = rows[2];
             }
+        }
+        else
+        {
+            std::vector<Vertex> skinned(mesh->vertexCount);
+            math::AABB bounds;
 
-            if (boneId >= maxBones)
-            {
-                std::cout << "Null bone data found: " << boneName << std::endl;
-            }
+            skinVertices(mesh->vertices, skinned.data(), mesh->vertexCount, palette.data(), palette.size(), bounds);
 
-            if (description)
+            for (size_t v = 0; v < skinned.size(); ++v)
             {
-
-                if (j == 0)
-                {
-                    var anode = description->GetNode("Armature");
-
-                    skeleton->rootName = boneName;
-                    if (anode != nullptr && anode != description->rootNode)
-                    {
-                        anode->SetParent(modelNode);
-                    }
-                }
-
-                var bnode = description->GetNode(boneName);
-                if (bnode)
-                    bnode->isBone = true;
+                out[v * 2] = glm::vec4(skinned[v].position, 1);
+                out[v * 2 + 1] = glm::vec4(skinned[v].normal, 0);
             }
         }
+    });
 
-        auto verts = new Vertex[vertices.size()];
-        std::copy(vertices.begin(), vertices.end(), verts);
+    return vat;
+}
 
-        auto incs = new u16[indices.size()];
-        std::copy(indices.begin(), indices.end(), incs);
+VertexAnimationTexture* VertexAnimationTexture::Load(string path)
+{
+    std::error_code error;
+    var fileSize = std::filesystem::file_size(path, error);
 
-        var mesh = createMesh(verts, incs, vertices.size(), indices.size(), Vertex::getVertexLayout(), this,
-                              msh->mName.C_Str());
+    var reader = new fs::BinaryReader(path);
 
-        meshes.push_back(mesh);
-        materialIndices.push_back(msh->mMaterialIndex);
+    if (error || !reader->CheckSignature("TVAT"))
+    {
+        std::cout << "Incorrect vertex animation format!" << std::endl;
+        reader->close();
+        delete reader;
+        return nullptr;
+    }
 
-        for (int j = 0; j < msh->mNumBones; ++j)
-        {
-            var bone = msh->mBones[j];
+    var mode = reader->ReadU8();
+    var frameRate = reader->ReadSingle();
+    var frameCount = reader->ReadUInt32();
+    var texelsPerFrame = reader->ReadUInt32();
+    var width = reader->ReadUInt32();
+    var rowsPerFrame = reader->ReadUInt32();
 
-            mesh->bones.push_back(bone->mName.C_Str());
-        }
+    // Signature, mode, rate and four counts, the texels fill the rest of the file exactly
+    constexpr u64 headerSize = 4 + 1 + 4 * 5;
+    u64 texelBytes = fileSize > headerSize ? fileSize - headerSize : 0;
+    u64 texelCount = texelBytes / sizeof(glm::vec4);
+    u64 frameTexels = static_cast<u64>(rowsPerFrame) * width;
 
+    bool valid = reader->good() && mode <= Vertices && frameRate > 0 && frameCount > 0 && texelsPerFrame > 0 &&
+        width > 0 && width <= VAT_MAX_WIDTH && frameTexels >= texelsPerFrame &&
+        frameTexels < static_cast<u64>(texelsPerFrame) + width && texelBytes % sizeof(glm::vec4) == 0 &&
+        texelCount % frameTexels == 0 && texelCount / frameTexels == frameCount;
 
-        if (description)
-        {
-            var mnd = description->GetNode(msh, i);
+    if (!valid)
+    {
+        std::cout << "Vertex animation " << path << " has a header that doesn't match its size" << std::endl;
+        reader->close();
+        delete reader;
+        return nullptr;
+    }
 
-            if (mnd)
-            {
+    var vat = new VertexAnimationTexture();
+    vat->mode = static_cast<Mode>(mode);
+    vat->frameRate = frameRate;
+    vat->frameCount = frameCount;
+    vat->texelsPerFrame = texelsPerFrame;
+    vat->width = width;
+    vat->rowsPerFrame = rowsPerFrame;
 
-                var meshNode = new SceneDescription::Node;
-                meshNode->name = "TMSH_" + mnd->name;
+    vat->texels.resize(texelCount);
+    reader->read(reinterpret_cast<char*>(vat->texels.data()), texelBytes);
 
-                meshNode->meshIndices.push_back(i);
-                meshNode->SetParent(modelNode);
+    var complete = reader->gcount() == static_cast<std::streamsize>(texelBytes);
 
-                meshNode->position = mnd->position;
-                meshNode->rotation = mnd->rotation;
-                meshNode->scale = mnd->scale;
-                meshNode->scene = description;
+    reader->close();
+    delete reader;
 
-                mnd->SetParent(nullptr);
+    if (!complete)
+    {
+        std::cout << "Vertex animation " << path << " ended early" << std::endl;
+        delete vat;
+        return nullptr;
+    }
 
-                delete mnd;
-            }
-        }
+    return vat;
+}
 
-    }
+void VertexAnimationTexture::Save(string path) const
+{
+    var writer = new fs::BinaryWriter(path);
 
-    /*
-    if (description)
+    writer->WriteSignature("TVAT");
+    writer->WriteByte(mode);
+    writer->WriteSingle(frameRate);
+    writer->WriteInt32(frameCount);
+    writer->WriteInt32(texelsPerFrame);
+    writer->WriteInt32(width);
+    writer->WriteInt32(rowsPerFrame);
+    writer->write(reinterpret_cast<const char*>(texels.data()), texels.size() * sizeof(glm::vec4));
+
+    writer->Close();
+    delete writer;
+}
+
+glm::mat4 VertexAnimationTexture::GetBoneMatrix(float frame, u32 bone) const
+{
+    var texel = [this](u32 f, u32 i)
     {
+        return texels[(static_cast<size_t>(f) * rowsPerFrame + i / width) * width + i % width];
+    };
 
-        var c = description->GetAllChildren();
+    frame = glm::clamp(frame, 0.0f, static_cast<float>(frameCount - 1));
+    u32 f0 = static_cast<u32>(frame);
+    u32 f1 = std::min(f0 + 1, frameCount - 1);
+    float blend = frame - f0;
 
-        for (auto value : c)
-        {
-            if (value->meshIndices.size() > 0 && !value->name.starts_with("TMSH_"))
-            {
-                value->SetParent(nullptr);
-                delete value;
-            }
-        }
+    glm::mat4 rows(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1);
+    for (u32 r = 0; r < 3; ++r)
+    {
+        rows[r] = mix(texel(f0, bone * 3 + r), texel(f1, bone * 3 + r), blend);
     }
-    */
 
-    for (int i = 0; i < scene->mNumMaterials; ++i)
+    return transpose(rows);
+}
+
+glm::vec3 VertexAnimationTexture::GetVertexPosition(float frame, u32 vertex) const
+{
+    var texel = [this](u32 f, u32 i)
     {
-        var mat = scene->mMaterials[i];
+        return texels[(static_cast<size_t>(f) * rowsPerFrame + i / width) * width + i % width];
+    };
 
-        var desc = new MaterialDescription;
+    frame = glm::clamp(frame, 0.0f, static_cast<float>(frameCount - 1));
+    u32 f0 = static_cast<u32>(frame);
+    u32 f1 = std::min(f0 + 1, frameCount - 1);
 
-        desc->Name = mat->GetName().C_Str();
+    return mix(glm::vec3(texel(f0, vertex * 2)), glm::vec3(texel(f1, vertex * 2)), frame - f0);
+}
 
-        for (int i = 0; i < mat->mNumProperties; ++i)
-        {
-            var property = mat->mProperties[i];
-        }
+float VertexAnimationTexture::MeasureError(Skeleton* skeleton, Animation* animation, const Mesh* mesh,
+                                           u32 samplesPerFrame) const
+{
+    if (!mesh || !mesh->vertices || samplesPerFrame == 0)
+        return 0;
 
-        std::map<int, string> typeToName = {
-            {aiTextureType_DIFFUSE, "s_texColor"}
-        };
+    float ticksPerSecond = animation->ticksPerSecond > 0 ? static_cast<float>(animation->ticksPerSecond) : 1.0f;
+    u32 sampleCount = (frameCount - 1) * samplesPerFrame + 1;
+    std::vector<float> errors(sampleCount, 0);
 
-        for (int i = 0; i < AI_TEXTURE_TYPE_MAX; ++i)
-        {
-            var type = static_cast<aiTextureType>(i);
-            var textureCount = mat->GetTextureCount(type);
+    job::parallelFor(sampleCount, [&](u32 sample)
+    {
+        std::vector<Animator::AnimationBone> channels;
+        std::vector<glm::mat4> palette;
+        Pose pose;
+        math::AABB bounds;
 
-            if (textureCount > 0)
-            {
+        float frame = static_cast<float>(sample) / samplesPerFrame;
+        float time = std::min(frame / frameRate * ticksPerSecond, animation->duration);
+        samplePose(skeleton, animation, time, channels, pose, palette);
 
-                var typeName = std::to_string(type);
+        std::vector<Vertex> expected(mesh->vertexCount);
+        skinVertices(mesh->vertices, expected.data(), mesh->vertexCount, palette.data(), palette.size(), bounds);
 
-                if (typeToName.contains(type))
-                {
-                    typeName = typeToName.at(type);
-                }
+        std::vector<Vertex> baked(mesh->vertexCount);
+        if (mode == Bones)
+        {
+            for (size_t bone = 0; bone < palette.size(); ++bone)
+            {
+                palette[bone] = GetBoneMatrix(frame, bone);
+            }
 
-                for (int j = 0; j < textureCount; ++j)
-                {
-                    aiString path;
-                    aiTextureMapping mapping;
-                    unsigned int uvindex;
-                    float blend;
-                    aiTextureOp op;
-                    aiTextureMapMode mapmode[3];
+            skinVertices(mesh->vertices, baked.data(), mesh->vertexCount, palette.data(), palette.size(), bounds);
+        }
+        else
+        {
+            for (u32 v = 0; v < mesh->vertexCount; ++v)
+            {
+                baked[v].position = GetVertexPosition(frame, v);
+            }
+        }
 
-                    aiReturn result = mat->GetTexture(type, j, &path, &mapping, &uvindex, &blend, &op, mapmode);
+        for (u32 v = 0; v < mesh->vertexCount; ++v)
+        {
+            errors[sample] = std::max(errors[sample], distance(expected[v].position, baked[v].position));
+        }
+    });
 
-                    u64 flags = 0;
+    return *std::max_element(errors.begin(), errors.end());
+}
 
-                    switch (mapmode[0])
-                    {
-                        case aiTextureMapMode_Clamp:
-                            flags |= TMGL_SAMPLER_U_CLAMP;
-                            break;
-                        case aiTextureMapMode_Mirror:
-                            flags |= TMGL_SAMPLER_U_MIRROR;
-                            break;
-                        case aiTextureMapMode_Wrap:
-                            break;
-                    }
+Texture* VertexAnimationTexture::CreateTexture()
+{
+    if (texture)
+        return texture;
 
-                    switch (mapmode[1])
-                    {
-                        case aiTextureMapMode_Clamp:
-                            flags |= TMGL_SAMPLER_V_CLAMP;
-                            break;
-                        case aiTextureMapMode_Mirror:
-                            flags |= TMGL_SAMPLER_V_MIRROR;
-                            break;
-                        case aiTextureMapMode_Wrap:
-                            break;
-                    }
+    texture = new Texture(width, GetHeight(), tmgl::TextureFormat::RGBA32F, TMGL_SAMPLER_POINT | TMGL_SAMPLER_UVW_CLAMP,
+                          tmgl::copy(texels.data(), texels.size() * sizeof(glm::vec4)),
+                          "TVAT_" + std::generateRandomString(8));
 
-                    if (result == aiReturn_SUCCESS)
-                    {
-                        var _tex = scene->GetEmbeddedTexture(path.C_Str());
+    return texture;
+}
 
+void VertexAnimationTexture::Apply(Material* material)
+{
+    material->features |= SubShader::VertexAnimation;
 
-                        Texture* tex = nullptr;
+    var sampler = material->GetUniform("s_vat");
+    sampler->tex = CreateTexture();
+    sampler->forcedSamplerIndex = VAT_SAMPLER;
+    sampler->shaderType = SubShader::Vertex;
 
-                        if (_tex)
-                        {
-                            tex = GetTextureFromName(_tex->mFilename.C_Str());
+    var params = material->GetUniform("u_vatParams");
+    params->v4 = glm::vec4(frameRate, frameCount, width, rowsPerFrame);
+    params->shaderType = SubShader::Vertex;
 
-                            if (!tex)
-                            {
-                                tex = new Texture(_tex->pcData, _tex->mWidth, flags);
+    var instance = material->GetUniform("u_vatInstance");
+    instance->v4 = glm::vec4(0, GetHeight(), mode, 0);
+    instance->shaderType = SubShader::Vertex;
+}
 
-                                if (isValid(tex->handle))
-                                {
-                                    tex->name = _tex->mFilename.C_Str();
+void VertexAnimationTexture::DrawInstances(Mesh* mesh, Material* material, const std::vector<glm::mat4>& transforms,
+                                           const std::vector<float>& times, u32 layer, u32 renderLayer)
+{
+    // The shader reads the playback time from i_data4.x instead of u_vatInstance
+    std::vector<glm::vec4> parameters(transforms.size(), glm::vec4(0));
+    for (size_t i = 0; i < parameters.size() && i < times.size(); ++i)
+    {
+        parameters[i].x = times[i];
+    }
 
-                                    textures.push_back(tex);
-                                }
-                                else
-                                {
-                                    tex = nullptr;
-                                }
-                            }
-                        }
-                        else
-                        {
-                            if (description)
-                            {
-                                var fpath = std::filesystem::path(description->path).parent_path();
+    mesh->drawInstanced(transforms, parameters, material, layer, renderLayer);
+}
 
-                                string _path = path.C_Str();
+void VertexAnimationTexture::SetInstance(Material* material, float time)
+{
+    material->GetUniform("u_vatInstance")->v4.x = time;
+}
 
-                                if (type == aiTextureType_DIFFUSE && _path.ends_with("_NRM.png"))
-                                {
-                                    _path.erase(_path.find("_NRM"), 4);
-                                }
+Mesh* VertexAnimationTexture::CreateMesh(const Mesh* source)
+{
+    if (!source->vertices || !source->indices)
+    {
+        std::cout << "Mesh " << source->name << " has no CPU vertices to copy" << std::endl;
+        return nullptr;
+    }
 
-                                var file = std::filesystem::path(_path);
+    var vertices = new Vertex[source->vertexCount];
+    for (u32 v = 0; v < source->vertexCount; ++v)
+    {
+        vertices[v] = source->vertices[v];
+        vertices[v].boneIds = glm::vec4(v, -1, -1, -1);
+        vertices[v].boneWeights = glm::vec4(1, 0, 0, 0);
+    }
 
+    // Absolute indices, createMesh narrows or splits them again like it did for the source
+    var indices = new u32[source->indexCount];
+    for (u32 i = 0; i < source->indexCount; ++i)
+    {
+        indices[i] = source->GetIndex(i);
+    }
 
-                                tex = Texture::CreateTexture(fpath.string() + "/" + file.string(), flags);
+    return createMesh(vertices, indices, source->vertexCount, source->indexCount, Vertex::getVertexLayout(),
+                      source->model);
+}
 
-                                if (tex)
-                                {
+void Animator::LoadAnimationBones()
+{
 
+    if (!skeleton)
+    {
+        skeleton = parent->GetObjectFromType<SkeletonObject>();
+    }
 
-                                    if (isValid(tex->handle))
-                                    {
+    if (skeleton)
+    {
 
-                                        textures.push_back(tex);
-                                    }
-                                }
+        for (auto& node_channel : currentAnimation->nodeChannels)
+        {
+            var animBone = new AnimationBone;
 
-                            }
+            animBone->channel = &node_channel;
+            animBone->animation = currentAnimation;
+            animBone->joint = skeleton->skeleton->FindJoint(node_channel.name);
 
+            animationBones.push_back(animBone);
+        }
+    }
+}
 
-                        }
+void Animator::SetAnimation(Animation* animation)
+{
 
-                        if (tex)
-                            desc->Textures.insert(std::make_pair(typeName, tex->name));
-                    }
-                }
-            }
-        }
+    currentAnimation = animation;
+    time = 0;
+    for (auto animation_bone : animationBones)
+    {
+        delete animation_bone;
+    }
+    animationBones.clear();
 
+    for (auto animation_bone : fadeBones)
+    {
+        delete animation_bone;
+    }
+    fadeBones.clear();
+    fadeAnimation = nullptr;
 
-        materials.push_back(desc);
+    LoadAnimationBones();
+}
+
+void Animator::CrossFade(Animation* animation, float duration)
+{
+    if (!currentAnimation || duration <= 0)
+    {
+        SetAnimation(animation);
+        return;
     }
 
-    for (int i = 0; i < scene->mNumSkeletons; ++i)
+    // Fading again mid fade drops the oldest clip
+    for (auto animation_bone : fadeBones)
     {
-        var skl = scene->mSkeletons[i];
+        delete animation_bone;
+    }
 
-        break;
+    fadeAnimation = currentAnimation;
+    fadeBones = std::move(animationBones);
+    fadeTime = time;
+    fadeElapsed = 0;
+    fadeDuration = duration;
+
+    currentAnimation = animation;
+    time = 0;
+    animationBones.clear();
+
+    LoadAnimationBones();
+}
+
+Animator::Layer* Animator::AddLayer(Animation* animation, float weight, bool additive,
+                                    const std::vector<string>& maskRoots)
+{
+    var layer = new Layer();
+    layer->animation = animation;
+    layer->weight = weight;
+    layer->additive = additive;
+
+    if (!skeleton)
+        skeleton = parent->GetObjectFromType<SkeletonObject>();
+
+    if (!maskRoots.empty() && skeleton)
+        layer->mask = skeleton->skeleton->CreateMask(maskRoots);
+
+    layers.push_back(layer);
+
+    return layer;
+}
+
+void Animator::RemoveLayer(Layer* layer)
+{
+    std::erase(layers, layer);
+    delete layer;
+}
+
+SkeletonObject::SkeletonObject(Skeleton* skl)
+{
+    skeleton = skl;
+
+    if (skeleton->joints.empty())
+        skeleton->Compile();
+
+    ResetPose();
+}
+
+void SkeletonObject::ResetPose()
+{
+    pose.Reset(skeleton);
+}
+
+void Pose::Reset(const Skeleton* skeleton)
+{
+    var count = skeleton->joints.size();
+
+    positions.resize(count);
+    rotations.resize(count);
+    scales.resize(count);
+    modelTransforms.resize(count, glm::mat4(1.0));
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        var bone = skeleton->joints[i];
+
+        positions[i] = bone->position;
+        rotations[i] = bone->rotation;
+        scales[i] = bone->scale;
     }
+}
 
-    if (scene->mSkeletons == nullptr)
+void Pose::Resolve(const Skeleton* skeleton, std::vector<glm::mat4>& palette)
+{
+    palette.assign(skeleton->bones.size(), glm::mat4(1.0));
+
+    const var& parents = skeleton->parents;
+    const var& paletteIndices = skeleton->paletteIndices;
+    const var& offsets = skeleton->offsets;
+
+    // Parents are compiled ahead of their children, so one forward pass resolves the whole hierarchy
+    for (size_t i = 0; i < parents.size(); ++i)
     {
-        for (auto value : skeleton->bones)
-        {
-            var node = scene->mRootNode->FindNode(value->name.c_str());
+        glm::mat4 local = glm::translate(glm::mat4(1.0), positions[i]) * toMat4(rotations[i]) *
+            glm::scale(glm::mat4(1.0), scales[i]);
 
-            value->CopyTransformation(math::convertMat4(node->mTransformation));
+        modelTransforms[i] = parents[i] < 0 ? local : modelTransforms[parents[i]] * local;
 
-            for (int i = 0; i < node->mNumChildren; ++i)
-            {
-                var child = node->mChildren[i];
-                value->children.push_back(child->mName.C_Str());
-            }
+        var index = paletteIndices[i];
+        if (index >= 0 && index < palette.size())
+            palette[index] = modelTransforms[i] * offsets[i];
+    }
+}
+
+void SkeletonObject::Start()
+{
+
+    Object::Start();
+}
+
+void SkeletonObject::Update()
+{
+    // Animated skeletons get their palette from the animator's job
+    if (!animator)
+        UpdatePalette();
+
+    Object::Update();
+}
+
+// Lerps count vec3s with one weight per vec3. Four joints are twelve floats, three registers
+static void blendVectors(const glm::vec3* a, const glm::vec3* b, const float* weights, glm::vec3* out, size_t count)
+{
+    size_t i = 0;
+
+#if defined(TM_POSE_SSE) || defined(TM_POSE_NEON)
+    const float* fa = &a[0].x;
+    const float* fb = &b[0].x;
+    float* fo = &out[0].x;
+
+    for (; i + 4 <= count; i += 4)
+    {
+        for (int r = 0; r < 3; ++r)
+        {
+            size_t f = i * 3 + r * 4;
+#ifdef TM_POSE_SSE
+            __m128 w4 = _mm_loadu_ps(weights + i);
+            __m128 w = r == 0
+                           ? _mm_shuffle_ps(w4, w4, _MM_SHUFFLE(1, 0, 0, 0))
+                           : r == 1
+                           ? _mm_shuffle_ps(w4, w4, _MM_SHUFFLE(2, 2, 1, 1))
+                           : _mm_shuffle_ps(w4, w4, _MM_SHUFFLE(3, 3, 3, 2));
+
+            __m128 va = _mm_loadu_ps(fa + f);
+            __m128 vb = _mm_loadu_ps(fb + f);
+            _mm_storeu_ps(fo + f, _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), w)));
+#else
+            const float* wi = weights + i;
+            float32x4_t w = r == 0
+                                ? float32x4_t{wi[0], wi[0], wi[0], wi[1]}
+                                : r == 1
+                                ? float32x4_t{wi[1], wi[1], wi[2], wi[2]}
+                                : float32x4_t{wi[2], wi[3], wi[3], wi[3]};
+
+            float32x4_t va = vld1q_f32(fa + f);
+            float32x4_t vb = vld1q_f32(fb + f);
+            vst1q_f32(fo + f, vmlaq_f32(va, vsubq_f32(vb, va), w));
+#endif
         }
     }
+#endif
 
-    for (int i = 0; i < scene->mNumAnimations; ++i)
+    for (; i < count; ++i)
     {
-        var anim = scene->mAnimations[i];
+        out[i] = mix(a[i], b[i], weights[i]);
+    }
+}
 
-        var animation = new Animation();
-        animation->LoadFromAiAnimation(anim);
+// Normalized lerp along the shorter arc, one quaternion per register
+static void blendRotations(const glm::quat* a, const glm::quat* b, const float* weights, glm::quat* out,
+                           size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+#if defined(TM_POSE_SSE)
+        __m128 qa = _mm_loadu_ps(&a[i].x);
+        __m128 qb = _mm_loadu_ps(&b[i].x);
 
+        __m128 d = _mm_mul_ps(qa, qb);
+        d = _mm_add_ps(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(2, 3, 0, 1)));
+        d = _mm_add_ps(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(1, 0, 3, 2)));
 
-        animations.push_back(animation);
+        // Flip b into a's hemisphere by moving the dot product's sign onto it
+        qb = _mm_xor_ps(qb, _mm_and_ps(d, _mm_set1_ps(-0.0f)));
 
-        //break;
+        __m128 q = _mm_add_ps(qa, _mm_mul_ps(_mm_sub_ps(qb, qa), _mm_set1_ps(weights[i])));
+
+        __m128 l = _mm_mul_ps(q, q);
+        l = _mm_add_ps(l, _mm_shuffle_ps(l, l, _MM_SHUFFLE(2, 3, 0, 1)));
+        l = _mm_add_ps(l, _mm_shuffle_ps(l, l, _MM_SHUFFLE(1, 0, 3, 2)));
+
+        _mm_storeu_ps(&out[i].x, _mm_div_ps(q, _mm_sqrt_ps(l)));
+#elif defined(TM_POSE_NEON)
+        float32x4_t qa = vld1q_f32(&a[i].x);
+        float32x4_t qb = vld1q_f32(&b[i].x);
+
+        if (vaddvq_f32(vmulq_f32(qa, qb)) < 0)
+            qb = vnegq_f32(qb);
+
+        float32x4_t q = vmlaq_n_f32(qa, vsubq_f32(qb, qa), weights[i]);
+        float32x4_t l = vdupq_n_f32(vaddvq_f32(vmulq_f32(q, q)));
+
+        vst1q_f32(&out[i].x, vdivq_f32(q, vsqrtq_f32(l)));
+#else
+        glm::quat qb = dot(a[i], b[i]) < 0 ? -b[i] : b[i];
+        out[i] = normalize(a[i] + (qb - a[i]) * weights[i]);
+#endif
     }
+}
+
+void Pose::Blend(const Pose& a, const Pose& b, const float* weights, Pose& out)
+{
+    var count = std::min(a.positions.size(), b.positions.size());
+
+    out.positions.resize(count);
+    out.rotations.resize(count);
+    out.scales.resize(count);
+    out.modelTransforms.resize(count, glm::mat4(1.0));
 
+    blendVectors(a.positions.data(), b.positions.data(), weights, out.positions.data(), count);
+    blendRotations(a.rotations.data(), b.rotations.data(), weights, out.rotations.data(), count);
+    blendVectors(a.scales.data(), b.scales.data(), weights, out.scales.data(), count);
 }
 
+void Pose::Add(const Pose& additive, const Pose& reference, const float* weights)
+{
+    var count = std::min({positions.size(), additive.positions.size(), reference.positions.size()});
 
-Model::~Model()
+    for (size_t i = 0; i < count; ++i)
+    {
+        float w = weights[i];
+        if (w <= 0)
+            continue;
+
+        positions[i] += (additive.positions[i] - reference.positions[i]) * w;
+
+        // Weighted by nlerping the delta away from identity
+        glm::quat identity{1, 0, 0, 0};
+        glm::quat delta = inverse(reference.rotations[i]) * additive.rotations[i];
+        if (delta.w < 0)
+            delta = -delta;
+        rotations[i] = normalize(rotations[i] * normalize(identity + (delta - identity) * w));
+
+        glm::vec3 scaleDelta = additive.scales[i] / glm::max(reference.scales[i], glm::vec3(1e-6f));
+        scales[i] *= mix(glm::vec3(1), scaleDelta, w);
+    }
+}
+
+void SkeletonObject::UpdatePalette()
 {
-    delete[] meshes.data();
-    delete[] textures.data();
-    delete[] materials.data();
-    delete[] animations.data();
+    if (!skeleton)
+        return;
 
-    delete skeleton;
+    sharedPose = nullptr;
+    sharedPalette = nullptr;
+
+    pose.Resolve(skeleton, boneMatrices);
+
+    UpdateAttachments();
 }
 
-glm::vec3 SceneDescription::Node::GetGlobalPosition()
+void SkeletonObject::SharePose(const Pose* pose, const std::vector<glm::mat4>* palette)
 {
-    var p = position;
+    sharedPose = pose;
+    sharedPalette = palette;
 
-    if (parent)
-        p += parent->GetGlobalPosition();
+    UpdateAttachments();
+}
 
-    return p;
+const std::vector<glm::mat4>& SkeletonObject::GetPalette() const
+{
+    return sharedPalette ? *sharedPalette : boneMatrices;
 }
 
-Model::Model(fs::BinaryReader* reader, SceneDescription* description)
+const Pose& SkeletonObject::GetPose() const
 {
-    var tmdlSig = reader->ReadString(4);
+    return sharedPose ? *sharedPose : pose;
+}
 
-    var scale = reader->ReadSingle();
+void SkeletonObject::UpdateAttachments()
+{
+    const var& modelTransforms = GetPose().modelTransforms;
 
-    if (tmdlSig != "TMDL")
+    for (auto bone : bones)
     {
-        std::cout << "Incorrect tmdl format!" << std::endl;
-        return;
+        if (bone->joint < 0 || bone->joint >= modelTransforms.size())
+            continue;
+
+        var transform = modelTransforms[bone->joint];
+
+        // Bones loaded from the scene keep their hierarchy, so they're placed relative to their parent's joint
+        var parentBone = bone->parent ? bone->parent->Cast<BoneObject>() : nullptr;
+        if (parentBone && parentBone->joint >= 0 && parentBone->joint < modelTransforms.size())
+            transform = inverse(modelTransforms[parentBone->joint]) * transform;
+
+        glm::vec3 skew;
+        glm::vec4 perspective;
+        decompose(transform, bone->scale, bone->rotation, bone->position, skew, perspective);
     }
+}
 
-    name = reader->ReadString();
+std::vector<float> Skeleton::CreateMask(const std::vector<string>& roots) const
+{
+    std::vector<float> mask(joints.size(), 0.0f);
 
-    SceneDescription::Node* modelNode;
-    if (description)
+    for (const auto& root : roots)
     {
+        var joint = FindJoint(root);
+        if (joint >= 0)
+            mask[joint] = 1.0f;
+    }
 
-        modelNode = new SceneDescription::Node;
-        modelNode->name = name;
-        modelNode->scene = description;
-        modelNode->SetParent(description->rootNode);
+    // Children come after their parents, so they inherit in the same pass
+    for (size_t i = 0; i < joints.size(); ++i)
+    {
+        if (parents[i] >= 0 && mask[parents[i]] > 0)
+            mask[i] = mask[parents[i]];
     }
 
-    var meshCount = reader->ReadInt32();
+    return mask;
+}
 
-    for (int i = 0; i < meshCount; ++i)
+int Skeleton::FindJoint(StringId name) const
+{
+    for (size_t i = 0; i < jointNames.size(); ++i)
     {
-        var tmshSig = reader->ReadString(4);
-        if (tmshSig == "TMSH")
-        {
-            var name = reader->ReadString();
-
-            var vtxCount = reader->ReadInt32();
-            var vertices = new Vertex[vtxCount];
+        if (jointNames[i] == name)
+            return static_cast<int>(i);
+    }
 
-            reader->Skip(4);
+    return -1;
+}
 
-            for (int i = 0; i < vtxCount; ++i)
-            {
-                glm::vec3 p = math::convertVec3(reader->ReadFloatArray(3)) * scale;
-                glm::vec3 n = math::convertVec3(reader->ReadFloatArray(3));
-                glm::vec2 u = math::convertVec2(reader->ReadFloatArray(2));
+void Skeleton::Compile()
+{
+    joints.clear();
+    jointNames.clear();
+    parents.clear();
+    paletteIndices.clear();
+    offsets.clear();
 
-                var boneIdxCount = reader->ReadInt32();
-                var boneIds = reader->ReadArray<s32>(boneIdxCount);
+    std::unordered_map<StringId, Bone*> byName;
+    std::unordered_map<StringId, bool> isChild;
 
-                var weightCount = reader->ReadInt32();
-                var weights = reader->ReadArray<float>(weightCount);
+    for (auto bone : bones)
+    {
+        byName[bone->name] = bone;
+        for (const auto& child : bone->children)
+        {
+            isChild[child] = true;
+        }
+    }
 
-                Vertex vtx = {p, n, u, math::convertIVec4(boneIds, boneIdxCount),
-                              math::convertVec4(weights, weightCount)};
-                vertices[i] = vtx;
-            }
+    // Breadth first from every root, so a joint's parent is always already placed
+    std::vector<std::pair<Bone*, int>> queue;
+    for (auto bone : bones)
+    {
+        if (!isChild.contains(bone->name))
+            queue.emplace_back(bone, -1);
+    }
 
-            reader->Skip(4);
-            var idxCount = reader->ReadInt32();
-            var incs = new u16[idxCount];
+    std::unordered_map<StringId, bool> placed;
+    for (size_t head = 0; head < queue.size(); ++head)
+    {
+        var [bone, parent] = queue[head];
 
-            for (int i = 0; i < idxCount; ++i)
-            {
-                incs[i] = reader->ReadUInt16();
-            }
+        if (placed.contains(bone->name))
+            continue;
+        placed[bone->name] = true;
 
-            if (vtxCount == 2162)
-            {
-                var vert = vertices[116];
-                std::cout << vert.position.x << std::endl;
-            }
+        int joint = static_cast<int>(joints.size());
+        var info = boneInfoMap.find(bone->name);
 
-            var materialIndex = reader->ReadInt32();
+        joints.push_back(bone);
+        jointNames.push_back(bone->name);
+        parents.push_back(parent);
+        paletteIndices.push_back(info != boneInfoMap.end() ? info->second.id : -1);
+        offsets.push_back(info != boneInfoMap.end() ? info->second.offset : glm::mat4(1.0));
 
-            meshes.push_back(createMesh(vertices, incs, vtxCount, idxCount, Vertex::getVertexLayout(), this));
-            materialIndices.push_back((materialIndex));
+        for (const auto& child : bone->children)
+        {
+            var found = byName.find(child);
+            if (found != byName.end())
+                queue.emplace_back(found->second, joint);
         }
     }
 
-    var textureCount = reader->ReadInt32();
+    // Children come after their parents, so walking backwards sees every child before its parent
+    jointHeights.assign(joints.size(), 0);
+    for (size_t i = joints.size(); i-- > 0;)
+    {
+        if (parents[i] >= 0)
+            jointHeights[parents[i]] = std::max<u8>(jointHeights[parents[i]], std::min(jointHeights[i] + 1, 255));
+    }
 
-    for (int i = 0; i < textureCount; ++i)
+    // The SKINNED shader only sees the first MAX_BONE_MATRICES palette entries
+    if (boneInfoMap.size() > MAX_BONE_MATRICES)
     {
-        long p = reader->tellg();
-        var texSig = reader->ReadString(4);
-        if (texSig == "TTEX")
-        {
+        std::cout << "Skeleton has " << boneInfoMap.size() << " skinned bones, only " << MAX_BONE_MATRICES
+                  << " can be skinned on the GPU" << std::endl;
+    }
+}
 
-            var name = reader->ReadString();
+Model::Model(string path)
+{
+    if (path.ends_with(".tmdl"))
+    {
 
-            var width = reader->ReadInt32();
-            var height = reader->ReadInt32();
-            var channelCount = reader->ReadInt32();
 
-            var size = width * height * channelCount;
-            std::vector<unsigned char> dataV;
-            for (int x = 0; x < width; ++x)
-            {
-                for (int y = 0; y < height; ++y)
-                {
-                    for (int j = 0; j < channelCount; ++j)
-                    {
-                        dataV.push_back(reader->ReadByte());
-                    }
-                }
-            }
+        var reader = new fs::BinaryReader(path);
 
-            var format = tmgl::TextureFormat::RGBA8;
 
-            switch (channelCount)
-            {
-                case 1:
-                    format = tmgl::TextureFormat::R8;
-                    break;
-                case 2:
-                    format = tmgl::TextureFormat::RG8;
-                    break;
-                case 3:
-                    format = tmgl::TextureFormat::RGB8;
-                    break;
-                default:
-                    break;
+        reader->close();
+
+    }
+    else
+    {
+
+
+        Assimp::Importer import;
+        const aiScene* scene = import.ReadFile(path,
+                                               aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_GenUVCoords);
+
+        if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+        {
+            std::cout << "ERROR::ASSIMP::" << import.GetErrorString() << std::endl;
+            return;
+        }
+
+        LoadFromAiScene(scene);
+
+        import.FreeScene();
+    }
+}
+
+Skeleton::Bone* Skeleton::GetBone(string name)
+{
+    /*
+    for (auto value : bones)
+    {
+        if (value->name == name)
+            return value;
+    }
+    */
+    var info = boneInfoMap.find(name);
+    if (info != boneInfoMap.end() && bones.size() > 0)
+    {
+        var id = info->second.id;
+
+        if (bones.size() > id)
+            return bones[id];
+    }
+
+    return nullptr;
+}
+
+Skeleton::Bone* Skeleton::GetParent(Bone* b)
+{
+    for (auto value : bones)
+    {
+        if (value->name != b->name)
+        {
+            for (auto child : value->children)
+            {
+                if (child == b->name)
+                    return value;
             }
+        }
+    }
+    return nullptr;
+}
 
-            var tex = new Texture(width, height, format, TMGL_SAMPLER_UVW_CLAMP, tmgl::copy(dataV.data(), size), name);
+Model::Model(const aiScene* scene)
+{
+    LoadFromAiScene(scene);
+}
+
+Model::Model(const aiScene* scene, SceneDescription* description)
+{
+    LoadFromAiScene(scene, description);
+}
+
+static u64 hashTextureData(const aiTexture* texture)
+{
+    // Compressed textures store their byte size in mWidth, raw ones are mWidth * mHeight texels
+    size_t size = texture->mHeight == 0 ? texture->mWidth : texture->mWidth * texture->mHeight * sizeof(aiTexel);
+
+    return StringId::Hash(std::string_view(reinterpret_cast<const char*>(texture->pcData), size));
+}
+
+void Model::LoadFromAiScene(const aiScene* scene, SceneDescription* description)
+{
+    name = "TMDL_" + std::string(scene->mName.C_Str());
+    skeleton = new Skeleton();
+
+    skeleton->inverseTransform = math::convertMat4(scene->mRootNode->mTransformation.Inverse());
+
+
+    int maxBones = INT_MAX;
+    SceneDescription::Node* modelNode;
+    if (description)
+    {
+
+        modelNode = new SceneDescription::Node;
+        modelNode->name = name;
+        modelNode->scene = description;
+        modelNode->SetParent(description->rootNode);
+
+    }
+
+    // Bone merging touches the shared skeleton, so it stays on this thread and only
+    // records the resolved id of every aiBone for the conversion pass below
+    std::vector<std::vector<int>> boneIds(scene->mNumMeshes);
+
+    for (int i = 0; i < scene->mNumMeshes; ++i)
+    {
+        var msh = scene->mMeshes[i];
+
+        boneIds[i].resize(msh->mNumBones);
+
+        for (int j = 0; j < msh->mNumBones; ++j)
+        {
+            var b = msh->mBones[j];
+
+            int boneId = -1;
+            string boneName = b->mName.C_Str();
+
+            if (boneName.starts_with("Armature_"))
+            {
+                boneName.erase(boneName.find("Armature_"), strlen("Armature_"));
+            }
+
+            if (!skeleton->boneInfoMap.contains(boneName))
+            {
+                BoneInfo boneInfo;
+                boneInfo.id = skeleton->boneInfoMap.size();
+                boneInfo.offset = math::convertMat4(b->mOffsetMatrix);
+
+                skeleton->boneInfoMap[boneName] = boneInfo;
+                boneId = boneInfo.id;
+            }
+            else
+            {
+                boneId = skeleton->boneInfoMap[boneName].id;
+
+                skeleton->boneInfoMap[boneName].offset = math::convertMat4(b->mOffsetMatrix);
+            }
+
+            var bone = skeleton->GetBone(boneName);
+
+            if (bone == nullptr)
+            {
+
+                bone = new Skeleton::Bone;
+                bone->name = boneName;
+                bone->skeleton = skeleton;
+
+                skeleton->bones.push_back(bone);
+            }
+
+            bone->weights.reserve(bone->weights.size() + b->mNumWeights);
+            for (int k = 0; k < b->mNumWeights; ++k)
+            {
+                var weight = b->mWeights[k];
+
+                bone->weights.push_back(Skeleton::Bone::VertexWeight{weight.mVertexId, weight.mWeight});
+            }
+
+            boneIds[i][j] = boneId;
+
+            if (boneId >= maxBones)
+            {
+                std::cout << "Null bone data found: " << boneName << std::endl;
+            }
+
+            if (description)
+            {
+
+                if (j == 0)
+                {
+                    var anode = description->GetNode("Armature");
+
+                    skeleton->rootName = boneName;
+                    if (anode != nullptr && anode != description->rootNode)
+                    {
+                        anode->SetParent(modelNode);
+                    }
+                }
+
+                var bnode = description->GetNode(boneName);
+                if (bnode)
+                    bnode->isBone = true;
+            }
+        }
+    }
+
+    struct ImportedMesh
+    {
+        Vertex* vertices = nullptr;
+        u32* indices = nullptr;
+        u32 vertexCount = 0;
+        u32 indexCount = 0;
+    };
+
+    std::vector<ImportedMesh> imported(scene->mNumMeshes);
+
+    // Every aiMesh converts into its own pre-sized arrays, so the meshes can be split across the workers
+    job::parallelFor(scene->mNumMeshes, [&](u32 i)
+    {
+        var msh = scene->mMeshes[i];
+        var& out = imported[i];
+
+        // Filled in place, the mesh takes ownership of both arrays
+        out.vertexCount = msh->mNumVertices;
+        out.vertices = new Vertex[out.vertexCount];
+
+        for (int j = 0; j < msh->mNumVertices; ++j)
+        {
+            aiVector3D pos(0), norm(0), uv(0);
+            pos = msh->mVertices[j];
+            if (msh->HasNormals())
+                norm = msh->mNormals[j];
+            if (msh->HasTextureCoords(0))
+                uv = msh->mTextureCoords[0][j];
+
+            var vertex = Vertex{};
+
+            vertex.position = glm::vec3{pos.x, pos.y, pos.z};
+            vertex.normal = glm::vec3{norm.x, norm.y, norm.z};
+            vertex.uv0 = glm::vec2{uv.x, uv.y};
+            out.vertices[j] = vertex;
+        }
+
+        for (unsigned int j = 0; j < msh->mNumFaces; j++)
+        {
+            out.indexCount += msh->mFaces[j].mNumIndices;
+        }
+
+        out.indices = new u32[out.indexCount];
+        u32 index = 0;
+
+        for (unsigned int j = 0; j < msh->mNumFaces; j++)
+        {
+            const aiFace& face = msh->mFaces[j];
+            for (unsigned int k = 0; k < face.mNumIndices; k++)
+                out.indices[index++] = face.mIndices[k];
+        }
+
+        for (int j = 0; j < msh->mNumBones; ++j)
+        {
+            var b = msh->mBones[j];
+
+            for (int k = 0; k < b->mNumWeights; ++k)
+            {
+                var weight = b->mWeights[k];
+
+                out.vertices[weight.mVertexId].SetBoneData(boneIds[i][j], weight.mWeight);
+            }
+        }
+    });
+
+    // Uploads and scene nodes stay on the calling thread, in mesh order
+    for (int i = 0; i < scene->mNumMeshes; ++i)
+    {
+        var msh = scene->mMeshes[i];
+        var& out = imported[i];
+
+        var mesh = createMesh(out.vertices, out.indices, out.vertexCount, out.indexCount, Vertex::getVertexLayout(),
+                              this, msh->mName.C_Str());
+
+        meshes.push_back(mesh);
+        materialIndices.push_back(msh->mMaterialIndex);
+
+        for (int j = 0; j < msh->mNumBones; ++j)
+        {
+            var bone = msh->mBones[j];
+
+            mesh->bones.push_back(bone->mName.C_Str());
+        }
+
+
+        if (description)
+        {
+            var mnd = description->GetNode(msh, i);
+
+            if (mnd)
+            {
+
+                var meshNode = new SceneDescription::Node;
+                meshNode->name = "TMSH_" + mnd->name;
+
+                meshNode->meshIndices.push_back(i);
+                meshNode->SetParent(modelNode);
+
+                meshNode->position = mnd->position;
+                meshNode->rotation = mnd->rotation;
+                meshNode->scale = mnd->scale;
+                meshNode->scene = description;
+
+                mnd->SetParent(nullptr);
+
+                delete mnd;
+            }
+        }
+
+    }
+
+    /*
+    if (description)
+    {
+
+        var c = description->GetAllChildren();
+
+        for (auto value : c)
+        {
+            if (value->meshIndices.size() > 0 && !value->name.starts_with("TMSH_"))
+            {
+                value->SetParent(nullptr);
+                delete value;
+            }
+        }
+    }
+    */
+
+    for (int i = 0; i < scene->mNumMaterials; ++i)
+    {
+        var mat = scene->mMaterials[i];
+
+        var desc = new MaterialDescription;
+
+        desc->Name = mat->GetName().C_Str();
+
+        for (int i = 0; i < mat->mNumProperties; ++i)
+        {
+            var property = mat->mProperties[i];
+        }
+
+        std::map<int, string> typeToName = {
+            {aiTextureType_DIFFUSE, "s_texColor"}
+        };
+
+        for (int i = 0; i < AI_TEXTURE_TYPE_MAX; ++i)
+        {
+            var type = static_cast<aiTextureType>(i);
+            var textureCount = mat->GetTextureCount(type);
+
+            if (textureCount > 0)
+            {
+
+                var typeName = std::to_string(type);
+
+                if (typeToName.contains(type))
+                {
+                    typeName = typeToName.at(type);
+                }
+
+                for (int j = 0; j < textureCount; ++j)
+                {
+                    aiString path;
+                    aiTextureMapping mapping;
+                    unsigned int uvindex;
+                    float blend;
+                    aiTextureOp op;
+                    aiTextureMapMode mapmode[3];
+
+                    aiReturn result = mat->GetTexture(type, j, &path, &mapping, &uvindex, &blend, &op, mapmode);
+
+                    u64 flags = 0;
+
+                    switch (mapmode[0])
+                    {
+                        case aiTextureMapMode_Clamp:
+                            flags |= TMGL_SAMPLER_U_CLAMP;
+                            break;
+                        case aiTextureMapMode_Mirror:
+                            flags |= TMGL_SAMPLER_U_MIRROR;
+                            break;
+                        case aiTextureMapMode_Wrap:
+                            break;
+                    }
+
+                    switch (mapmode[1])
+                    {
+                        case aiTextureMapMode_Clamp:
+                            flags |= TMGL_SAMPLER_V_CLAMP;
+                            break;
+                        case aiTextureMapMode_Mirror:
+                            flags |= TMGL_SAMPLER_V_MIRROR;
+                            break;
+                        case aiTextureMapMode_Wrap:
+                            break;
+                    }
+
+                    if (result == aiReturn_SUCCESS && !renderer->headless)
+                    {
+                        var _tex = scene->GetEmbeddedTexture(path.C_Str());
+
+
+                        Texture* tex = nullptr;
+
+                        if (_tex)
+                        {
+                            // Exporters often embed the same image once per material under different names
+                            var hash = hashTextureData(_tex);
+
+                            if (ResMgr->loaded_embedded_textures.contains(hash))
+                            {
+                                tex = ResMgr->loaded_embedded_textures[hash];
+
+                                if (!IN_VECTOR(textures, tex))
+                                    textures.push_back(tex);
+                            }
+                            else
+                            {
+                                tex = GetTextureFromName(_tex->mFilename.C_Str());
+
+                                if (!tex)
+                                {
+                                    tex = new Texture(_tex->pcData, _tex->mWidth, flags);
+
+                                    if (isValid(tex->handle))
+                                    {
+                                        tex->name = _tex->mFilename.C_Str();
+
+                                        textures.push_back(tex);
+                                    }
+                                    else
+                                    {
+                                        tex = nullptr;
+                                    }
+                                }
+
+                                if (tex)
+                                    ResMgr->loaded_embedded_textures[hash] = tex;
+                            }
+                        }
+                        else
+                        {
+                            if (description)
+                            {
+                                var fpath = std::filesystem::path(description->path).parent_path();
+
+                                string _path = path.C_Str();
+
+                                if (type == aiTextureType_DIFFUSE && _path.ends_with("_NRM.png"))
+                                {
+                                    _path.erase(_path.find("_NRM"), 4);
+                                }
+
+                                var file = std::filesystem::path(_path);
+
+
+                                tex = Texture::CreateTexture(fpath.string() + "/" + file.string(), flags);
+
+                                if (tex)
+                                {
+
+
+                                    if (isValid(tex->handle) && !(IN_VECTOR(textures, tex)))
+                                    {
+
+                                        textures.push_back(tex);
+                                    }
+                                }
+
+                            }
+
+
+                        }
+
+                        if (tex)
+                            desc->Textures.insert(std::make_pair(typeName, tex->name));
+                    }
+                }
+            }
+        }
+
+
+        materials.push_back(desc);
+    }
+
+    for (int i = 0; i < scene->mNumSkeletons; ++i)
+    {
+        var skl = scene->mSkeletons[i];
+
+        break;
+    }
+
+    if (scene->mSkeletons == nullptr)
+    {
+        for (auto value : skeleton->bones)
+        {
+            var node = scene->mRootNode->FindNode(value->name.c_str());
+
+            value->CopyTransformation(math::convertMat4(node->mTransformation));
+
+            for (int i = 0; i < node->mNumChildren; ++i)
+            {
+                var child = node->mChildren[i];
+                value->children.push_back(child->mName.C_Str());
+            }
+        }
+    }
+
+    for (int i = 0; i < scene->mNumAnimations; ++i)
+    {
+        var anim = scene->mAnimations[i];
+
+        var animation = new Animation();
+        animation->LoadFromAiAnimation(anim);
+
+
+        animations.push_back(animation);
+
+        //break;
+    }
+
+    skeleton->Compile();
+}
+
+
+Model::~Model()
+{
+    for (auto mesh : meshes)
+    {
+        delete mesh;
+    }
+
+    for (auto material : materials)
+    {
+        delete material;
+    }
+
+    for (auto animation : animations)
+    {
+        delete animation;
+    }
+
+    delete skeleton;
+}
+
+glm::vec3 SceneDescription::Node::GetGlobalPosition()
+{
+    var p = position;
+
+    if (parent)
+        p += parent->GetGlobalPosition();
+
+    return p;
+}
+
+Model::Model(fs::BinaryReader* reader, SceneDescription* description)
+{
+    var tmdlSig = reader->ReadString(4);
+
+    var scale = reader->ReadSingle();
+
+    if (tmdlSig != "TMDL")
+    {
+        std::cout << "Incorrect tmdl format!" << std::endl;
+        return;
+    }
+
+    name = reader->ReadString();
+
+    SceneDescription::Node* modelNode;
+    if (description)
+    {
+
+        modelNode = new SceneDescription::Node;
+        modelNode->name = name;
+        modelNode->scene = description;
+        modelNode->SetParent(description->rootNode);
+    }
+
+    var meshCount = reader->ReadInt32();
+
+    for (int i = 0; i < meshCount; ++i)
+    {
+        var tmshSig = reader->ReadString(4);
+        if (tmshSig == "TMSH")
+        {
+            var name = reader->ReadString();
+
+            var vtxCount = reader->ReadInt32();
+            var vertices = new Vertex[vtxCount];
+
+            reader->Skip(4);
+
+            for (int i = 0; i < vtxCount; ++i)
+            {
+                glm::vec3 p = math::convertVec3(reader->ReadFloatArray(3)) * scale;
+                glm::vec3 n = math::convertVec3(reader->ReadFloatArray(3));
+                glm::vec2 u = math::convertVec2(reader->ReadFloatArray(2));
+
+                var boneIdxCount = reader->ReadInt32();
+                var boneIds = reader->ReadArray<s32>(boneIdxCount);
+
+                var weightCount = reader->ReadInt32();
+                var weights = reader->ReadArray<float>(weightCount);
+
+                Vertex vtx = {p, n, u, math::convertIVec4(boneIds, boneIdxCount),
+                              math::convertVec4(weights, weightCount)};
+                vertices[i] = vtx;
+            }
+
+            reader->Skip(4);
+            var idxCount = reader->ReadInt32();
+            var incs = new u16[idxCount];
+
+            for (int i = 0; i < idxCount; ++i)
+            {
+                incs[i] = reader->ReadUInt16();
+            }
+
+            if (vtxCount == 2162)
+            {
+                var vert = vertices[116];
+                std::cout << vert.position.x << std::endl;
+            }
+
+            var materialIndex = reader->ReadInt32();
+
+            meshes.push_back(createMesh(vertices, incs, vtxCount, idxCount, Vertex::getVertexLayout(), this));
+            materialIndices.push_back((materialIndex));
+        }
+    }
+
+    var textureCount = reader->ReadInt32();
+
+    for (int i = 0; i < textureCount; ++i)
+    {
+        long p = reader->tellg();
+        var texSig = reader->ReadString(4);
+        if (texSig == "TTEX")
+        {
+
+            var name = reader->ReadString();
+
+            var width = reader->ReadInt32();
+            var height = reader->ReadInt32();
+            var channelCount = reader->ReadInt32();
+
+            var size = width * height * channelCount;
+            std::vector<unsigned char> dataV;
+            for (int x = 0; x < width; ++x)
+            {
+                for (int y = 0; y < height; ++y)
+                {
+                    for (int j = 0; j < channelCount; ++j)
+                    {
+                        dataV.push_back(reader->ReadByte());
+                    }
+                }
+            }
+
+            var format = tmgl::TextureFormat::RGBA8;
+
+            switch (channelCount)
+            {
+                case 1:
+                    format = tmgl::TextureFormat::R8;
+                    break;
+                case 2:
+                    format = tmgl::TextureFormat::RG8;
+                    break;
+                case 3:
+                    format = tmgl::TextureFormat::RGB8;
+                    break;
+                default:
+                    break;
+            }
+
+            var tex = new Texture(width, height, format, TMGL_SAMPLER_UVW_CLAMP, tmgl::copy(dataV.data(), size), name);
+
+
+            textures.push_back(tex);
+        }
+    }
+
+
+    var materialCount = reader->ReadInt32();
+    for (int i = 0; i < materialCount; ++i)
+    {
+        reader->Skip(4);
+        var materialDescription = new MaterialDescription();
+        var name = reader->ReadString();
+
+        materialDescription->Name = name;
+
+        var texCount = reader->ReadInt32();
+        for (int i = 0; i < texCount; ++i)
+        {
+            var uniform = reader->ReadString();
+            var texture = reader->ReadString();
+
+            materialDescription->Textures.insert(std::make_pair(uniform, texture));
+        }
+        materials.push_back(materialDescription);
+    }
+
+    skeleton = new Skeleton(reader);
+
+    var animCount = reader->ReadInt32();
+
+    int preAnim = reader->tellg();
+    int postAnim = -1;
+
+    int animSize = -1;
+
+    for (int i = 0; i < animCount; ++i)
+    {
+        if (animSize == -1)
+            animations.push_back(new Animation(reader));
+
+        if (i == 0 && postAnim == -1)
+        {
+            postAnim = reader->tellg();
+            //animSize = postAnim - preAnim;
+        }
+
+        if (animSize != -1)
+        {
+            reader->Skip(animSize);
+        }
+    }
+}
+
+Animation::Animation(fs::BinaryReader* reader)
+{
+    var sig = reader->ReadString(4);
+
+    name = reader->ReadString();
+    duration = reader->ReadSingle();
+    ticksPerSecond = reader->ReadInt32();
+
+    var channelCount = reader->ReadInt32();
+    nodeChannels.reserve(channelCount);
+
+    for (int i = 0; i < channelCount; ++i)
+    {
+        NodeChannel nodeChannel;
+
+        nodeChannel.name = reader->ReadString();
+        nodeChannel.id = reader->ReadInt32();
+
+        var pct = reader->ReadInt32();
+        nodeChannel.positions = {static_cast<u32>(positionTimes.size()), static_cast<u32>(pct)};
+        for (int j = 0; j < pct; ++j)
+        {
+            positionTimes.push_back(reader->ReadSingle());
+            positionValues.push_back(reader->ReadVec3());
+        }
+
+        var rct = reader->ReadInt32();
+        nodeChannel.rotations = {static_cast<u32>(rotationTimes.size()), static_cast<u32>(rct)};
+        for (int j = 0; j < rct; ++j)
+        {
+            rotationTimes.push_back(reader->ReadSingle());
+            rotationValues.push_back(reader->ReadQuat());
+        }
+
+        var sct = reader->ReadInt32();
+        nodeChannel.scales = {static_cast<u32>(scaleTimes.size()), static_cast<u32>(sct)};
+        for (int j = 0; j < sct; ++j)
+        {
+            scaleTimes.push_back(reader->ReadSingle());
+            scaleValues.push_back(reader->ReadVec3());
+        }
+
+        nodeChannels.push_back(nodeChannel);
+    }
+}
+
+Animation::~Animation()
+{
+}
+
+u32 Animation::SeekKey(const std::vector<float>& times, KeyRange range, float time, u32 cursor)
+{
+    if (range.count < 2)
+        return 0;
+
+    const float* keys = times.data() + range.first;
+    u32 last = range.count - 2;
+
+    if (cursor > last)
+        cursor = last;
+
+    if (time >= keys[cursor])
+    {
+        // Next segment or the one after, anything further is a seek
+        for (u32 step = 0; step < 2 && cursor <= last; ++step, ++cursor)
+        {
+            if (time <= keys[cursor + 1])
+                return cursor;
+        }
+
+        if (time >= keys[last + 1])
+            return last;
+    }
+    else if (time <= keys[0])
+    {
+        return 0;
+    }
+
+    // First key after time ends the segment
+    var next = std::upper_bound(keys + 1, keys + range.count, time);
+    return std::min(static_cast<u32>(next - keys) - 1, last);
+}
+
+// Quaternion components are at most 1/sqrt(2) once the largest one is dropped
+static constexpr float QUAT_PACK_RANGE = 0.70710678f;
+
+static void packQuat(glm::quat q, u16* out)
+{
+    float c[4] = {q.x, q.y, q.z, q.w};
+
+    int largest = 0;
+    for (int i = 1; i < 4; ++i)
+    {
+        if (std::abs(c[i]) > std::abs(c[largest]))
+            largest = i;
+    }
+
+    // q and -q are the same rotation, flip so the dropped component is positive
+    float sign = c[largest] < 0 ? -1.0f : 1.0f;
+
+    u16 packed[3];
+    for (int i = 0, k = 0; i < 4; ++i)
+    {
+        if (i == largest)
+            continue;
+
+        float unit = glm::clamp(c[i] * sign / QUAT_PACK_RANGE * 0.5f + 0.5f, 0.0f, 1.0f);
+        packed[k++] = static_cast<u16>(std::lround(unit * 32767.0f));
+    }
+
+    out[0] = packed[0] | (largest & 1) << 15;
+    out[1] = packed[1] | (largest >> 1) << 15;
+    out[2] = packed[2];
+}
+
+static glm::quat unpackQuat(const u16* in)
+{
+    int largest = in[0] >> 15 | (in[1] >> 15) << 1;
+
+    float v[3];
+    for (int k = 0; k < 3; ++k)
+    {
+        v[k] = ((in[k] & 0x7FFF) * (2.0f / 32767.0f) - 1.0f) * QUAT_PACK_RANGE;
+    }
+
+    float w = std::sqrt(std::max(0.0f, 1.0f - v[0] * v[0] - v[1] * v[1] - v[2] * v[2]));
+
+    // Where x, y, z and w come from in {v0, v1, v2, rebuilt}, a table lookup keeps the decode branch-free
+    static constexpr u8 order[4][4] = {{3, 0, 1, 2}, {0, 3, 1, 2}, {0, 1, 3, 2}, {0, 1, 2, 3}};
+
+    float c[4] = {v[0], v[1], v[2], w};
+    const u8* o = order[largest];
+
+    return {c[o[3]], c[o[0]], c[o[1]], c[o[2]]};
+}
+
+static glm::vec3 unpackVec3(const u16* in, glm::vec3 min, glm::vec3 step)
+{
+    return min + glm::vec3{in[0], in[1], in[2]} * step;
+}
+
+glm::vec3 Animation::GetPosition(const NodeChannel& channel, u32 key) const
+{
+    key += channel.positions.first;
+
+    if (compressed)
+        return unpackVec3(&packedPositions[key * 3], channel.positionMin, channel.positionStep);
+
+    return positionValues[key];
+}
+
+glm::quat Animation::GetRotation(const NodeChannel& channel, u32 key) const
+{
+    key += channel.rotations.first;
+
+    if (compressed)
+        return unpackQuat(&packedRotations[key * 3]);
+
+    return rotationValues[key];
+}
+
+glm::vec3 Animation::GetScale(const NodeChannel& channel, u32 key) const
+{
+    key += channel.scales.first;
+
+    if (compressed)
+        return unpackVec3(&packedScales[key * 3], channel.scaleMin, channel.scaleStep);
+
+    return scaleValues[key];
+}
+
+// Longest run of keys one segment may replace. Each extension re-checks the keys since the anchor, so this
+// keeps long mocap tracks linear at the cost of a key every few seconds on very smooth curves
+static constexpr u32 MAX_REDUCED_SPAN = 64;
+
+// Keys of a track that have to stay so interpolating between them rebuilds every dropped key within maxError.
+// A track whose keys all sit within maxError of the first keeps only that one. stored is each value the way
+// playback reads it back after quantization, so the bound covers the quantization error too.
+template <typename T, typename Lerp, typename Error>
+static std::vector<u32> reduceKeys(const float* times, const T* values, const T* stored, u32 count, float maxError,
+                                   Lerp lerp, Error error)
+{
+    std::vector<u32> kept = {0};
+
+    bool constant = true;
+    for (u32 i = 1; i < count && constant; ++i)
+    {
+        constant = error(stored[0], values[i]) <= maxError;
+    }
+
+    if (constant)
+        return kept;
+
+    u32 anchor = 0;
+    for (u32 end = anchor + 2; end < count; ++end)
+    {
+        bool fits = end - anchor <= MAX_REDUCED_SPAN;
+        for (u32 i = anchor + 1; i < end && fits; ++i)
+        {
+            float span = times[end] - times[anchor];
+            float t = span > 0 ? (times[i] - times[anchor]) / span : 0.0f;
+
+            fits = error(lerp(stored[anchor], stored[end], t), values[i]) <= maxError;
+        }
+
+        if (!fits)
+        {
+            anchor = end - 1;
+            kept.push_back(anchor);
+        }
+    }
+
+    kept.push_back(count - 1);
+
+    return kept;
+}
+
+static void packVec3(glm::vec3 value, glm::vec3 min, glm::vec3 step, u16* out)
+{
+    for (int c = 0; c < 3; ++c)
+    {
+        float packed = step[c] > 0 ? (value[c] - min[c]) / step[c] : 0.0f;
+        out[c] = static_cast<u16>(std::lround(glm::clamp(packed, 0.0f, 65535.0f)));
+    }
+}
+
+// Reduces a track and writes the kept keys quantized to 16 bits over the whole track's range
+template <typename Error>
+static std::vector<u32> compressVec3Track(const float* times, const glm::vec3* values, u32 count, float maxError,
+                                          Error error, std::vector<u16>& out, glm::vec3& min, glm::vec3& step)
+{
+    min = glm::vec3{std::numeric_limits<float>::max()};
+    glm::vec3 max{-std::numeric_limits<float>::max()};
+
+    for (u32 i = 0; i < count; ++i)
+    {
+        min = glm::min(min, values[i]);
+        max = glm::max(max, values[i]);
+    }
+
+    step = (max - min) / 65535.0f;
+
+    std::vector<glm::vec3> stored(count);
+    for (u32 i = 0; i < count; ++i)
+    {
+        u16 packed[3];
+        packVec3(values[i], min, step, packed);
+        stored[i] = unpackVec3(packed, min, step);
+    }
+
+    var kept = reduceKeys(times, values, stored.data(), count, maxError,
+                          [](glm::vec3 a, glm::vec3 b, float t) { return mix(a, b, t); }, error);
+
+    for (u32 key : kept)
+    {
+        u16 packed[3];
+        packVec3(values[key], min, step, packed);
+        out.insert(out.end(), packed, packed + 3);
+    }
+
+    return kept;
+}
+
+void Animation::Compress(const CompressionSettings& settings)
+{
+    if (compressed)
+        return;
+
+    var slerpQuat = [](glm::quat a, glm::quat b, float t) { return normalize(glm::slerp(a, b, t)); };
+
+    var positionError = [](glm::vec3 a, glm::vec3 b) { return length(a - b); };
+    // A point boneLength away moves by the chord of the angle between the two rotations, 2 sin(half angle).
+    // Taken from the quaternions' distance, 1 - dot^2 cancels to nothing in float well above maxError
+    var rotationError = [&settings](glm::quat a, glm::quat b)
+    {
+        a = normalize(a);
+        b = normalize(b);
+        if (dot(a, b) < 0)
+            b = -b;
+
+        float chord = std::min(length(glm::vec4(a.x - b.x, a.y - b.y, a.z - b.z, a.w - b.w)), std::sqrt(2.0f));
+        return 2.0f * settings.boneLength * chord * std::sqrt(1.0f - chord * chord * 0.25f);
+    };
+    var scaleError = [&settings](glm::vec3 a, glm::vec3 b) { return settings.boneLength * length(a - b); };
+
+    std::vector<float> newPositionTimes, newRotationTimes, newScaleTimes;
+
+    for (auto& channel : nodeChannels)
+    {
+        {
+            const float* times = positionTimes.data() + channel.positions.first;
+            const glm::vec3* values = positionValues.data() + channel.positions.first;
+
+            var kept = channel.positions.count > 0
+                           ? compressVec3Track(times, values, channel.positions.count, settings.maxError,
+                                               positionError, packedPositions, channel.positionMin,
+                                               channel.positionStep)
+                           : std::vector<u32>{};
+
+            channel.positions = {static_cast<u32>(newPositionTimes.size()), static_cast<u32>(kept.size())};
+            for (u32 key : kept)
+            {
+                newPositionTimes.push_back(times[key]);
+            }
+        }
+
+        {
+            const float* times = rotationTimes.data() + channel.rotations.first;
+            const glm::quat* values = rotationValues.data() + channel.rotations.first;
+
+            std::vector<glm::quat> stored(channel.rotations.count);
+            for (u32 i = 0; i < stored.size(); ++i)
+            {
+                u16 packed[3];
+                packQuat(normalize(values[i]), packed);
+                stored[i] = unpackQuat(packed);
+            }
+
+            var kept = channel.rotations.count > 0
+                           ? reduceKeys(times, values, stored.data(), channel.rotations.count, settings.maxError,
+                                        slerpQuat, rotationError)
+                           : std::vector<u32>{};
+
+            channel.rotations = {static_cast<u32>(newRotationTimes.size()), static_cast<u32>(kept.size())};
+            for (u32 key : kept)
+            {
+                newRotationTimes.push_back(times[key]);
+
+                u16 packed[3];
+                packQuat(normalize(values[key]), packed);
+                packedRotations.insert(packedRotations.end(), packed, packed + 3);
+            }
+        }
+
+        {
+            const float* times = scaleTimes.data() + channel.scales.first;
+            const glm::vec3* values = scaleValues.data() + channel.scales.first;
+
+            var kept = channel.scales.count > 0
+                           ? compressVec3Track(times, values, channel.scales.count, settings.maxError, scaleError,
+                                               packedScales, channel.scaleMin, channel.scaleStep)
+                           : std::vector<u32>{};
+
+            channel.scales = {static_cast<u32>(newScaleTimes.size()), static_cast<u32>(kept.size())};
+            for (u32 key : kept)
+            {
+                newScaleTimes.push_back(times[key]);
+            }
+        }
+    }
+
+    positionTimes = std::move(newPositionTimes);
+    rotationTimes = std::move(newRotationTimes);
+    scaleTimes = std::move(newScaleTimes);
+
+    positionValues = {};
+    rotationValues = {};
+    scaleValues = {};
+
+    compressed = true;
+}
+
+std::vector<Animation*> Animation::LoadAnimations(string path, const CompressionSettings* compression)
+{
+    std::vector<Animation*> anims;
+
+    Assimp::Importer import;
+    const aiScene* scene = import.ReadFile(path, aiProcess_Triangulate);
+
+    if (!scene || !scene->mRootNode)
+    {
+        std::cout << "ERROR::ASSIMP::" << import.GetErrorString() << std::endl;
+        return anims;
+    }
+
+    if (scene->HasAnimations())
+    {
+        for (int i = 0; i < scene->mNumAnimations; ++i)
+        {
+            var a = scene->mAnimations[i];
+
+            var animation = new Animation();
+
+            animation->LoadFromAiAnimation(a);
+
+            if (compression)
+                animation->Compress(*compression);
+
+            anims.push_back(animation);
+        }
+    }
+
+    return anims;
+}
+
+
+void Animation::LoadFromAiAnimation(aiAnimation* anim)
+{
+    name = anim->mName.C_Str();
+    duration = static_cast<float>(anim->mDuration);
+    ticksPerSecond = static_cast<int>(anim->mTicksPerSecond);
+
+    nodeChannels.reserve(anim->mNumChannels);
+
+    for (int i = 0; i < anim->mNumChannels; ++i)
+    {
+        var channel = anim->mChannels[i];
+
+        NodeChannel nodeChannel;
+        nodeChannel.name = channel->mNodeName.C_Str();
+
+        nodeChannel.positions = {static_cast<u32>(positionTimes.size()), channel->mNumPositionKeys};
+        for (int i = 0; i < channel->mNumPositionKeys; ++i)
+        {
+            var posKey = channel->mPositionKeys[i];
+            positionTimes.push_back(static_cast<float>(posKey.mTime));
+            positionValues.push_back(math::convertVec3(posKey.mValue));
+        }
+
+        nodeChannel.scales = {static_cast<u32>(scaleTimes.size()), channel->mNumScalingKeys};
+        for (int i = 0; i < channel->mNumScalingKeys; ++i)
+        {
+            var posKey = channel->mScalingKeys[i];
+            scaleTimes.push_back(static_cast<float>(posKey.mTime));
+            scaleValues.push_back(math::convertVec3(posKey.mValue));
+        }
+
+        nodeChannel.rotations = {static_cast<u32>(rotationTimes.size()), channel->mNumRotationKeys};
+        for (int i = 0; i < channel->mNumRotationKeys; ++i)
+        {
+            var posKey = channel->mRotationKeys[i];
+            rotationTimes.push_back(static_cast<float>(posKey.mTime));
+            rotationValues.push_back(math::convertQuat(posKey.mValue));
+        }
+
+        nodeChannels.push_back(nodeChannel);
+    }
+}
+
+Skeleton::Skeleton(fs::BinaryReader* reader)
+{
+    reader->Skip(4);
+    var boneCount = reader->ReadInt32();
+
+    for (int i = 0; i < boneCount; ++i)
+    {
+        var name = reader->ReadString();
+        var id = reader->ReadInt32();
+
+        var pos = reader->ReadVec3();
+        var rot = reader->ReadQuat();
+        var scl = reader->ReadVec3();
+
+        var bone = new Bone();
+        bone->name = name;
+        bone->position = pos;
+
+        //bone->position.x = pos.z;
+        //bone->position.z = pos.x;
+
+        bone->rotation = rot;
+        bone->scale = scl;
+        bone->skeleton = this;
+
+        glm::mat4 offsetMatrix;
+
+        for (int x = 0; x < 4; ++x)
+        {
+            for (int y = 0; y < 4; ++y)
+            {
+                offsetMatrix[y][x] = reader->ReadSingle();
+            }
+        }
+
+        int childCount = reader->ReadInt32();
+        for (int i = 0; i < childCount; ++i)
+        {
+            var cname = reader->ReadString();
+            bone->children.push_back(cname);
+        }
+
+        bones.push_back(bone);
+        boneInfoMap[name] = {id, offsetMatrix};
+    }
+
+    rootName = reader->ReadString();
+
+    Compile();
+
+    // Parents are compiled before their children, so one pass builds every world transform
+    std::vector<glm::mat4> world(joints.size());
+    for (size_t i = 0; i < joints.size(); ++i)
+    {
+        world[i] = joints[i]->GetTransformation();
+        if (parents[i] >= 0)
+            world[i] *= world[parents[i]];
+
+        offsets[i] = glm::inverse(world[i]);
+        boneInfoMap[joints[i]->name].offset = offsets[i];
+    }
+}
+
+tmt::obj::Object* Model::CreateObject(Shader* shdr)
+{
+
+    var shader = shdr;
+
+    if (shader == nullptr)
+    {
+        shader = defaultShader;
+    }
+
+    var mdlObj = new obj::Object();
+
+    std::vector<Material*> mats;
+    mdlObj->name = name;
+
+    for (auto materialDesc : this->materials)
+    {
+        mats.push_back(CreateMaterial(materialDesc, shader));
+    }
+
+
+    var midx = 0;
+    for (auto value : meshes)
+    {
+        var mshObj = obj::MeshObject::FromBasicMesh(value);
+        mshObj->material = mats[materialIndices[midx]];
+        mshObj->SetParent(mdlObj);
+
+        midx++;
+    }
+
+    var sklObj = new SkeletonObject(skeleton);
+    sklObj->SetParent(mdlObj);
+
+    var animator = new Animator();
+    animator->SetParent(mdlObj);
+
+    sklObj->animator = animator;
+
+    return mdlObj;
+}
+
+Texture::Texture(aiTexel* texels, int width, u64 flags)
+{
+
+    var caps = tmgl::getCaps();
+    //stbi_set_flip_vertically_on_load(true);
+
+
+    //bool f = true;
+
+    int channels;
+    u8* data = stbi_load_from_memory((unsigned char*)texels, width, &this->width, &this->height, &channels, 4);
+
+    bool f = this->width < caps->limits.maxTextureSize && this->height < caps->limits.maxTextureSize;
+
+
+    if (f)
+    {
+
+
+        tmgl::TextureFormat::Enum textureFormat = tmgl::TextureFormat::RGBA8;
+        uint64_t textureFlags = flags; // Adjust as needed
+
+        // Create the texture in bgfx, passing the image data directly
+        handle = createTexture2D(static_cast<u16>(this->width), static_cast<u16>(this->height), false, 1, textureFormat,
+                                 textureFlags, tmgl::copy(data, this->width * this->height * channels));
+        format = textureFormat;
+    }
+    else
+    {
+        handle.idx = -1;
+    }
+
+    stbi_image_free(data);
+}
+
+// Decodes any stb supported image to RGBA8, empty when the file can't be read
+static std::vector<u8> decodeRgba(const string& path, int& width, int& height)
+{
+    int nrChannels;
+    u8* data = stbi_load(path.c_str(), &width, &height, &nrChannels, 0);
+
+    if (!data)
+        return {};
+
+    std::vector<u8> rgbaData(width * height * 4);
+
+    for (int i = 0; i < width * height; ++i)
+    {
+        const u8* texel = data + i * nrChannels;
+        u8* out = rgbaData.data() + i * 4;
+
+        switch (nrChannels)
+        {
+            case 4:
+                std::memcpy(out, texel, 4);
+                break;
+            case 3:
+                std::memcpy(out, texel, 3);
+                out[3] = 255;
+                break;
+            case 2:
+                out[0] = texel[0];
+                out[1] = texel[1];
+                out[2] = 0;
+                out[3] = texel[1];
+                break;
+            default:
+                out[0] = out[1] = out[2] = texel[0];
+                out[3] = 255;
+                break;
+        }
+    }
+
+    stbi_image_free(data);
+
+    return rgbaData;
+}
+
+Texture::Texture(string path, u64 flags)
+{
+    var rgbaData = decodeRgba(path, width, height);
+
+    tmgl::TextureFormat::Enum textureFormat = tmgl::TextureFormat::RGBA8;
+
+    // Create the texture in bgfx, passing the image data directly
+    handle = createTexture2D(static_cast<u16>(width), static_cast<u16>(height), false, 1, textureFormat, flags,
+                             tmgl::copy(rgbaData.data(), rgbaData.size()));
+    format = textureFormat;
+
+    var fpath = std::filesystem::path(path);
+    name = fpath.stem().string();
+
+    fs::ResourceManager::pInstance->loaded_textures.insert(std::make_pair(name, this));
+
+    // The handle is swapped inside this object, so materials pointing at it pick up the new image
+    ResMgr->Watch(path, this, [this, path, flags]() -> std::function<void()>
+    {
+        int newWidth, newHeight;
+        var pixels = decodeRgba(path, newWidth, newHeight);
+        if (pixels.empty())
+            return {};
+
+        return [this, flags, newWidth, newHeight, pixels = std::move(pixels)]()
+        {
+            destroy(handle);
+
+            width = newWidth;
+            height = newHeight;
+            handle = createTexture2D(static_cast<u16>(width), static_cast<u16>(height), false, 1, format, flags,
+                                     tmgl::copy(pixels.data(), pixels.size()));
+        };
+    });
+}
+
+Texture::Texture()
+{
+}
+
+TextureAtlas* TextureAtlas::CreateTexture(string dirPath) { return new TextureAtlas(dirPath); }
+
+TextureAtlas* TextureAtlas::CreateTexture(std::vector<string> paths) { return new TextureAtlas(paths); }
+
+TextureAtlas::~TextureAtlas()
+{
+}
+
+TextureAtlas::TextureAtlas(string dirPath) :
+    Texture()
+{
+
+    std::vector<u8> pixels;
+    u16 imageCount = 0;
+
+    for (const auto& entry : std::filesystem::directory_iterator(dirPath))
+    {
+        if (entry.is_regular_file())
+        {
+            string path = entry.path().generic_string();
+
+            int nrChannels;
+            u8* data = stbi_load(path.c_str(), &width, &height, &nrChannels, 0);
+
+            var dataSize = width * height * nrChannels;
+            auto rgbaData = new unsigned char[dataSize];
+
+            if (nrChannels == 3)
+            {
+                delete[] rgbaData;
+                dataSize = width * height * 4;
+                rgbaData = new unsigned char[dataSize];
+                for (int i = 0; i < width * height; ++i)
+                {
+                    rgbaData[i * 4 + 0] = data[i * nrChannels + 0];
+                    rgbaData[i * 4 + 1] = data[i * nrChannels + 1];
+                    rgbaData[i * 4 + 2] = data[i * nrChannels + 2];
+                    rgbaData[i * 4 + 3] = 1.0f; // Add alpha channel with value 1.0
+                }
+                nrChannels = 4;
+            }
+            else if (nrChannels == 4)
+            {
+                rgbaData = data;
+            }
+
+            for (int i = 0; i < dataSize; ++i)
+            {
+                pixels.push_back(rgbaData[i]);
+            }
+
+            imageCount++;
+        }
+    }
+
+    tmgl::TextureFormat::Enum textureFormat = tmgl::TextureFormat::RGBA8;
+    uint64_t textureFlags = TMGL_SAMPLER_U_MIRROR | TMGL_SAMPLER_V_MIRROR | TMGL_SAMPLER_POINT; // Adjust as needed
+
+    // Create the texture in bgfx, passing the image data directly
+    handle = createTexture2D(static_cast<u16>(width), static_cast<u16>(height), false, imageCount, textureFormat,
+                             textureFlags,
+                             tmgl::copy(pixels.data(),
+                                        (static_cast<u32>(pixels.size()) * static_cast<u32>(sizeof(u8)))));
+    format = textureFormat;
+    setName(handle, "atlas");
+}
+
+TextureAtlas::TextureAtlas(std::vector<string> paths)
+{
+    std::vector<u8> pixels;
+    u16 imageCount = 0;
+
+    for (auto path : paths)
+    {
+        int nrChannels;
+        stbi_set_flip_vertically_on_load(true);
+        u8* data = stbi_load(path.c_str(), &width, &height, &nrChannels, 0);
+
+        var dataSize = width * height * nrChannels;
+        auto rgbaData = new unsigned char[dataSize];
+
+        if (nrChannels == 3)
+        {
+            delete[] rgbaData;
+            dataSize = width * height * 4;
+            rgbaData = new unsigned char[dataSize];
+            for (int i = 0; i < width * height; ++i)
+            {
+                rgbaData[i * 4 + 0] = data[i * nrChannels + 0];
+                rgbaData[i * 4 + 1] = data[i * nrChannels + 1];
+                rgbaData[i * 4 + 2] = data[i * nrChannels + 2];
+                rgbaData[i * 4 + 3] = 1.0f; // Add alpha channel with value 1.0
+            }
+            nrChannels = 4;
+        }
+        else if (nrChannels == 4)
+        {
+            rgbaData = data;
+        }
+
+        for (int i = 0; i < dataSize; ++i)
+        {
+            pixels.push_back(rgbaData[i]);
+        }
+
+        imageCount++;
+    }
+
+    tmgl::TextureFormat::Enum textureFormat = tmgl::TextureFormat::RGBA8;
+    uint64_t textureFlags = TMGL_SAMPLER_U_MIRROR | TMGL_SAMPLER_V_MIRROR | TMGL_SAMPLER_POINT; // Adjust as needed
+
+    // Create the texture in bgfx, passing the image data directly
+    handle = createTexture2D(
+        static_cast<u16>(width), static_cast<u16>(height), false, imageCount, textureFormat, textureFlags,
+        tmgl::copy(pixels.data(), (static_cast<u32>(pixels.size()) * static_cast<u32>(sizeof(u8)))));
+    format = textureFormat;
+    setName(handle, "atlas");
+}
+
+Texture* Texture::CreateTexture(string path, u64 flags)
+{
+    if (IN_MAP(ResMgr->loaded_textures, path))
+    {
+        return ResMgr->loaded_textures[path];
+    }
+
+    if (!std::filesystem::exists(path))
+        return nullptr;
+
+    return new Texture(path, flags);
+}
+
+Texture::Texture(int width, int height, tmgl::TextureFormat::Enum tf, u64 flags, const tmgl::Memory* mem, string name)
+{
+    handle = createTexture2D(width, height, false, 1, tf, flags, mem);
+
+    setName(handle, name.c_str());
+
+    format = tf;
+    this->width = width;
+    this->height = height;
+    this->name = name;
+
+    ResMgr->loaded_textures[name] = this;
+}
+
+Texture::Texture(tmgl::TextureHandle handle)
+{
+    this->handle = handle;
+
+}
+
+Texture::~Texture()
+{
+    ResMgr->Unwatch(this);
+
+    std::erase_if(ResMgr->loaded_embedded_textures, [this](const auto& texture) { return texture.second == this; });
+
+    destroy(handle);
+}
+
+RenderTexture::RenderTexture(u16 width, u16 height, tmgl::TextureFormat::Enum format, u16 cf)
+{
+    const tmgl::Memory* mem = nullptr;
+    if (format == tmgl::TextureFormat::RGBA8)
+    {
+        // std::vector<GLubyte> pixels(width * height * 4, (GLubyte)0xffffffff);
+        // mem = tmgl::copy(pixels.data(), width * height* 4);
+    }
+
+    u64 textureFlags = TMGL_TEXTURE_RT_WRITE_ONLY;
+
+    bgfx::TextureFormat::Enum depthFormat = isTextureValid(0, false, 1, bgfx::TextureFormat::D16, textureFlags)
+        ? bgfx::TextureFormat::D16
+        : isTextureValid(0, false, 1, bgfx::TextureFormat::D24S8, textureFlags)
+        ? bgfx::TextureFormat::D24S8
+        : bgfx::TextureFormat::D32;
+
+    realTexture = new Texture(width, height, format,
+                              textureFlags
+                              , mem);
+
+
+    handle = createFrameBuffer(1, &realTexture->handle, true);
+    this->format = format;
+
+    //tmgl::setViewName(vid, "RenderTexture");
+    //tmgl::setViewClear(vid, cf);
+    //tmgl::setViewRect(vid, 0, 0, width, height);
+    //setViewFrameBuffer(vid, handle);
+
+    viewId = renderer->viewCache.size();
+    setViewFrameBuffer(viewId, handle);
+
+    renderer->viewCache.push_back(this);
+}
+
+RenderTexture::RenderTexture()
+{
+    viewId = renderer->viewCache.size();
+    if (viewId == 0)
+    {
+        tmgl::setViewFrameBuffer(0, BGFX_INVALID_HANDLE);
+    }
+    else
+    {
+
+        var width = renderer->windowWidth;
+        var height = renderer->windowHeight;
+
+
+        depthFormat = tmgl::TextureFormat::D24S8;
+        format = tmgl::TextureFormat::RGBA8;
+
+        resize(width, height);
+    }
+    tmgl::setViewClear(viewId, TMGL_CLEAR_COLOR | TMGL_CLEAR_DEPTH, Color(0.2f, 0.3f, 0.3f, 1).getHex(), 1.0f, 0);
+
+    if (!name.empty())
+    {
+        tmgl::setViewName(viewId, name.c_str());
+    }
+
+
+    renderer->viewCache.push_back(this);
+}
+
+
+RenderTexture::~RenderTexture()
+{
+    bgfx::resetView(viewId);
+    renderer->viewCache.erase(VEC_FIND(renderer->viewCache, this));
+}
+
+void RenderTexture::resize(int width, int height)
+{
+    if (realTexture)
+        delete realTexture;
+    if (depthTexture)
+        delete depthTexture;
+    if (isValid(handle))
+    {
+        destroy(handle);
+    }
+
+    u64 textureFlags = TMGL_TEXTURE_RT;
+
+
+    realTexture = new Texture(width, height, format, textureFlags);
+    depthTexture = new Texture(width, height, depthFormat, textureFlags);
+
+    tmgl::TextureHandle handles[] = {realTexture->handle, depthTexture->handle};
+
+    handle = createFrameBuffer(2, handles, true);
+
+    setViewFrameBuffer(viewId, handle);
+}
+
+CubemapTexture::CubemapTexture(string path, int cubemapSize)
+{
+    int width, height, nrChannels;
+    float* data = stbi_loadf(path.c_str(), &width, &height, &nrChannels, 0);
+
+    if (!data)
+    {
+        std::cerr << "Cubemap texture failed to load at path: " << path << std::endl;
+        return;
+    }
+
+    var dataSize = width * height * nrChannels;
+
+    auto rgbaData = new float[dataSize];
+
+    if (nrChannels == 3)
+    {
+        delete[] rgbaData;
+        dataSize = width * height * 4;
+        rgbaData = new float[dataSize];
+        for (int i = 0; i < width * height; ++i)
+        {
+            rgbaData[i * 4 + 0] = data[i * nrChannels + 0];
+            rgbaData[i * 4 + 1] = data[i * nrChannels + 1];
+            rgbaData[i * 4 + 2] = data[i * nrChannels + 2];
+            rgbaData[i * 4 + 3] = 1.0; // Add alpha channel with value 1.0
+        }
+        nrChannels = 4;
+    }
+    dataSize = width * height * nrChannels * sizeof(float);
+
+    tmgl::TextureFormat::Enum textureFormat = tmgl::TextureFormat::RGBA32F; // Use floating point format for HDR
+    u16 textureFlags = 0;
+
+    var hdrHandle = createTexture2D(static_cast<u16>(width), static_cast<u16>(height), false, 1, textureFormat,
+                                    textureFlags, tmgl::copy(rgbaData, dataSize));
+
+    var hdrTexture = new Texture(hdrHandle);
+
+
+    var format = tmgl::TextureFormat::RGBA8;
+
+    tmgl::TextureHandle cubemapHandle = createTextureCube(cubemapSize, false, 1, format, TMGL_TEXTURE_RT);
+
+
+    std::vector<tmgl::FrameBufferHandle> fbos;
+
+    for (int i = 0; i < 6; ++i)
+    {
+        var attachment = tmgl::Attachment{};
+        attachment.init(cubemapHandle, tmgl::Access::Write, i);
+        fbos.push_back(createFrameBuffer(1, &attachment, true));
+    }
+
+    glm::mat4 captureProjection = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 10.0f);
+    glm::mat4 captureViews[] = {
+        lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)),
+        lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)),
+        lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f)),
+        lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f)),
+        lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, -1.0f, 0.0f)),
+        lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f))};
+
+    var shader = Shader::CreateShader("test/equi_vert", "test/equi_frag");
+
+    var material = new Material(shader);
+    material->GetUniform("equiMap")->tex = hdrTexture;
+    tmgl::setViewClear(1, TMGL_CLEAR_COLOR | TMGL_CLEAR_DEPTH, Color(0.2f, 0.3f, 0.3f, 1).getHex(), 1.0f, 0);
+
+    int off = 16;
+    for (int i = 0; i < 6; ++i)
+    {
+        setViewFrameBuffer(i + off, fbos[i]);
+        tmgl::setViewRect(i + off, 0, 0, cubemapSize, cubemapSize);
+        tmgl::setViewTransform(i + off, value_ptr(captureViews[i]), value_ptr(captureProjection));
+
+        var cube = GetPrimitive(prim::Cube);
+
+        tmgl::setState(material->GetMaterialState());
+
+        cube->use();
+
+        shader->Push(i + off, material->overrides.data(), material->overrides.size());
+
+    }
+
+    for (auto fbo : fbos)
+    {
+        destroy(fbo);
+    }
+
+    realTexture = new Texture(cubemapHandle);
+    panoramaTexture = hdrTexture;
+}
+
+Font* Font::Create(string path)
+{
+    if (IN_MAP(ResMgr->loaded_fonts, path))
+    {
+        return ResMgr->loaded_fonts[path];
+    }
+
+    return new Font(path);
+}
+
+float Font::CalculateTextSize(string text, float fontSize, float forcedSpacing)
+{
+    float size = 0;
+
+    if (forcedSpacing == FLT_MAX)
+        forcedSpacing = spacing;
+
+    var scl = 1.0f;
+
+    scl = (fontSize / 48);
+
+    for (char value : text)
+    {
+
+        var c = characters[value];
+
+        float xPos = size - c.bearing.x * scl;
+
+        size -= (c.advance >> 6) * scl;
+    }
+
+    size = -size;
+
+    return size;
+}
+
+
+Font::Font(string path)
+{
+
+
+    FT_Library ft;
+    if (FT_Init_FreeType(&ft))
+    {
+        std::cout << "Could not init FreeType Library" << std::endl;
+        return;
+    }
+
+    FT_Face face;
+    if (FT_New_Face(ft, path.c_str(), 0, &face))
+    {
+        std::cout << "Failed to load font" << std::endl;
+        return;
+    }
+
+    FT_Set_Pixel_Sizes(face, 0, 48);
+
+    tmgl::VertexLayout layout;
+    layout.begin();
+    layout.add(tmgl::Attrib::Position, 4, tmgl::AttribType::Float);
+    layout.end();
+
+
+    std::vector<u16> indices = {0, 1, 2, 1, 3, 2};
+
+    ibh = createIndexBuffer(tmgl::copy(indices.data(), indices.size() * sizeof(u16)));
+
+    FT_GlyphSlot slot = face->glyph; // <-- This is new
+
+    for (unsigned char c = 0; c < 128; c++)
+    {
+        // load character glyph
+        if (FT_Load_Char(face, c, FT_LOAD_RENDER))
+        {
+            std::cout << "ERROR::FREETYTPE: Failed to load Glyph" << std::endl;
+        }
+
+        // Render as SDF using FreeType's built-in support
+        if (FT_Render_Glyph(face->glyph, FT_RENDER_MODE_SDF))
+        {
+            std::cerr << "Failed to render SDF glyph!" << std::endl;
+        }
+
+        tmgl::TextureFormat::Enum textureFormat = tmgl::TextureFormat::R8;
+        uint64_t textureFlags = 0; // Adjust as needed
+
+        var width = face->glyph->bitmap.width;
+        var height = face->glyph->bitmap.rows;
+
+        if (width == 0 || height == 0)
+        {
+            Character character = {glm::ivec2(face->glyph->bitmap.width, face->glyph->bitmap.rows),
+                                   glm::ivec2(face->glyph->bitmap_left, face->glyph->bitmap_top),
+                                   face->glyph->advance.x, nullptr,TMGL_INVALID_HANDLE};
+            characters.insert(std::pair<char, Character>(c, character));
+            continue;
+        }
+
+
+        var size = width * height;
+
+        // Create the texture in bgfx, passing the image data directly
+        var handle = createTexture2D(
+            static_cast<u16>(width), static_cast<u16>(height), false, 1,
+            textureFormat, textureFlags,
+            tmgl::copy(face->glyph->bitmap.buffer, size));
+
+        var tex = new Texture(handle);
+
+        string handleName = "";
+        handleName += static_cast<char>(c);
+        handleName += "_";
+        handleName += face->family_name;
+
+        setName(handle, handleName.c_str());
+
+        tex->name = handleName;
+
+        std::vector<glm::vec4> vertices;
+
+        var v_width = static_cast<float>(width);
+        var v_height = static_cast<float>(height);
+
+        vertices.emplace_back(0, 0, v_width, v_height);
+        vertices.emplace_back(v_width, 0, v_width, v_height);
+        vertices.emplace_back(0, v_height, v_width, v_height);
+        vertices.emplace_back(v_width, v_height, v_width, v_height);
+
+        var vbh = createVertexBuffer(tmgl::copy(vertices.data(), (vertices.size() * sizeof(glm::vec4))), layout);
+
+        // Glyph quads share the font's index buffer, the font destroys both buffers
+        var mesh = new Mesh();
+        mesh->vbh = vbh;
+        mesh->ibh = ibh;
+        mesh->ownsBuffers = false;
+        mesh->vertexCount = 4;
+        mesh->indexCount = indices.size();
+        mesh->origin = mo_loaded;
+        mesh->name = handleName;
+        registerMesh(mesh);
+
+        Character character = {glm::ivec2(face->glyph->bitmap.width, face->glyph->bitmap.rows),
+                               glm::ivec2(glm::abs(face->glyph->bitmap_left), face->glyph->bitmap_top),
+                               face->glyph->advance.x,
+                               tex, vbh, mesh};
+        characters.insert(std::pair<char, Character>(c, character));
+    }
+
+    FT_Done_Face(face);
+    FT_Done_FreeType(ft);
+
+    ResMgr->loaded_fonts[path] = this;
+}
+
+Font::~Font()
+{
+    std::erase_if(ResMgr->loaded_fonts, [this](const auto& font) { return font.second == this; });
+
+    for (auto& [c, character] : characters)
+    {
+        // Empty glyphs have no quad
+        if (!character.mesh)
+            continue;
+
+        delete character.mesh;
+        delete character.handle;
+        destroy(character.vbh);
+    }
+
+    destroy(ibh);
+}
+
+float* Camera::GetView()
+{
+    var Front = GetFront();
+    var Up = GetUp();
+
+    float view[16];
+
+    mtxLookAt(view, bx::Vec3(position.x, position.y, position.z), math::convertVec3(position + Front),
+              bx::Vec3(Up.x, Up.y, Up.z));
+
+    return view;
+}
+
+const float* Camera::GetProjection()
+{
+    return value_ptr(GetProjection_m4());
+}
+
+glm::mat4 Camera::GetView_m4()
+{
+    //if (mode == Perspective)
+    return lookAt(position, position + GetFront(), GetUp());
+
+    return glm::mat4(1.0);
+}
 
+glm::mat4 Camera::GetProjection_m4()
+{
+    float width = renderer->windowWidth;
+    float height = renderer->windowHeight;
 
-            textures.push_back(tex);
-        }
+    if (renderTexture->realTexture)
+    {
+        width = renderTexture->realTexture->width;
+        height = renderTexture->realTexture->height;
     }
 
-
-    var materialCount = reader->ReadInt32();
-    for (int i = 0; i < materialCount; ++i)
+    if (width == 0 || height == 0)
     {
-        reader->Skip(4);
-        var materialDescription = new MaterialDescription();
-        var name = reader->ReadString();
+        return glm::mat4(1.0);
+    }
 
-        materialDescription->Name = name;
+    if (mode == Perspective)
+        return glm::perspective(glm::radians(FOV),
+                                width / height,
+                                NearPlane, FarPlane);
 
-        var texCount = reader->ReadInt32();
-        for (int i = 0; i < texCount; ++i)
-        {
-            var uniform = reader->ReadString();
-            var texture = reader->ReadString();
+    return GetOrthoProjection_m4();
 
-            materialDescription->Textures.insert(std::make_pair(uniform, texture));
-        }
-        materials.push_back(materialDescription);
-    }
+}
 
-    skeleton = new Skeleton(reader);
+glm::mat4 Camera::GetOrthoProjection_m4()
+{
+    float width = renderer->windowWidth;
+    float height = renderer->windowHeight;
 
-    var animCount = reader->ReadInt32();
+    if (renderTexture->realTexture)
+    {
+        width = renderTexture->realTexture->width;
+        height = renderTexture->realTexture->height;
+    }
 
-    int preAnim = reader->tellg();
-    int postAnim = -1;
+    if (width == 0 || height == 0)
+    {
+        return glm::mat4(1.0);
+    }
 
-    int animSize = -1;
+    float rad = glm::radians(FOV);
 
-    for (int i = 0; i < animCount; ++i)
-    {
-        if (animSize == -1)
-            animations.push_back(new Animation(reader));
+    if (!application->is2D)
+        rad = 1;
 
-        if (i == 0 && postAnim == -1)
-        {
-            postAnim = reader->tellg();
-            //animSize = postAnim - preAnim;
-        }
+    float left = (width / 2) * rad;
+    float bottom = -(height / 2) * rad;
 
-        if (animSize != -1)
-        {
-            reader->Skip(animSize);
-        }
-    }
+    return glm::ortho(left, -left, bottom, -bottom, -100.f, 100.f);
 }
 
-Animation::Animation(fs::BinaryReader* reader)
+glm::vec3 Camera::GetFront()
 {
-    var sig = reader->ReadString(4);
-
-    name = reader->ReadString();
-    duration = reader->ReadSingle();
-    ticksPerSecond = reader->ReadInt32();
-
-    var channelCount = reader->ReadInt32();
-    for (int i = 0; i < channelCount; ++i)
-    {
-        var nodeChannel = new NodeChannel;
+    return rotation * glm::vec3{0, 0, 1};
+}
 
-        var nodeName = reader->ReadString();
-        var id = reader->ReadInt32();
+glm::vec3 Camera::GetUp()
+{
+    var Front = GetFront();
 
-        nodeChannel->name = nodeName;
-        nodeChannel->id = id;
+    glm::vec3 Right = normalize(cross(Front, glm::vec3{0, 1, 0}));
+    // normalize the vectors, because their length gets closer to 0 the more you look up or down which results in slower
+    // movement.
+    glm::vec3 Up = normalize(cross(Right, Front));
 
-        var pct = reader->ReadInt32();
-        for (int j = 0; j < pct; ++j)
-        {
-            var key = new NodeChannel::NodeKey<glm::vec3>();
-            key->time = reader->ReadSingle();
-            key->value = reader->ReadVec3();
-            nodeChannel->positions.push_back(key);
-        }
+    return Up;
+}
 
-        var rct = reader->ReadInt32();
-        for (int j = 0; j < rct; ++j)
-        {
-            var key = new NodeChannel::NodeKey<glm::quat>();
-            key->time = reader->ReadSingle();
-            key->value = reader->ReadQuat();
-            nodeChannel->rotations.push_back(key);
-        }
+// Buffer pixels with the NDC depth in z, false when the point is too close to the eye plane to divide by w
+static bool projectToOcclusion(const glm::mat4& viewProj, const glm::vec3& point, glm::vec3& out)
+{
+    var clip = viewProj * glm::vec4(point, 1);
+    if (clip.w < 1e-5f)
+        return false;
 
-        var sct = reader->ReadInt32();
-        for (int j = 0; j < sct; ++j)
-        {
-            var key = new NodeChannel::NodeKey<glm::vec3>();
-            key->time = reader->ReadSingle();
-            key->value = reader->ReadVec3();
-            nodeChannel->scales.push_back(key);
-        }
+    var ndc = glm::vec3(clip) / clip.w;
+    out = {(ndc.x * 0.5f + 0.5f) * OcclusionBuffer::Width, (ndc.y * 0.5f + 0.5f) * OcclusionBuffer::Height, ndc.z};
 
+    return true;
+}
 
-        nodeChannels.push_back(nodeChannel);
-    }
+void OcclusionBuffer::Clear(const glm::mat4& viewProj)
+{
+    this->viewProj = viewProj;
+    depth.assign(Width * Height, FLT_MAX);
+    triangleCount = 0;
 }
 
-std::vector<Animation*> Animation::LoadAnimations(string path)
+void OcclusionBuffer::DrawTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
 {
-    std::vector<Animation*> anims;
+    glm::vec3 v0, v1, v2;
+    if (depth.empty() || !projectToOcclusion(viewProj, a, v0) || !projectToOcclusion(viewProj, b, v1) ||
+        !projectToOcclusion(viewProj, c, v2))
+        return;
 
-    Assimp::Importer import;
-    const aiScene* scene = import.ReadFile(path, aiProcess_Triangulate);
+    float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+    if (std::abs(area) < 1e-6f)
+        return;
 
-    if (!scene || !scene->mRootNode)
+    // Hulls are drawn from both sides
+    if (area < 0)
     {
-        std::cout << "ERROR::ASSIMP::" << import.GetErrorString() << std::endl;
-        return anims;
+        std::swap(v1, v2);
+        area = -area;
     }
 
-    if (scene->HasAnimations())
-    {
-        for (int i = 0; i < scene->mNumAnimations; ++i)
-        {
-            var a = scene->mAnimations[i];
+    int minX = std::max(0, static_cast<int>(std::floor(std::min({v0.x, v1.x, v2.x}))));
+    int maxX = std::min(static_cast<int>(Width) - 1, static_cast<int>(std::floor(std::max({v0.x, v1.x, v2.x}))));
+    int minY = std::max(0, static_cast<int>(std::floor(std::min({v0.y, v1.y, v2.y}))));
+    int maxY = std::min(static_cast<int>(Height) - 1, static_cast<int>(std::floor(std::max({v0.y, v1.y, v2.y}))));
 
-            var animation = new Animation();
+    if (minX > maxX || minY > maxY)
+        return;
 
-            animation->LoadFromAiAnimation(a);
+    triangleCount++;
 
-            anims.push_back(animation);
-        }
-    }
+    // Edge functions e = a * x + b * y + c, positive inside. e0 is the edge facing v0 and so on
+    float a0 = v1.y - v2.y, b0 = v2.x - v1.x, c0 = v1.x * v2.y - v2.x * v1.y;
+    float a1 = v2.y - v0.y, b1 = v0.x - v2.x, c1 = v2.x * v0.y - v0.x * v2.y;
+    float a2 = v0.y - v1.y, b2 = v1.x - v0.x, c2 = v0.x * v1.y - v1.x * v0.y;
 
-    return anims;
-}
+    // NDC depth is linear in screen space
+    float za = (a0 * v0.z + a1 * v1.z + a2 * v2.z) / area;
+    float zb = (b0 * v0.z + b1 * v1.z + b2 * v2.z) / area;
+    float zc = (c0 * v0.z + c1 * v1.z + c2 * v2.z) / area;
 
+    for (int y = minY; y <= maxY; ++y)
+    {
+        float py = y + 0.5f;
+        float* row = &depth[y * Width];
 
-void Animation::LoadFromAiAnimation(aiAnimation* anim)
-{
-    name = anim->mName.C_Str();
-    duration = static_cast<float>(anim->mDuration);
-    ticksPerSecond = static_cast<int>(anim->mTicksPerSecond);
+        float r0 = b0 * py + c0, r1 = b1 * py + c1, r2 = b2 * py + c2, rz = zb * py + zc;
 
-    for (int i = 0; i < anim->mNumChannels; ++i)
-    {
-        var channel = anim->mChannels[i];
-        var nodeChannel = new NodeChannel;
-        nodeChannel->name = channel->mNodeName.C_Str();
+#ifdef TM_OCCLUSION_SSE
+        // Width is a multiple of 4 and the box holds the whole triangle, so starting on a
+        // 4 pixel boundary stays inside the row and the extra pixels fail the edge test
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
 
-        for (int i = 0; i < channel->mNumPositionKeys; ++i)
+        for (int x = minX & ~3; x <= maxX; x += 4)
         {
-            var posKey = channel->mPositionKeys[i];
-            nodeChannel->positions.push_back(new NodeChannel::NodeKey<glm::vec3>(
-                static_cast<float>(posKey.mTime), math::convertVec3(posKey.mValue)));
-        }
+            __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), offsets);
 
-        for (int i = 0; i < channel->mNumScalingKeys; ++i)
-        {
-            var posKey = channel->mScalingKeys[i];
-            nodeChannel->scales.push_back(new NodeChannel::NodeKey<glm::vec3>(
-                static_cast<float>(posKey.mTime), math::convertVec3(posKey.mValue)));
-        }
+            __m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a0), px), _mm_set1_ps(r0));
+            __m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a1), px), _mm_set1_ps(r1));
+            __m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a2), px), _mm_set1_ps(r2));
 
-        for (int i = 0; i < channel->mNumRotationKeys; ++i)
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)),
+                                       _mm_cmpge_ps(e2, zero));
+
+            __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(za), px), _mm_set1_ps(rz));
+            __m128 old = _mm_loadu_ps(row + x);
+            __m128 closer = _mm_min_ps(old, z);
+
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, closer), _mm_andnot_ps(inside, old)));
+        }
+#else
+        for (int x = minX; x <= maxX; ++x)
         {
-            var posKey = channel->mRotationKeys[i];
-            nodeChannel->rotations.push_back(new NodeChannel::NodeKey<glm::quat>(
-                static_cast<float>(posKey.mTime), math::convertQuat(posKey.mValue)));
+            float px = x + 0.5f;
+
+            if (a0 * px + r0 >= 0 && a1 * px + r1 >= 0 && a2 * px + r2 >= 0)
+                row[x] = std::min(row[x], za * px + rz);
         }
+#endif
+    }
+}
 
-        nodeChannels.push_back(nodeChannel);
+void OcclusionBuffer::DrawMesh(const Mesh* mesh, const glm::mat4& transform)
+{
+    if (!mesh || !mesh->indices || !(mesh->vertices || mesh->positions || mesh->quantizedPositions))
+        return;
+
+    for (size_t i = 0; i + 2 < mesh->indexCount; i += 3)
+    {
+        var a = glm::vec3(transform * glm::vec4(mesh->GetPosition(mesh->GetIndex(i + 0)), 1));
+        var b = glm::vec3(transform * glm::vec4(mesh->GetPosition(mesh->GetIndex(i + 1)), 1));
+        var c = glm::vec3(transform * glm::vec4(mesh->GetPosition(mesh->GetIndex(i + 2)), 1));
+
+        DrawTriangle(a, b, c);
     }
 }
 
-Skeleton::Skeleton(fs::BinaryReader* reader)
+bool OcclusionBuffer::IsOccluded(const math::AABB& bounds) const
 {
-    reader->Skip(4);
-    var boneCount = reader->ReadInt32();
+    if (triangleCount == 0)
+        return false;
 
-    for (int i = 0; i < boneCount; ++i)
+    float minX = FLT_MAX, minY = FLT_MAX, minZ = FLT_MAX;
+    float maxX = -FLT_MAX, maxY = -FLT_MAX;
+
+    for (int i = 0; i < 8; ++i)
     {
-        var name = reader->ReadString();
-        var id = reader->ReadInt32();
+        glm::vec3 corner = {i & 1 ? bounds.max.x : bounds.min.x, i & 2 ? bounds.max.y : bounds.min.y,
+                            i & 4 ? bounds.max.z : bounds.min.z};
 
-        var pos = reader->ReadVec3();
-        var rot = reader->ReadQuat();
-        var scl = reader->ReadVec3();
+        // A box reaching behind the eye can't be hidden
+        glm::vec3 p;
+        if (!projectToOcclusion(viewProj, corner, p))
+            return false;
 
-        var bone = new Bone();
-        bone->name = name;
-        bone->position = pos;
+        minX = std::min(minX, p.x);
+        maxX = std::max(maxX, p.x);
+        minY = std::min(minY, p.y);
+        maxY = std::max(maxY, p.y);
+        minZ = std::min(minZ, p.z);
+    }
 
-        //bone->position.x = pos.z;
-        //bone->position.z = pos.x;
+    // Every pixel the box's screen rectangle touches, partially covered ones included
+    int x0 = std::max(0, static_cast<int>(std::floor(minX)));
+    int x1 = std::min(static_cast<int>(Width) - 1, static_cast<int>(std::floor(maxX)));
+    int y0 = std::max(0, static_cast<int>(std::floor(minY)));
+    int y1 = std::min(static_cast<int>(Height) - 1, static_cast<int>(std::floor(maxY)));
 
-        bone->rotation = rot;
-        bone->scale = scl;
-        bone->skeleton = this;
+    if (x0 > x1 || y0 > y1)
+        return false;
 
-        glm::mat4 offsetMatrix;
+    for (int y = y0; y <= y1; ++y)
+    {
+        const float* row = &depth[y * Width];
 
-        for (int x = 0; x < 4; ++x)
+#ifdef TM_OCCLUSION_SSE
+        const __m128 nearest = _mm_set1_ps(minZ);
+
+        for (int x = x0 & ~3; x <= x1; x += 4)
         {
-            for (int y = 0; y < 4; ++y)
-            {
-                offsetMatrix[y][x] = reader->ReadSingle();
-            }
-        }
+            int lanes = _mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), nearest));
 
-        int childCount = reader->ReadInt32();
-        for (int i = 0; i < childCount; ++i)
+            // Drop the lanes left of x0 and right of x1
+            lanes &= (0xF << std::max(0, x0 - x)) & (0xF >> std::max(0, x + 3 - x1));
+            if (lanes)
+                return false;
+        }
+#else
+        for (int x = x0; x <= x1; ++x)
         {
-            var cname = reader->ReadString();
-            bone->children.push_back(cname);
+            if (row[x] >= minZ)
+                return false;
         }
-
-        bones.push_back(bone);
-        boneInfoMap[name] = {id, offsetMatrix};
+#endif
     }
 
-    rootName = reader->ReadString();
+    return true;
+}
 
-    for (auto& value : bones)
-    {
-        var world = value->GetWorldTransform();
-        var inverse = glm::inverse(world);
+u32 OcclusionBuffer::GetTriangleCount() const
+{
+    return triangleCount;
+}
 
-        var diff = inverse - world;
-        var diff2 = world + inverse;
+const float* OcclusionBuffer::GetDepth() const
+{
+    return depth.data();
+}
 
-        boneInfoMap[value->name].offset = (inverse);
+// Reference into drawList or proxyDrawList. order is the packet's position in the merged,
+// sorted frame so buckets can be recombined without comparing sort keys again
+struct DrawRef
+{
+    u32 order;
+    u32 index;
+    bool retained;
+};
 
-    }
-}
+struct DrawBucket
+{
+    u32 renderLayer;
+    std::vector<DrawRef> draws;
+};
 
-tmt::obj::Object* Model::CreateObject(Shader* shdr)
+enum CullState : u8
 {
+    CullUnknown,
+    CullVisible,
+    CullHidden,
+    CullOccluded,
+    CullCell
+};
 
-    var shader = shdr;
+// Cameras with the same view-projection share one visibility array, filled lazily,
+// and the visible cells and occlusion buffer, filled before any of them records
+struct CullResult
+{
+    glm::mat4 viewProj;
+    math::Frustum frustum;
+    std::vector<u8> visibility;
 
-    if (shader == nullptr)
+    glm::vec3 eye;
+    // Indexed by cell, empty when every cell counts as visible
+    std::vector<u8> cells;
+
+    OcclusionBuffer occlusion;
+    bool ready = false;
+};
+
+std::vector<DrawBucket> drawBuckets;
+std::vector<CullResult> cullResults;
+u32 cullResultCount = 0;
+u32 frameDrawCount = 0;
+u32 frameRenderLayers = 0;
+
+void buildDrawBuckets()
+{
+    for (auto& bucket : drawBuckets)
     {
-        shader = defaultShader;
+        bucket.draws.clear();
     }
 
-    var mdlObj = new obj::Object();
-
-    std::vector<Material*> mats;
-    mdlObj->name = name;
+    cullResultCount = 0;
 
-    for (auto materialDesc : this->materials)
+    frameRenderLayers = 0;
+    for (auto layerMap : obj::LayerMask::layerMap)
     {
-        mats.push_back(CreateMaterial(materialDesc, shader));
+        frameRenderLayers |= layerMap.second;
     }
 
+    // Immediate draws and retained proxies are both sorted by key, walk them together
+    var& calls = drawList.calls;
+    var& proxyCalls = proxyDrawList.calls;
 
-    var midx = 0;
-    for (auto value : meshes)
+    u32 order = 0;
+    DrawBucket* bucket = nullptr;
+
+    size_t callIdx = 0, proxyIdx = 0;
+    while (callIdx < calls.size() || proxyIdx < proxyCalls.size())
     {
-        var mshObj = obj::MeshObject::FromBasicMesh(value);
-        mshObj->material = mats[materialIndices[midx]];
-        mshObj->SetParent(mdlObj);
+        bool takeProxy = proxyIdx < proxyCalls.size() &&
+            (callIdx >= calls.size() || proxyCalls[proxyIdx].sortKey < calls[callIdx].sortKey);
+
+        u32 index = takeProxy ? proxyIdx++ : callIdx++;
+        const var& call = takeProxy ? proxyCalls[index] : calls[index];
+
+        if (!call.visible || call.renderLayer == 0)
+            continue;
+
+        if (!bucket || bucket->renderLayer != call.renderLayer)
+        {
+            bucket = nullptr;
+            for (auto& b : drawBuckets)
+            {
+                if (b.renderLayer == call.renderLayer)
+                {
+                    bucket = &b;
+                    break;
+                }
+            }
+
+            if (!bucket)
+            {
+                bucket = &drawBuckets.emplace_back();
+                bucket->renderLayer = call.renderLayer;
+            }
+        }
+
+        bucket->draws.push_back({order++, index, takeProxy});
+    }
+
+    frameDrawCount = order;
+}
 
-        midx++;
+// Not thread safe, cameras look their result up in prepare() before recording
+u32 getCullResult(const glm::mat4& viewProj, const glm::vec3& eye)
+{
+    for (u32 i = 0; i < cullResultCount; ++i)
+    {
+        if (cullResults[i].viewProj == viewProj)
+            return i;
     }
 
-    var sklObj = new SkeletonObject(skeleton);
-    sklObj->SetParent(mdlObj);
+    if (cullResultCount == cullResults.size())
+        cullResults.emplace_back();
 
-    var animator = new Animator();
-    animator->SetParent(mdlObj);
+    var& result = cullResults[cullResultCount];
+    result.viewProj = viewProj;
+    result.frustum = math::Frustum::FromMatrix(viewProj);
+    result.eye = eye;
+    result.visibility.assign(frameDrawCount, CullUnknown);
+    result.ready = false;
 
-    sklObj->animator = animator;
+    return cullResultCount++;
+}
 
-    return mdlObj;
+bool isCellVisible(const CullResult& cull, u32 cell)
+{
+    return cull.cells.empty() || cell >= cull.cells.size() || cull.cells[cell];
 }
 
-Texture::Texture(aiTexel* texels, int width, u64 flags)
+// Shared between cameras of different layers, so every occluder inside the frustum counts
+void buildCullResult(CullResult& cull)
 {
+    if (renderer->cellGraph)
+        renderer->cellGraph->GatherVisible(cull.eye, cull.frustum, cull.cells);
+    else
+        cull.cells.clear();
 
-    var caps = tmgl::getCaps();
-    //stbi_set_flip_vertically_on_load(true);
+    cull.occlusion.Clear(cull.viewProj);
+    cull.ready = true;
 
+    if (!renderer->occlusionCulling)
+        return;
 
-    //bool f = true;
+    for (const auto& proxy : renderProxies)
+    {
+        if (!proxy.alive || !proxy.occluder || !proxyDrawList.calls[renderProxyIndices[proxy.id]].visible ||
+            !isCellVisible(cull, proxy.cell))
+            continue;
 
-    int channels;
-    u8* data = stbi_load_from_memory((unsigned char*)texels, width, &this->width, &this->height, &channels, 4);
+        const var& transform = proxyDrawList.transforms[proxy.id];
+        if (!cull.frustum.Intersects(proxy.occluder->bounds.Transform(transform)))
+            continue;
 
-    bool f = this->width < caps->limits.maxTextureSize && this->height < caps->limits.maxTextureSize;
+        cull.occlusion.DrawMesh(proxy.occluder, transform);
+    }
+}
 
+CullState getDrawVisibility(CullResult& cull, const DrawRef& ref, const DrawCall& call)
+{
+    // Whole rooms go first, before looking at any bounds
+    if (ref.retained && !isCellVisible(cull, renderProxies[call.transform].cell))
+        return CullCell;
 
-    if (f)
+    // Only unskinned world space geometry has bounds we can trust
+    if (call.matrixMode != MaterialState::ViewProj || call.palette != static_cast<u32>(-1))
+        return CullVisible;
+
+    // Cameras sharing a frustum may record concurrently, both would write the same value
+    std::atomic_ref<u8> state(cull.visibility[ref.order]);
+
+    var visibility = state.load(std::memory_order_relaxed);
+    if (visibility == CullUnknown)
     {
+        math::AABB bounds;
 
+        if (ref.retained)
+        {
+            bounds = renderProxies[call.transform].bounds;
+        }
+        else if (call.instances != static_cast<u32>(-1))
+        {
+            bounds = drawList.instanceBatches[call.instances].bounds;
+        }
+        else if (call.mesh < meshTable.size() && meshTable[call.mesh])
+        {
+            bounds = meshTable[call.mesh]->bounds.Transform(drawList.transforms[call.transform]);
+        }
 
-        tmgl::TextureFormat::Enum textureFormat = tmgl::TextureFormat::RGBA8;
-        uint64_t textureFlags = flags; // Adjust as needed
+        if (!bounds.IsValid())
+            visibility = CullVisible;
+        else if (!cull.frustum.Intersects(bounds))
+            visibility = CullHidden;
+        else if (cull.occlusion.IsOccluded(bounds))
+            visibility = CullOccluded;
+        else
+            visibility = CullVisible;
 
-        // Create the texture in bgfx, passing the image data directly
-        handle = createTexture2D(static_cast<u16>(this->width), static_cast<u16>(this->height), false, 1, textureFormat,
-                                 textureFlags, tmgl::copy(data, this->width * this->height * channels));
-        format = textureFormat;
-    }
-    else
-    {
-        handle.idx = -1;
+        state.store(visibility, std::memory_order_relaxed);
     }
 
-    stbi_image_free(data);
+    return static_cast<CullState>(visibility);
 }
 
-Texture::Texture(string path, u64 flags)
+void Camera::prepare()
 {
+    commands.view = GetView_m4();
+    commands.projection = GetProjection_m4();
+    commands.orthoProjection = GetOrthoProjection_m4();
+    commands.viewPos = glm::vec4(position, 0);
 
-    uint64_t textureFlags = flags;
-    // Adjust as needed
-    int nrChannels;
-    u8* data = stbi_load(path.c_str(), &width, &height, &nrChannels, 0);
+    commands.cullResult = getCullResult(commands.projection * commands.view, position);
+    commands.entries.clear();
+    commands.stats = CullStats();
+}
 
-    var dataSize = width * height * nrChannels;
-    auto rgbaData = new unsigned char[dataSize];
+void Camera::record()
+{
+    var l = renderLayers == static_cast<u32>(-1) ? frameRenderLayers : renderLayers;
 
-    if (nrChannels == 3)
-    {
-        delete[] rgbaData;
-        dataSize = width * height * 4;
-        rgbaData = new unsigned char[dataSize];
-        for (int i = 0; i < width * height; ++i)
-        {
-            rgbaData[i * 4 + 0] = data[i * nrChannels + 0];
-            rgbaData[i * 4 + 1] = data[i * nrChannels + 1];
-            rgbaData[i * 4 + 2] = data[i * nrChannels + 2];
-            rgbaData[i * 4 + 3] = 255; // Add alpha channel with value 1.0
-        }
-        nrChannels = 4;
-    }
-    else if (nrChannels == 4)
+    std::vector<DrawBucket*> buckets;
+    for (auto& bucket : drawBuckets)
     {
-        for (int i = 0; i < width * height; ++i)
-        {
-            rgbaData[i * 4 + 0] = data[i * nrChannels + 0];
-            rgbaData[i * 4 + 1] = data[i * nrChannels + 1];
-            rgbaData[i * 4 + 2] = data[i * nrChannels + 2];
-            rgbaData[i * 4 + 3] = data[i * nrChannels + 3]; // Add alpha channel with value 1.0
-        }
-        rgbaData = data;
+        if ((bucket.renderLayer & l) && !bucket.draws.empty())
+            buckets.push_back(&bucket);
     }
-    else if (nrChannels == 2)
+
+    var& cull = cullResults[commands.cullResult];
+
+    // update() builds every result before recording, this only runs for a lone redraw()
+    if (!cull.ready)
+        buildCullResult(cull);
+
+    commands.stats.occluderTriangles = cull.occlusion.GetTriangleCount();
+
+    // Every bucket is already in frame order, merge them back on that order
+    std::vector<size_t> cursors(buckets.size(), 0);
+    while (true)
     {
-        delete[] rgbaData;
-        dataSize = width * height * 4;
-        rgbaData = new unsigned char[dataSize];
-        for (int i = 0; i < width * height; ++i)
+        size_t next = buckets.size();
+        u32 nextOrder = -1;
+
+        for (size_t i = 0; i < buckets.size(); ++i)
         {
-            rgbaData[i * 4 + 0] = data[i * nrChannels + 0];
-            rgbaData[i * 4 + 1] = data[i * nrChannels + 1];
-            rgbaData[i * 4 + 2] = 0;
-            rgbaData[i * 4 + 3] = data[i * nrChannels + 1];
+            if (cursors[i] < buckets[i]->draws.size() && buckets[i]->draws[cursors[i]].order < nextOrder)
+            {
+                next = i;
+                nextOrder = buckets[i]->draws[cursors[i]].order;
+            }
         }
-    }
 
+        if (next == buckets.size())
+            break;
 
-    tmgl::TextureFormat::Enum textureFormat = tmgl::TextureFormat::RGBA8;
+        const var& ref = buckets[next]->draws[cursors[next]++];
 
-    var s = sizeof(rgbaData);
+        var& list = ref.retained ? proxyDrawList : drawList;
+        const var& call = list.calls[ref.index];
 
-    // Create the texture in bgfx, passing the image data directly
-    handle = createTexture2D(static_cast<u16>(width), static_cast<u16>(height), false, 1, textureFormat, textureFlags,
-                             tmgl::copy(rgbaData, dataSize));
-    format = textureFormat;
+        var visibility = getDrawVisibility(cull, ref, call);
 
-    var fpath = std::filesystem::path(path);
-    name = fpath.stem().string();
+        if (visibility == CullHidden)
+        {
+            commands.stats.frustumCulled++;
+            continue;
+        }
 
-    stbi_image_free(data);
+        if (visibility == CullOccluded)
+        {
+            commands.stats.occlusionCulled++;
+            continue;
+        }
 
-    fs::ResourceManager::pInstance->loaded_textures.insert(std::make_pair(name, this));
+        if (visibility == CullCell)
+        {
+            commands.stats.cellCulled++;
+            continue;
+        }
+
+        commands.entries.push_back({&call, &list});
+    }
 
+    commands.stats.submitted = commands.entries.size();
 }
 
-Texture::Texture()
+void Camera::execute()
 {
-}
+    if (renderTexture->viewId > 0)
+    {
 
-TextureAtlas* TextureAtlas::CreateTexture(string dirPath) { return new TextureAtlas(dirPath); }
+        tmgl::setViewRect(renderTexture->viewId, 0, 0, renderTexture->realTexture->width,
+                          renderTexture->realTexture->height);
+    }
+    else
+    {
+        tmgl::setViewRect(renderTexture->viewId, 0, 0,
+                          static_cast<uint16_t>(renderer->windowWidth), static_cast<uint16_t>(renderer->windowHeight));
+    }
 
-TextureAtlas* TextureAtlas::CreateTexture(std::vector<string> paths) { return new TextureAtlas(paths); }
 
-TextureAtlas::~TextureAtlas()
-{
+    setViewMode(renderTexture->viewId, bgfx::ViewMode::Sequential);
+
+    for (const auto& entry : commands.entries)
+    {
+        submit(*entry.call, *entry.list);
+    }
 }
 
-TextureAtlas::TextureAtlas(string dirPath) :
-    Texture()
+void Camera::redraw()
 {
+    prepare();
+    record();
+    execute();
+}
 
-    std::vector<u8> pixels;
-    u16 imageCount = 0;
+const CullStats& Camera::GetCullStats() const
+{
+    return commands.stats;
+}
 
-    for (const auto& entry : std::filesystem::directory_iterator(dirPath))
-    {
-        if (entry.is_regular_file())
-        {
-            string path = entry.path().generic_string();
+const CameraCommands& Camera::GetCommands() const
+{
+    return commands;
+}
 
-            int nrChannels;
-            u8* data = stbi_load(path.c_str(), &width, &height, &nrChannels, 0);
+// A transform's four columns and a vec4 of parameters per instance, see DrawList::InstanceBatch
+constexpr u16 INSTANCE_STRIDE = sizeof(glm::mat4) + sizeof(glm::vec4);
 
-            var dataSize = width * height * nrChannels;
-            auto rgbaData = new unsigned char[dataSize];
+void Camera::submit(const DrawCall& call, DrawList& list)
+{
+    // tmgl::setTransform(call.transformMatrix);
 
-            if (nrChannels == 3)
-            {
-                delete[] rgbaData;
-                dataSize = width * height * 4;
-                rgbaData = new unsigned char[dataSize];
-                for (int i = 0; i < width * height; ++i)
-                {
-                    rgbaData[i * 4 + 0] = data[i * nrChannels + 0];
-                    rgbaData[i * 4 + 1] = data[i * nrChannels + 1];
-                    rgbaData[i * 4 + 2] = data[i * nrChannels + 2];
-                    rgbaData[i * 4 + 3] = 1.0f; // Add alpha channel with value 1.0
-                }
-                nrChannels = 4;
-            }
-            else if (nrChannels == 4)
-            {
-                rgbaData = data;
-            }
+    const var& material = list.materials[call.material];
 
-            for (int i = 0; i < dataSize; ++i)
-            {
-                pixels.push_back(rgbaData[i]);
-            }
+    if (!material.program)
+        return;
 
-            imageCount++;
+    switch (call.matrixMode)
+    {
+        case MaterialState::ViewProj:
+            tmgl::setViewTransform(renderTexture->viewId, value_ptr(commands.view), value_ptr(commands.projection));
+            break;
+        case MaterialState::View:
+            // tmgl::setViewTransform(0, mainCamera->GetView(), oneMat);
+            break;
+        case MaterialState::Proj:
+            // tmgl::setViewTransform(0, oneMat, proj);
+            break;
+        case MaterialState::None:
+            // tmgl::setViewTransform(0, oneMat, oneMat);
+            break;
+        case MaterialState::ViewOrthoProj:
+            // tmgl::setViewTransform(0, mainCamera->GetView(), ortho);
+            tmgl::setViewTransform(renderTexture->viewId, value_ptr(commands.view),
+                                   value_ptr(commands.orthoProjection));
+            break;
+        case MaterialState::OrthoProj:
+        {
+            // tmgl::setViewTransform(0, oneMat, ortho);
+            setUniform(orthoHandle, value_ptr(commands.orthoProjection));
         }
+        break;
     }
 
-    tmgl::TextureFormat::Enum textureFormat = tmgl::TextureFormat::RGBA8;
-    uint64_t textureFlags = TMGL_SAMPLER_U_MIRROR | TMGL_SAMPLER_V_MIRROR | TMGL_SAMPLER_POINT; // Adjust as needed
+    var mesh = call.mesh < meshTable.size() ? meshTable[call.mesh] : nullptr;
+    if (!mesh)
+        return;
 
-    // Create the texture in bgfx, passing the image data directly
-    handle = createTexture2D(static_cast<u16>(width), static_cast<u16>(height), false, imageCount, textureFormat,
-                             textureFlags,
-                             tmgl::copy(pixels.data(),
-                                        (static_cast<u32>(pixels.size()) * static_cast<u32>(sizeof(u8)))));
-    format = textureFormat;
-    setName(handle, "atlas");
-}
+    const var& transform = list.transforms[call.transform];
 
-TextureAtlas::TextureAtlas(std::vector<string> paths)
-{
-    std::vector<u8> pixels;
-    u16 imageCount = 0;
+    // The palette goes through iu_boneMatrices, setTransform's matrix count is capped far below MAX_BONE_MATRICES
+    const glm::mat4* palette = nullptr;
+    u16 paletteSize = 0;
 
-    for (auto path : paths)
+    if (call.palette != static_cast<u32>(-1) && list.palettes[call.palette].size() > 0 &&
+        material.program->HasFeature(SubShader::Skinned))
     {
-        int nrChannels;
-        stbi_set_flip_vertically_on_load(true);
-        u8* data = stbi_load(path.c_str(), &width, &height, &nrChannels, 0);
+        palette = list.palettes[call.palette].data();
+        paletteSize = static_cast<u16>(std::min<size_t>(list.palettes[call.palette].size(), MAX_BONE_MATRICES));
+    }
 
-        var dataSize = width * height * nrChannels;
-        auto rgbaData = new unsigned char[dataSize];
+    // Meshes split into 16-bit chunks submit once per chunk with the same state
+    for (u32 chunk = 0; chunk < mesh->GetChunkCount(); ++chunk)
+    {
+        setUniform(timeHandle, getTimeUniform());
+        setUniform(vposHandle, value_ptr(commands.viewPos));
 
-        if (nrChannels == 3)
+        if (call.instances != static_cast<u32>(-1))
         {
-            delete[] rgbaData;
-            dataSize = width * height * 4;
-            rgbaData = new unsigned char[dataSize];
-            for (int i = 0; i < width * height; ++i)
-            {
-                rgbaData[i * 4 + 0] = data[i * nrChannels + 0];
-                rgbaData[i * 4 + 1] = data[i * nrChannels + 1];
-                rgbaData[i * 4 + 2] = data[i * nrChannels + 2];
-                rgbaData[i * 4 + 3] = 1.0f; // Add alpha channel with value 1.0
-            }
-            nrChannels = 4;
+            const var& batch = list.instanceBatches[call.instances];
+
+            // What doesn't fit in this frame's instance buffer is dropped rather than split into more draws
+            var count = tmgl::getAvailInstanceDataBuffer(batch.count, INSTANCE_STRIDE);
+            if (count == 0)
+                continue;
+
+            tmgl::InstanceDataBuffer instanceData;
+            tmgl::allocInstanceDataBuffer(&instanceData, count, INSTANCE_STRIDE);
+            memcpy(instanceData.data, batch.data.data(), count * INSTANCE_STRIDE);
+
+            tmgl::setInstanceDataBuffer(&instanceData);
         }
-        else if (nrChannels == 4)
+        else
         {
-            rgbaData = data;
+            tmgl::setTransform(value_ptr(transform));
         }
 
-        for (int i = 0; i < dataSize; ++i)
-        {
-            pixels.push_back(rgbaData[i]);
-        }
+        if (palette)
+            tmgl::setUniform(animHandle, value_ptr(palette[0]), paletteSize);
 
-        imageCount++;
-    }
+        if (lights.size() > 0 && material.program->HasFeature(SubShader::Lit))
+            lightUniforms->Apply(lights);
 
-    tmgl::TextureFormat::Enum textureFormat = tmgl::TextureFormat::RGBA8;
-    uint64_t textureFlags = TMGL_SAMPLER_U_MIRROR | TMGL_SAMPLER_V_MIRROR | TMGL_SAMPLER_POINT; // Adjust as needed
+        mesh->use(chunk);
 
-    // Create the texture in bgfx, passing the image data directly
-    handle = createTexture2D(
-        static_cast<u16>(width), static_cast<u16>(height), false, imageCount, textureFormat, textureFlags,
-        tmgl::copy(pixels.data(), (static_cast<u32>(pixels.size()) * static_cast<u32>(sizeof(u8)))));
-    format = textureFormat;
-    setName(handle, "atlas");
+        tmgl::setState(call.state);
+
+        material.program->Push(renderTexture->viewId, list.GetOverrides(material), list.GetOverrideCount(material));
+    }
+
+    // tmgl::discard();
 }
 
-Texture* Texture::CreateTexture(string path, u64 flags)
+Camera* Camera::GetMainCamera()
 {
-    if (IN_MAP(ResMgr->loaded_textures, path))
-    {
-        return ResMgr->loaded_textures[path];
-    }
+    return renderer->cameraCache[0];
+}
 
-    if (!std::filesystem::exists(path))
-        return nullptr;
+Camera::Camera()
+{
+    renderer->cameraCache.push_back(this);
+}
 
-    return new Texture(path, flags);
+Camera::~Camera()
+{
+    renderer->cameraCache.erase(VEC_FIND(renderer->cameraCache, this));
+    if (renderTexture)
+    {
+        delete renderTexture;
+    }
 }
 
-Texture::Texture(int width, int height, tmgl::TextureFormat::Enum tf, u64 flags, const tmgl::Memory* mem, string name)
+Color Color::FromHex(string hex)
 {
-    handle = createTexture2D(width, height, false, 1, tf, flags, mem);
+    if (hex.starts_with("#"))
+    {
+        hex = hex.substr(1);
+    }
 
-    setName(handle, name.c_str());
+    int r, g, b;
+    sscanf(hex.c_str(), "%02x%02x%02x", &r, &g, &b);
 
-    format = tf;
-    this->width = width;
-    this->height = height;
-    this->name = name;
+    Color c{};
+    c.r = r / 255.0f;
+    c.g = g / 255.0f;
+    c.b = b / 255.0f;
 
-    ResMgr->loaded_textures[name] = this;
+    return c;
 }
 
-Texture::Texture(tmgl::TextureHandle handle)
+tmgl::VertexLayout Vertex::getVertexLayout()
 {
-    this->handle = handle;
+    var layout = tmgl::VertexLayout();
+    layout.begin()
+          .add(tmgl::Attrib::Position, 3, tmgl::AttribType::Float)
+          .add(tmgl::Attrib::Normal, 3, tmgl::AttribType::Float)
+          .add(tmgl::Attrib::TexCoord0, 2, tmgl::AttribType::Float)
+          .add(tmgl::Attrib::Indices, 4, tmgl::AttribType::Float, false, false)
+          .add(tmgl::Attrib::Weight, 4, tmgl::AttribType::Float, true)
+          .end();
 
+    return layout;
 }
 
-Texture::~Texture()
+void Vertex::SetBoneData(int boneId, float boneWeight)
 {
-    destroy(handle);
+    if (boneWeight <= 0.01)
+        return;
+    for (int i = 0; i < 4; ++i)
+    {
+        if (boneIds[i] < 0)
+        {
+            boneIds[i] = static_cast<s16>(boneId);
+            boneWeights[i] = boneWeight;
+            break;
+        }
+    }
 }
 
-RenderTexture::RenderTexture(u16 width, u16 height, tmgl::TextureFormat::Enum format, u16 cf)
+MatrixArray tmt::render::GetMatrixArray(glm::mat4 m)
 {
-    const tmgl::Memory* mem = nullptr;
-    if (format == tmgl::TextureFormat::RGBA8)
+    MatrixArray mat(16, 0.0f);
+    for (int x = 0; x < 4; ++x)
     {
-        // std::vector<GLubyte> pixels(width * height * 4, (GLubyte)0xffffffff);
-        // mem = tmgl::copy(pixels.data(), width * height* 4);
+        for (int y = 0; y < 4; ++y)
+        {
+            mat[x * 4 + y] = m[x][y];
+        }
     }
 
-    u64 textureFlags = TMGL_TEXTURE_RT_WRITE_ONLY;
+    return mat;
+}
 
-    bgfx::TextureFormat::Enum depthFormat = isTextureValid(0, false, 1, bgfx::TextureFormat::D16, textureFlags)
-        ? bgfx::TextureFormat::D16
-        : isTextureValid(0, false, 1, bgfx::TextureFormat::D24S8, textureFlags)
-        ? bgfx::TextureFormat::D24S8
-        : bgfx::TextureFormat::D32;
+Mesh* buildMesh(Vertex* data, void* indices, u8 indexSize, u32 vertCount, u32 triSize, tmgl::VertexLayout layout,
+                Model* model, string name, std::vector<Mesh::Chunk> chunks = {})
+{
+    u32 stride = layout.getStride();
+    u32 vertS = stride * vertCount;
 
-    realTexture = new Texture(width, height, format,
-                              textureFlags
-                              , mem);
+    u32 indeS = indexSize * triSize;
 
+    if (name == "none")
+    {
+        name = std::generateRandomString(12);
+        name += std::to_string(vertCount);
+        name += std::to_string(triSize);
+    }
 
-    handle = createFrameBuffer(1, &realTexture->handle, true);
-    this->format = format;
+    var mesh = new Mesh();
+    //memcpy(mesh->vertices, data, sizeof(data));
+    //memcpy(mesh->indices, indices, sizeof(indices));
+    mesh->indices = indices;
+    mesh->indexSize = indexSize;
+    mesh->vertices = data;
+    mesh->chunks = std::move(chunks);
+    mesh->model = model;
+    mesh->name = name;
+    if (model)
+    {
+        mesh->idx = model->meshes.size();
+    }
 
-    //tmgl::setViewName(vid, "RenderTexture");
-    //tmgl::setViewClear(vid, cf);
-    //tmgl::setViewRect(vid, 0, 0, width, height);
-    //setViewFrameBuffer(vid, handle);
+    for (u32 i = 0; i < vertCount; ++i)
+    {
+        mesh->bounds.Expand(data[i].position);
+    }
 
-    viewId = renderer->viewCache.size();
-    setViewFrameBuffer(viewId, handle);
+    mesh->vertexCount = vertCount;
+    mesh->indexCount = triSize;
 
-    renderer->viewCache.push_back(this);
-}
+    // Headless tools only read the CPU copies
+    if (renderer->headless)
+    {
+        registerMesh(mesh);
+        ResMgr->loaded_meshes[name] = mesh;
 
-RenderTexture::RenderTexture()
-{
-    viewId = renderer->viewCache.size();
-    if (viewId == 0)
+        return mesh;
+    }
+
+    // 32-bit meshes are few and large, they keep their own buffers
+    if (indexSize == sizeof(u16))
     {
-        tmgl::setViewFrameBuffer(0, BGFX_INVALID_HANDLE);
+        GeometryArena::Get(layout)->Allocate(mesh, data, static_cast<u16*>(indices));
     }
     else
     {
+        {
+            const tmgl::Memory* mem = tmgl::alloc(vertS);
 
-        var width = renderer->windowWidth;
-        var height = renderer->windowHeight;
+            bx::memCopy(mem->data, data, vertS);
 
+            mesh->vbh = createVertexBuffer(mem, layout);
+        }
 
-        depthFormat = tmgl::TextureFormat::D24S8;
-        format = tmgl::TextureFormat::RGBA8;
+        {
+            const tmgl::Memory* mem = tmgl::alloc(indeS);
 
-        resize(width, height);
-    }
-    tmgl::setViewClear(viewId, TMGL_CLEAR_COLOR | TMGL_CLEAR_DEPTH, Color(0.2f, 0.3f, 0.3f, 1).getHex(), 1.0f, 0);
+            bx::memCopy(mem->data, indices, indeS);
 
-    if (!name.empty())
-    {
-        tmgl::setViewName(viewId, name.c_str());
+            mesh->ibh = createIndexBuffer(mem, TMGL_BUFFER_INDEX32);
+        }
     }
 
+    registerMesh(mesh);
 
-    renderer->viewCache.push_back(this);
-}
+    mesh->ReleaseCpuData(renderer->meshCpuData);
 
+    ResMgr->loaded_meshes[name] = mesh;
 
-RenderTexture::~RenderTexture()
-{
-    bgfx::resetView(viewId);
-    renderer->viewCache.erase(VEC_FIND(renderer->viewCache, this));
+    return mesh;
 }
 
-void RenderTexture::resize(int width, int height)
+// Greedily packs triangles into ranges that reference at most 65536 vertices each. Vertices shared
+// across a range boundary are duplicated so every range can use 16-bit local indices
+Mesh* splitMesh(Vertex* data, u32* indices, u32 vertCount, u32 triSize, tmgl::VertexLayout layout, Model* model,
+                string name)
 {
-    if (realTexture)
-        delete realTexture;
-    if (depthTexture)
-        delete depthTexture;
-    if (isValid(handle))
+    std::vector<Vertex> chunkVertices;
+    std::vector<u16> chunkIndices;
+    std::vector<Mesh::Chunk> chunks;
+    std::unordered_map<u32, u16> remap;
+
+    chunkVertices.reserve(vertCount);
+    chunkIndices.reserve(triSize);
+
+    var chunk = Mesh::Chunk{0, 0, 0, 0};
+
+    for (u32 t = 0; t + 2 < triSize; t += 3)
     {
-        destroy(handle);
-    }
+        u32 newVertices = 0;
+        for (u32 k = 0; k < 3; ++k)
+        {
+            if (!remap.contains(indices[t + k]))
+                newVertices++;
+        }
 
-    u64 textureFlags = TMGL_TEXTURE_RT;
+        if (chunk.vertexCount + newVertices > 0x10000)
+        {
+            chunks.push_back(chunk);
+            chunk = Mesh::Chunk{static_cast<u32>(chunkVertices.size()), 0, static_cast<u32>(chunkIndices.size()), 0};
+            remap.clear();
+        }
 
+        for (u32 k = 0; k < 3; ++k)
+        {
+            u32 index = indices[t + k];
 
-    realTexture = new Texture(width, height, format, textureFlags);
-    depthTexture = new Texture(width, height, depthFormat, textureFlags);
+            var it = remap.find(index);
+            if (it == remap.end())
+            {
+                it = remap.emplace(index, static_cast<u16>(chunk.vertexCount++)).first;
+                chunkVertices.push_back(data[index]);
+            }
 
-    tmgl::TextureHandle handles[] = {realTexture->handle, depthTexture->handle};
+            chunkIndices.push_back(it->second);
+            chunk.indexCount++;
+        }
+    }
 
-    handle = createFrameBuffer(2, handles, true);
+    if (chunk.indexCount > 0)
+        chunks.push_back(chunk);
 
-    setViewFrameBuffer(viewId, handle);
-}
+    delete[] data;
+    delete[] indices;
 
-CubemapTexture::CubemapTexture(string path, int cubemapSize)
-{
-    int width, height, nrChannels;
-    float* data = stbi_loadf(path.c_str(), &width, &height, &nrChannels, 0);
+    var verts = new Vertex[chunkVertices.size()];
+    std::copy(chunkVertices.begin(), chunkVertices.end(), verts);
 
-    if (!data)
-    {
-        std::cerr << "Cubemap texture failed to load at path: " << path << std::endl;
-        return;
-    }
+    var incs = new u16[chunkIndices.size()];
+    std::copy(chunkIndices.begin(), chunkIndices.end(), incs);
 
-    var dataSize = width * height * nrChannels;
+    return buildMesh(verts, incs, sizeof(u16), chunkVertices.size(), chunkIndices.size(), layout, model, name,
+                     std::move(chunks));
+}
 
-    auto rgbaData = new float[dataSize];
+Mesh* tmt::render::createMesh(Vertex* data, u16* indices, u32 vertCount, u32 triSize,
+                              tmgl::VertexLayout layout, Model* model, string name)
+{
+    return buildMesh(data, indices, sizeof(u16), vertCount, triSize, layout, model, name);
+}
 
-    if (nrChannels == 3)
+Mesh* tmt::render::createMesh(Vertex* data, u32* indices, u32 vertCount, u32 triSize,
+                              tmgl::VertexLayout layout, Model* model, string name)
+{
+    // Every index fits in 16 bits, keep the smaller buffer
+    if (vertCount <= 0x10000)
     {
-        delete[] rgbaData;
-        dataSize = width * height * 4;
-        rgbaData = new float[dataSize];
-        for (int i = 0; i < width * height; ++i)
+        var narrow = new u16[triSize];
+        for (u32 i = 0; i < triSize; ++i)
         {
-            rgbaData[i * 4 + 0] = data[i * nrChannels + 0];
-            rgbaData[i * 4 + 1] = data[i * nrChannels + 1];
-            rgbaData[i * 4 + 2] = data[i * nrChannels + 2];
-            rgbaData[i * 4 + 3] = 1.0; // Add alpha channel with value 1.0
+            narrow[i] = static_cast<u16>(indices[i]);
         }
-        nrChannels = 4;
+
+        delete[] indices;
+
+        return buildMesh(data, narrow, sizeof(u16), vertCount, triSize, layout, model, name);
     }
-    dataSize = width * height * nrChannels * sizeof(float);
 
-    tmgl::TextureFormat::Enum textureFormat = tmgl::TextureFormat::RGBA32F; // Use floating point format for HDR
-    u16 textureFlags = 0;
+    if (renderer->splitLargeMeshes)
+        return splitMesh(data, indices, vertCount, triSize, layout, model, name);
 
-    var hdrHandle = createTexture2D(static_cast<u16>(width), static_cast<u16>(height), false, 1, textureFormat,
-                                    textureFlags, tmgl::copy(rgbaData, dataSize));
+    return buildMesh(data, indices, sizeof(u32), vertCount, triSize, layout, model, name);
+}
 
-    var hdrTexture = new Texture(hdrHandle);
+u64 makeSortKey(u32 sortLayer, Shader* program, u32 mesh)
+{
+    u32 low = (program ? static_cast<u32>(program->sortId) << 16 : 0) | (mesh & 0xFFFF);
+    return math::packU32ToU64(sortLayer, low);
+}
 
+constexpr u32 TRANSIENT_FRAMES = 3;
 
-    var format = tmgl::TextureFormat::RGBA8;
+struct TransientRing
+{
+    tmgl::VertexLayout layout;
+    tmgl::DynamicVertexBufferHandle vertexBuffer = TMGL_INVALID_HANDLE;
+    tmgl::DynamicIndexBufferHandle indexBuffer = TMGL_INVALID_HANDLE;
 
-    tmgl::TextureHandle cubemapHandle = createTextureCube(cubemapSize, false, 1, format, TMGL_TEXTURE_RT);
+    // Capacity of one frame slot, the GPU buffers hold TRANSIENT_FRAMES slots
+    u32 frameVertices = 1 << 14, frameIndices = 1 << 15;
+    u32 usedVertices = 0, usedIndices = 0;
+    // Overflow seen this frame, slots grow before the next one so handed out spans never move
+    u32 wantedVertices = 0, wantedIndices = 0;
 
+    std::vector<u8> vertexStaging;
+    std::vector<u16> indexStaging;
 
-    std::vector<tmgl::FrameBufferHandle> fbos;
+    std::vector<Mesh*> meshes;
+    u32 usedMeshes = 0;
 
-    for (int i = 0; i < 6; ++i)
+    void CreateBuffers()
     {
-        var attachment = tmgl::Attachment{};
-        attachment.init(cubemapHandle, tmgl::Access::Write, i);
-        fbos.push_back(createFrameBuffer(1, &attachment, true));
+        if (isValid(vertexBuffer))
+            destroy(vertexBuffer);
+        if (isValid(indexBuffer))
+            destroy(indexBuffer);
+
+        vertexBuffer = createDynamicVertexBuffer(frameVertices * TRANSIENT_FRAMES, layout);
+        indexBuffer = createDynamicIndexBuffer(frameIndices * TRANSIENT_FRAMES);
+
+        vertexStaging.resize(frameVertices * layout.getStride());
+        indexStaging.resize(frameIndices);
     }
+};
 
-    glm::mat4 captureProjection = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 10.0f);
-    glm::mat4 captureViews[] = {
-        lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)),
-        lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)),
-        lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f)),
-        lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f)),
-        lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, -1.0f, 0.0f)),
-        lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f))};
+std::vector<TransientRing*> transientRings;
+u32 transientFrame = 0;
 
-    var shader = Shader::CreateShader("test/equi_vert", "test/equi_frag");
+TransientGeometry tmt::render::allocateTransient(u32 vertexCount, u32 indexCount, tmgl::VertexLayout layout)
+{
+    TransientRing* ring = nullptr;
+    for (auto r : transientRings)
+    {
+        if (std::memcmp(&r->layout, &layout, sizeof(tmgl::VertexLayout)) == 0)
+        {
+            ring = r;
+            break;
+        }
+    }
 
-    var material = new Material(shader);
-    material->GetUniform("equiMap")->tex = hdrTexture;
-    tmgl::setViewClear(1, TMGL_CLEAR_COLOR | TMGL_CLEAR_DEPTH, Color(0.2f, 0.3f, 0.3f, 1).getHex(), 1.0f, 0);
+    if (!ring)
+    {
+        ring = new TransientRing();
+        ring->layout = layout;
+        ring->CreateBuffers();
+        transientRings.push_back(ring);
+    }
 
-    int off = 16;
-    for (int i = 0; i < 6; ++i)
+    if (ring->usedVertices + vertexCount > ring->frameVertices || ring->usedIndices + indexCount > ring->frameIndices)
     {
-        setViewFrameBuffer(i + off, fbos[i]);
-        tmgl::setViewRect(i + off, 0, 0, cubemapSize, cubemapSize);
-        tmgl::setViewTransform(i + off, value_ptr(captureViews[i]), value_ptr(captureProjection));
+        ring->wantedVertices = std::max(ring->wantedVertices, ring->usedVertices + vertexCount);
+        ring->wantedIndices = std::max(ring->wantedIndices, ring->usedIndices + indexCount);
+        return {};
+    }
 
-        var cube = GetPrimitive(prim::Cube);
+    if (ring->usedMeshes == ring->meshes.size())
+    {
+        var mesh = new Mesh();
+        mesh->origin = mo_generated;
+        mesh->name = "$transient";
+        mesh->vertexBuffers.push_back(ring->vertexBuffer);
+        registerMesh(mesh);
 
-        tmgl::setState(material->GetMaterialState());
+        ring->meshes.push_back(mesh);
+    }
 
-        cube->use();
+    u32 slot = transientFrame % TRANSIENT_FRAMES;
+    u32 stride = layout.getStride();
 
-        shader->Push(i + off, material->overrides.data(), material->overrides.size());
+    var mesh = ring->meshes[ring->usedMeshes++];
+    mesh->vertexBuffers[0] = ring->vertexBuffer;
+    mesh->indexBuffer = ring->indexBuffer;
+    mesh->baseVertex = slot * ring->frameVertices + ring->usedVertices;
+    mesh->firstIndex = slot * ring->frameIndices + ring->usedIndices;
+    mesh->vertexCount = vertexCount;
+    mesh->indexCount = indexCount;
 
-    }
+    TransientGeometry geometry;
+    geometry.vertices = std::span<u8>(ring->vertexStaging.data() + ring->usedVertices * stride, vertexCount * stride);
+    geometry.indices = std::span<u16>(ring->indexStaging.data() + ring->usedIndices, indexCount);
+    geometry.mesh = mesh;
 
-    for (auto fbo : fbos)
+    ring->usedVertices += vertexCount;
+    ring->usedIndices += indexCount;
+
+    return geometry;
+}
+
+// One update per ring and frame, right before the cameras submit
+void flushTransientGeometry()
+{
+    u32 slot = transientFrame % TRANSIENT_FRAMES;
+
+    for (auto ring : transientRings)
     {
-        destroy(fbo);
-    }
+        if (ring->usedVertices > 0)
+        {
+            update(ring->vertexBuffer, slot * ring->frameVertices,
+                   tmgl::copy(ring->vertexStaging.data(), ring->usedVertices * ring->layout.getStride()));
+        }
 
-    realTexture = new Texture(cubemapHandle);
-    panoramaTexture = hdrTexture;
+        if (ring->usedIndices > 0)
+        {
+            update(ring->indexBuffer, slot * ring->frameIndices,
+                   tmgl::copy(ring->indexStaging.data(), ring->usedIndices * sizeof(u16)));
+        }
+    }
 }
 
-Font* Font::Create(string path)
+void advanceTransientGeometry()
 {
-    if (IN_MAP(ResMgr->loaded_fonts, path))
+    transientFrame++;
+
+    for (auto ring : transientRings)
     {
-        return ResMgr->loaded_fonts[path];
-    }
+        ring->usedVertices = 0;
+        ring->usedIndices = 0;
+        ring->usedMeshes = 0;
 
-    return new Font(path);
+        if (ring->wantedVertices > ring->frameVertices || ring->wantedIndices > ring->frameIndices)
+        {
+            std::cout << "Growing transient geometry ring to " << ring->wantedVertices << " vertices" << std::endl;
+
+            ring->frameVertices = std::max(ring->frameVertices * 2, ring->wantedVertices);
+            ring->frameIndices = std::max(ring->frameIndices * 2, ring->wantedIndices);
+            ring->CreateBuffers();
+        }
+
+        ring->wantedVertices = 0;
+        ring->wantedIndices = 0;
+    }
 }
 
-float Font::CalculateTextSize(string text, float fontSize, float forcedSpacing)
+Shader* selectProgram(Material* material, u32 meshFeatures)
 {
-    float size = 0;
+    if (!material->shader)
+        return nullptr;
 
-    if (forcedSpacing == FLT_MAX)
-        forcedSpacing = spacing;
+    return material->shader->GetVariant(material->features | meshFeatures);
+}
 
-    var scl = 1.0f;
+void tmt::render::pushDrawCall(DrawCall d, Material* material, const glm::mat4& transform,
+                               const std::vector<glm::mat4>& anims)
+{
 
-    scl = (fontSize / 48);
+    u32 l1, l2;
 
-    for (char value : text)
-    {
+    math::unpackU64ToU32(d.sortKey, l1, l2);
 
-        var c = characters[value];
+    var program = selectProgram(material, anims.empty() ? 0 : SubShader::Skinned);
 
-        float xPos = size - c.bearing.x * scl;
+    d.renderLayer = l2;
+    d.sortKey = makeSortKey(l1, program, d.mesh);
 
-        size -= (c.advance >> 6) * scl;
-    }
+    d.state = material->GetMaterialState();
+    d.transform = drawList.PushTransform(transform);
+    d.material = drawList.PushMaterial(material, program);
 
-    size = -size;
+    if (anims.size() > 0)
+        d.palette = drawList.PushPalette(anims);
 
-    return size;
+    drawList.calls.push_back(d);
 }
 
-
-Font::Font(string path)
+void tmt::render::pushInstancedDrawCall(DrawCall d, Material* material, const std::vector<glm::mat4>& transforms,
+                                        const std::vector<glm::vec4>& parameters)
 {
+    if (transforms.empty())
+        return;
 
+    var program = selectProgram(material, SubShader::Instanced);
 
-    FT_Library ft;
-    if (FT_Init_FreeType(&ft))
+    if (!program || !program->HasFeature(SubShader::Instanced))
     {
-        std::cout << "Could not init FreeType Library" << std::endl;
+        for (const auto& transform : transforms)
+        {
+            pushDrawCall(d, material, transform);
+        }
         return;
     }
 
-    FT_Face face;
-    if (FT_New_Face(ft, path.c_str(), 0, &face))
+    math::AABB bounds;
+    var mesh = d.mesh < meshTable.size() ? meshTable[d.mesh] : nullptr;
+
+    if (mesh && mesh->bounds.IsValid())
     {
-        std::cout << "Failed to load font" << std::endl;
-        return;
+        for (const auto& transform : transforms)
+        {
+            var instanceBounds = mesh->bounds.Transform(transform);
+            bounds.Expand(instanceBounds.min);
+            bounds.Expand(instanceBounds.max);
+        }
     }
 
-    FT_Set_Pixel_Sizes(face, 0, 48);
+    u32 l1, l2;
 
-    tmgl::VertexLayout layout;
-    layout.begin();
-    layout.add(tmgl::Attrib::Position, 4, tmgl::AttribType::Float);
-    layout.end();
+    math::unpackU64ToU32(d.sortKey, l1, l2);
 
+    d.renderLayer = l2;
+    d.sortKey = makeSortKey(l1, program, d.mesh);
 
-    std::vector<u16> indices = {0, 1, 2, 1, 3, 2};
+    d.state = material->GetMaterialState();
+    // Unused by the Instanced variant, kept valid for everything that reads a call's transform
+    d.transform = drawList.PushTransform(glm::mat4(1));
+    d.material = drawList.PushMaterial(material, program);
+    d.instances = drawList.PushInstances(transforms, parameters, bounds);
 
-    ibh = createIndexBuffer(tmgl::copy(indices.data(), indices.size() * sizeof(u16)));
+    drawList.calls.push_back(d);
+}
 
-    FT_GlyphSlot slot = face->glyph; // <-- This is new
+u32 DrawList::PushTransform(const glm::mat4& transform)
+{
+    transforms.push_back(transform);
+    return transforms.size() - 1;
+}
 
-    for (unsigned char c = 0; c < 128; c++)
+u32 DrawList::PushMaterial(Material* material, Shader* program)
+{
+    var drawMaterial = DrawMaterial();
+    drawMaterial.program = program;
+    drawMaterial.overrideOffset = overrides.size();
+    drawMaterial.overrideCount = material->overrides.size();
+
+    overrides.insert(overrides.end(), material->overrides.begin(), material->overrides.end());
+
+    materials.push_back(drawMaterial);
+    return materials.size() - 1;
+}
+
+u32 DrawList::PushPalette(const std::vector<glm::mat4>& palette)
+{
+    // Slots are reused between frames so the inner vectors keep their capacity
+    if (paletteCount >= palettes.size())
+        palettes.emplace_back();
+
+    palettes[paletteCount].assign(palette.begin(), palette.end());
+    return paletteCount++;
+}
+
+u32 DrawList::PushInstances(const std::vector<glm::mat4>& transforms, const std::vector<glm::vec4>& parameters,
+                            const math::AABB& bounds)
+{
+    // Reused between frames like the palettes
+    if (instanceBatchCount >= instanceBatches.size())
+        instanceBatches.emplace_back();
+
+    var& batch = instanceBatches[instanceBatchCount];
+    batch.count = transforms.size();
+    batch.bounds = bounds;
+    batch.data.resize(transforms.size() * 5);
+
+    for (size_t i = 0; i < transforms.size(); ++i)
     {
-        // load character glyph
-        if (FT_Load_Char(face, c, FT_LOAD_RENDER))
-        {
-            std::cout << "ERROR::FREETYTPE: Failed to load Glyph" << std::endl;
-        }
+        var out = &batch.data[i * 5];
 
-        // Render as SDF using FreeType's built-in support
-        if (FT_Render_Glyph(face->glyph, FT_RENDER_MODE_SDF))
-        {
-            std::cerr << "Failed to render SDF glyph!" << std::endl;
-        }
+        out[0] = transforms[i][0];
+        out[1] = transforms[i][1];
+        out[2] = transforms[i][2];
+        out[3] = transforms[i][3];
+        out[4] = i < parameters.size() ? parameters[i] : glm::vec4(0);
+    }
 
-        tmgl::TextureFormat::Enum textureFormat = tmgl::TextureFormat::R8;
-        uint64_t textureFlags = 0; // Adjust as needed
+    return instanceBatchCount++;
+}
 
-        var width = face->glyph->bitmap.width;
-        var height = face->glyph->bitmap.rows;
+MaterialOverride* DrawList::GetOverrides(const DrawMaterial& material)
+{
+    if (material.material)
+        return material.material->overrides.data();
 
-        if (width == 0 || height == 0)
-        {
-            Character character = {glm::ivec2(face->glyph->bitmap.width, face->glyph->bitmap.rows),
-                                   glm::ivec2(face->glyph->bitmap_left, face->glyph->bitmap_top),
-                                   face->glyph->advance.x, nullptr,TMGL_INVALID_HANDLE};
-            characters.insert(std::pair<char, Character>(c, character));
-            continue;
-        }
+    if (material.overrideCount == 0)
+        return nullptr;
 
+    return overrides.data() + material.overrideOffset;
+}
 
-        var size = width * height;
+size_t DrawList::GetOverrideCount(const DrawMaterial& material)
+{
+    if (material.material)
+        return material.material->overrides.size();
 
-        // Create the texture in bgfx, passing the image data directly
-        var handle = createTexture2D(
-            static_cast<u16>(width), static_cast<u16>(height), false, 1,
-            textureFormat, textureFlags,
-            tmgl::copy(face->glyph->bitmap.buffer, size));
+    return material.overrideCount;
+}
 
-        var tex = new Texture(handle);
+void DrawList::Sort()
+{
+    std::sort(calls.begin(), calls.end(),
+              [](const DrawCall& a, const DrawCall& b) { return a.sortKey < b.sortKey; });
+}
 
-        string handleName = "";
-        handleName += static_cast<char>(c);
-        handleName += "_";
-        handleName += face->family_name;
+void DrawList::Clear()
+{
+    calls.clear();
+    transforms.clear();
+    materials.clear();
+    overrides.clear();
+    paletteCount = 0;
+    instanceBatchCount = 0;
+}
 
-        setName(handle, handleName.c_str());
+std::vector<u32> freeRenderProxyHandles;
+bool renderProxiesNeedSort = false;
+// Proxies following a transformHierarchy transform, checked every flush
+std::vector<u32> hierarchyRenderProxies;
 
-        tex->name = handleName;
+void RenderProxy::SetTransform(const glm::mat4& transform)
+{
+    proxyDrawList.transforms[id] = transform;
 
-        std::vector<glm::vec4> vertices;
+    MarkDirty(DirtyTransform);
+}
 
-        var v_width = static_cast<float>(width);
-        var v_height = static_cast<float>(height);
+void RenderProxy::SetTransform(math::TransformHierarchy::Handle transform)
+{
+    if (this->transform == transform)
+        return;
 
-        vertices.emplace_back(0, 0, v_width, v_height);
-        vertices.emplace_back(v_width, 0, v_width, v_height);
-        vertices.emplace_back(0, v_height, v_width, v_height);
-        vertices.emplace_back(v_width, v_height, v_width, v_height);
+    if (this->transform == math::TransformHierarchy::INVALID_HANDLE)
+        hierarchyRenderProxies.push_back(id);
+    else if (transform == math::TransformHierarchy::INVALID_HANDLE)
+        std::erase(hierarchyRenderProxies, id);
 
-        var vbh = createVertexBuffer(tmgl::copy(vertices.data(), (vertices.size() * sizeof(glm::vec4))), layout);
+    this->transform = transform;
 
-        Character character = {glm::ivec2(face->glyph->bitmap.width, face->glyph->bitmap.rows),
-                               glm::ivec2(glm::abs(face->glyph->bitmap_left), face->glyph->bitmap_top),
-                               face->glyph->advance.x,
-                               tex, vbh};
-        characters.insert(std::pair<char, Character>(c, character));
-    }
+    if (transform != math::TransformHierarchy::INVALID_HANDLE)
+        SetTransform(transformHierarchy.GetWorldMatrix(transform));
+}
 
-    FT_Done_Face(face);
-    FT_Done_FreeType(ft);
+void RenderProxy::SetMaterial(Material* material)
+{
+    if (this->material == material)
+        return;
 
-    ResMgr->loaded_fonts[path] = this;
+    this->material = material;
+
+    MarkDirty(DirtyMaterial);
 }
 
-float* Camera::GetView()
+void RenderProxy::SetLayers(u32 layer, u32 renderLayer)
 {
-    var Front = GetFront();
-    var Up = GetUp();
+    if (this->layer == layer && this->renderLayer == renderLayer)
+        return;
 
-    float view[16];
+    this->layer = layer;
+    this->renderLayer = renderLayer;
 
-    mtxLookAt(view, bx::Vec3(position.x, position.y, position.z), math::convertVec3(position + Front),
-              bx::Vec3(Up.x, Up.y, Up.z));
+    MarkDirty(DirtyLayer);
+}
 
-    return view;
+void RenderProxy::SetAnimationMatrices(const std::vector<glm::mat4>& anims)
+{
+    var& palette = proxyDrawList.palettes[id];
+
+    // Switching between skinned and static picks a different shader variant
+    if (palette.empty() != anims.empty())
+        MarkDirty(DirtyMaterial);
+
+    palette.assign(anims.begin(), anims.end());
+    GetDrawCall().palette = anims.empty() ? -1 : id;
 }
 
-const float* Camera::GetProjection()
+void RenderProxy::SetVisible(bool visible)
 {
-    return value_ptr(GetProjection_m4());
+    GetDrawCall().visible = visible;
 }
 
-glm::mat4 Camera::GetView_m4()
+void RenderProxy::MarkDirty(u8 flags)
 {
-    //if (mode == Perspective)
-    return lookAt(position, position + GetFront(), GetUp());
+    if (dirty == 0)
+        dirtyRenderProxies.push_back(id);
 
-    return glm::mat4(1.0);
+    dirty |= flags;
 }
 
-glm::mat4 Camera::GetProjection_m4()
+DrawCall& RenderProxy::GetDrawCall()
 {
-    float width = renderer->windowWidth;
-    float height = renderer->windowHeight;
+    return proxyDrawList.calls[renderProxyIndices[id]];
+}
 
-    if (renderTexture->realTexture)
+u32 tmt::render::createRenderProxy(Mesh* mesh, Material* material, u32 layer, u32 renderLayer)
+{
+    u32 id;
+
+    if (!freeRenderProxyHandles.empty())
     {
-        width = renderTexture->realTexture->width;
-        height = renderTexture->realTexture->height;
+        id = freeRenderProxyHandles.back();
+        freeRenderProxyHandles.pop_back();
     }
-
-    if (width == 0 || height == 0)
+    else
     {
-        return glm::mat4(1.0);
+        id = renderProxies.size();
+        renderProxies.emplace_back();
+        renderProxyIndices.push_back(-1);
+
+        proxyDrawList.transforms.emplace_back(1.0);
+        proxyDrawList.materials.emplace_back();
+        proxyDrawList.palettes.emplace_back();
     }
 
-    if (mode == Perspective)
-        return glm::perspective(glm::radians(FOV),
-                                width / height,
-                                NearPlane, FarPlane);
+    var& proxy = renderProxies[id];
+    proxy = RenderProxy();
+    proxy.id = id;
+    proxy.mesh = mesh;
+    proxy.material = material;
+    proxy.layer = layer;
+    proxy.renderLayer = renderLayer;
+    proxy.alive = true;
 
-    return GetOrthoProjection_m4();
+    proxyDrawList.transforms[id] = glm::mat4(1.0);
+    proxyDrawList.palettes[id].clear();
 
+    var call = DrawCall();
+    call.transform = id;
+    call.material = id;
+
+    renderProxyIndices[id] = proxyDrawList.calls.size();
+    proxyDrawList.calls.push_back(call);
+    dirtyRenderProxies.push_back(id);
+
+    return id;
 }
 
-glm::mat4 Camera::GetOrthoProjection_m4()
+RenderProxy* tmt::render::getRenderProxy(u32 handle)
 {
-    float width = renderer->windowWidth;
-    float height = renderer->windowHeight;
+    if (handle >= renderProxies.size() || !renderProxies[handle].alive)
+        return nullptr;
 
-    if (renderTexture->realTexture)
+    return &renderProxies[handle];
+}
+
+void tmt::render::destroyRenderProxy(u32 handle)
+{
+    if (!getRenderProxy(handle))
+        return;
+
+    u32 idx = renderProxyIndices[handle];
+
+    // Erase rather than swap so the key ordering stays intact
+    var& calls = proxyDrawList.calls;
+    calls.erase(calls.begin() + idx);
+    for (u32 i = idx; i < calls.size(); ++i)
     {
-        width = renderTexture->realTexture->width;
-        height = renderTexture->realTexture->height;
+        renderProxyIndices[calls[i].transform] = i;
     }
 
-    if (width == 0 || height == 0)
+    if (renderProxies[handle].transform != math::TransformHierarchy::INVALID_HANDLE)
+        std::erase(hierarchyRenderProxies, handle);
+
+    renderProxies[handle].alive = false;
+    renderProxyIndices[handle] = -1;
+    proxyDrawList.palettes[handle].clear();
+    freeRenderProxyHandles.push_back(handle);
+}
+
+void flushRenderProxies()
+{
+    // transformHierarchy.Update ran before render::update, only the transforms it touched are copied
+    for (u32 handle : hierarchyRenderProxies)
     {
-        return glm::mat4(1.0);
+        var& proxy = renderProxies[handle];
+        if (transformHierarchy.WasUpdated(proxy.transform))
+            proxy.SetTransform(transformHierarchy.GetWorldMatrix(proxy.transform));
     }
 
-    float rad = glm::radians(FOV);
+    for (u32 handle : dirtyRenderProxies)
+    {
+        var proxy = getRenderProxy(handle);
+        if (!proxy)
+            continue;
 
-    if (!application->is2D)
-        rad = 1;
+        var& call = proxy->GetDrawCall();
 
-    float left = (width / 2) * rad;
-    float bottom = -(height / 2) * rad;
+        if (proxy->dirty & (RenderProxy::DirtyTransform | RenderProxy::DirtyMaterial))
+        {
+            proxy->bounds = proxy->mesh ? proxy->mesh->bounds.Transform(proxyDrawList.transforms[handle])
+                                        : math::AABB();
+        }
 
-    return glm::ortho(left, -left, bottom, -bottom, -100.f, 100.f);
-}
+        if (proxy->dirty & (RenderProxy::DirtyMaterial | RenderProxy::DirtyLayer))
+        {
+            var& material = proxyDrawList.materials[handle];
+            material = DrawMaterial();
+            material.material = proxy->material;
 
-glm::vec3 Camera::GetFront()
-{
-    return rotation * glm::vec3{0, 0, 1};
+            call.mesh = proxy->mesh ? proxy->mesh->handle : -1;
+
+            if (proxy->material)
+            {
+                var skinned = !proxyDrawList.palettes[handle].empty();
+                material.program = selectProgram(proxy->material, skinned ? SubShader::Skinned : 0);
+                call.state = proxy->material->GetMaterialState();
+                call.matrixMode = proxy->material->state.matrixMode;
+            }
+
+            // Same packing as Mesh::draw -> pushDrawCall
+            call.renderLayer = proxy->layer;
+            call.sortKey = makeSortKey(proxy->renderLayer, material.program, call.mesh);
+
+            renderProxiesNeedSort = true;
+        }
+
+        proxy->dirty = 0;
+    }
+
+    dirtyRenderProxies.clear();
+
+    if (renderProxiesNeedSort)
+    {
+        var& calls = proxyDrawList.calls;
+        std::stable_sort(calls.begin(), calls.end(),
+                         [](const DrawCall& a, const DrawCall& b) { return a.sortKey < b.sortKey; });
+
+        // Retained packets index their SoA data by proxy handle
+        for (u32 i = 0; i < calls.size(); ++i)
+        {
+            renderProxyIndices[calls[i].transform] = i;
+        }
+
+        renderProxiesNeedSort = false;
+    }
 }
 
-glm::vec3 Camera::GetUp()
+constexpr u32 MAX_CAPTURE_READBACKS = 4;
+
+struct CaptureWrite
 {
-    var Front = GetFront();
+    enum Kind
+    {
+        Png,
+        Exr,
+        Hdr,
+        Raw,
+        Text
+    } kind = Png;
 
-    glm::vec3 Right = normalize(cross(Front, glm::vec3{0, 1, 0}));
-    // normalize the vectors, because their length gets closer to 0 the more you look up or down which results in slower
-    // movement.
-    glm::vec3 Up = normalize(cross(Right, Front));
+    string path;
+    std::vector<u8> data;
+    u32 width = 0, height = 0, pitch = 0;
+    tmgl::TextureFormat::Enum format = tmgl::TextureFormat::RGBA8;
+    bool yflip = false;
+};
 
-    return Up;
+// 0 for formats the writer can't unpack
+u32 getCaptureBytesPerPixel(tmgl::TextureFormat::Enum format)
+{
+    switch (format)
+    {
+    case tmgl::TextureFormat::RGBA8:
+    case tmgl::TextureFormat::BGRA8:
+        return 4;
+    case tmgl::TextureFormat::RGBA16F:
+        return 8;
+    case tmgl::TextureFormat::RGBA32F:
+        return 16;
+    default:
+        return 0;
+    }
 }
 
-void Camera::redraw()
+// Encodes and writes captures in request order on one background thread
+struct CaptureWriter
 {
-    if (renderTexture->viewId > 0)
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<CaptureWrite> queue;
+    bool running = false;
+
+    // Queued or being written, counted against MAX_CAPTURE_READBACKS so a slow disk drops frames
+    std::atomic<u32> pending = 0;
+
+    void Push(CaptureWrite&& write)
     {
+        pending++;
+
+        {
+            std::lock_guard lock(mutex);
+            if (!running)
+            {
+                running = true;
+                thread = std::thread([this] { Run(); });
+            }
 
-        tmgl::setViewRect(renderTexture->viewId, 0, 0, renderTexture->realTexture->width,
-                          renderTexture->realTexture->height);
+            queue.push_back(std::move(write));
+        }
+
+        wake.notify_one();
     }
-    else
+
+    // Writes everything already queued before returning
+    void Stop()
     {
-        tmgl::setViewRect(renderTexture->viewId, 0, 0,
-                          static_cast<uint16_t>(renderer->windowWidth), static_cast<uint16_t>(renderer->windowHeight));
-    }
+        {
+            std::lock_guard lock(mutex);
+            if (!running)
+                return;
 
+            running = false;
+        }
 
-    setViewMode(renderTexture->viewId, bgfx::ViewMode::Sequential);
+        wake.notify_one();
+        thread.join();
+    }
 
-    var l = renderLayers;
-    if (renderLayers == -1)
+private:
+    void Run()
     {
-        l = 0;
-        for (auto layerMap : obj::LayerMask::layerMap)
+        while (true)
         {
-            l |= layerMap.second;
+            CaptureWrite write;
+            {
+                std::unique_lock lock(mutex);
+                wake.wait(lock, [this] { return !queue.empty() || !running; });
+
+                if (queue.empty())
+                    return;
+
+                write = std::move(queue.front());
+                queue.pop_front();
+            }
+
+            Write(write);
+            pending--;
         }
     }
 
-    /*
-    for (const auto& draw : calls)
+    // Source row y, top row first
+    static const u8* GetRow(const CaptureWrite& write, u32 y)
     {
-        printf("Submitting draw call: Layer %d\n", draw.layer);
+        return &write.data[(write.yflip ? write.height - 1 - y : y) * write.pitch];
     }
-    */
 
-    for (int i = 0; i < drawCalls.size(); i++)
+    static void UnpackRow(const CaptureWrite& write, const u8* src, float* dst)
     {
-        const var& call = drawCalls[i];
-        // tmgl::setTransform(call.transformMatrix);
+        var count = write.width * 4;
 
-        if (!call.program)
-            continue;
+        switch (write.format)
+        {
+        case tmgl::TextureFormat::RGBA32F:
+            memcpy(dst, src, count * sizeof(float));
+            break;
+        case tmgl::TextureFormat::RGBA16F:
+            for (u32 i = 0; i < count; ++i)
+            {
+                dst[i] = glm::unpackHalf1x16(reinterpret_cast<const u16*>(src)[i]);
+            }
+            break;
+        default:
+            for (u32 i = 0; i < count; ++i)
+            {
+                dst[i] = src[i] / 255.0f;
+            }
 
-        if (!(l & call.renderLayer))
-            continue;
+            if (write.format == tmgl::TextureFormat::BGRA8)
+            {
+                for (u32 x = 0; x < write.width; ++x)
+                {
+                    std::swap(dst[x * 4 + 0], dst[x * 4 + 2]);
+                }
+            }
+            break;
+        }
+    }
 
-        switch (call.matrixMode)
+    static void PackRow(const CaptureWrite& write, const u8* src, u8* dst, std::vector<float>& scratch)
+    {
+        if (write.format != tmgl::TextureFormat::RGBA8 && write.format != tmgl::TextureFormat::BGRA8)
         {
-            case MaterialState::ViewProj:
-                tmgl::setViewTransform(renderTexture->viewId, value_ptr(GetView_m4()), value_ptr(GetProjection_m4()));
-                break;
-            case MaterialState::View:
-                // tmgl::setViewTransform(0, mainCamera->GetView(), oneMat);
-                break;
-            case MaterialState::Proj:
-                // tmgl::setViewTransform(0, oneMat, proj);
-                break;
-            case MaterialState::None:
-                // tmgl::setViewTransform(0, oneMat, oneMat);
-                break;
-            case MaterialState::ViewOrthoProj:
-                // tmgl::setViewTransform(0, mainCamera->GetView(), ortho);
-                tmgl::setViewTransform(renderTexture->viewId, value_ptr(GetView_m4()),
-                                       value_ptr(GetOrthoProjection_m4()));
-                break;
-            case MaterialState::OrthoProj:
+            scratch.resize(write.width * 4);
+            UnpackRow(write, src, scratch.data());
+
+            for (u32 i = 0; i < scratch.size(); ++i)
             {
-                // tmgl::setViewTransform(0, oneMat, ortho);
-                setUniform(orthoHandle, value_ptr(GetOrthoProjection_m4()));
+                dst[i] = static_cast<u8>(glm::clamp(scratch[i], 0.0f, 1.0f) * 255.0f + 0.5f);
             }
-            break;
+            return;
         }
 
-        setUniform(timeHandle, getTimeUniform());
-        setUniform(vposHandle, math::vec4toArray(glm::vec4(position, 0)));
+        memcpy(dst, src, write.width * 4);
 
-        if (call.animationMatrices.size() > 0)
+        if (write.format == tmgl::TextureFormat::BGRA8)
         {
-            // tmgl::setUniform(animHandle, call.animationMatrices);
+            for (u32 x = 0; x < write.width; ++x)
+            {
+                std::swap(dst[x * 4 + 0], dst[x * 4 + 2]);
+            }
+        }
+    }
 
-            var matrixCount = call.animationMatrices.size() + 1;
+    static void Write(const CaptureWrite& write)
+    {
+        if (write.kind == CaptureWrite::Text)
+        {
+            std::ofstream file(write.path, std::ios::binary);
+            file.write(reinterpret_cast<const char*>(write.data.data()), write.data.size());
+            return;
+        }
 
-            std::vector<float> matrixData;
-            matrixData.reserve(matrixCount * 16);
+        bool written = true;
 
+        if (write.kind == CaptureWrite::Exr || write.kind == CaptureWrite::Hdr)
+        {
+            // Tightly packed float RGBA, top row first
+            std::vector<float> pixels(write.width * write.height * 4);
+            for (u32 y = 0; y < write.height; ++y)
             {
-                const float* transformPtr = value_ptr(call.transformMatrix);
-                matrixData.insert(matrixData.end(), transformPtr, transformPtr + 16);
+                UnpackRow(write, GetRow(write, y), &pixels[y * write.width * 4]);
             }
 
-            for (const auto& full_vec : call.animationMatrices)
+            if (write.kind == CaptureWrite::Hdr)
             {
-                const float* matPtr = value_ptr(full_vec);
-                matrixData.insert(matrixData.end(), matPtr, matPtr + 16);
+                written = stbi_write_hdr(write.path.c_str(), write.width, write.height, 4, pixels.data()) != 0;
             }
+            else
+            {
+                bx::FileWriter file;
+                bx::Error error;
 
-
-            // tmgl::setTransform(glm::value_ptr(fullVec[0]));
-            tmgl::setTransform(matrixData.data(), static_cast<uint16_t>(matrixCount));
+                written = bx::open(&file, bx::FilePath(write.path.c_str()), false, &error);
+                if (written)
+                {
+                    bimg::imageWriteExr(&file, write.width, write.height, write.width * 4 * sizeof(float),
+                                        pixels.data(), bimg::TextureFormat::RGBA32F, false, &error);
+                    bx::close(&file);
+                    written = error.isOk();
+                }
+            }
         }
         else
         {
-            var matrix = call.transformMatrix;
-            if (call.matrixMode == MaterialState::OrthoProj)
+            // Tightly packed RGBA8, top row first
+            std::vector<u8> pixels(write.width * write.height * 4);
+            std::vector<float> scratch;
+            for (u32 y = 0; y < write.height; ++y)
             {
+                PackRow(write, GetRow(write, y), &pixels[y * write.width * 4], scratch);
             }
-            tmgl::setTransform(value_ptr(matrix));
-        }
 
-        if (lights.size() > 0)
-            lightUniforms->Apply(lights);
-
-        if (call.mesh)
-        {
-            call.mesh->use();
+            if (write.kind == CaptureWrite::Png)
+            {
+                written = stbi_write_png(write.path.c_str(), write.width, write.height, 4, pixels.data(),
+                                         write.width * 4) != 0;
+            }
+            else
+            {
+                std::ofstream file(write.path, std::ios::binary);
+                file.write("TRAW", 4);
+                file.write(reinterpret_cast<const char*>(&write.width), sizeof(u32));
+                file.write(reinterpret_cast<const char*>(&write.height), sizeof(u32));
+                file.write(reinterpret_cast<const char*>(pixels.data()), pixels.size());
+                written = file.good();
+            }
         }
-        else
+
+        if (!written)
         {
-            setVertexBuffer(0, call.vbh, 0, call.vertexCount);
-            setIndexBuffer(call.ibh, 0, call.indexCount);
+            std::cout << "Failed to write capture " << write.path << std::endl;
         }
+    }
+};
 
-        tmgl::setState(call.state);
+struct CaptureReadback
+{
+    tmgl::TextureHandle texture = TMGL_INVALID_HANDLE;
+    tmgl::TextureFormat::Enum format = tmgl::TextureFormat::Count;
+    int width = 0, height = 0;
 
-        call.program->Push(renderTexture->viewId, call.overrides, call.overrideCt);
+    u32 readyFrame = 0;
+    bool busy = false;
 
-        // tmgl::discard();
-    }
-}
+    CaptureWrite write;
+};
 
-Camera* Camera::GetMainCamera()
+struct CaptureRequest
 {
-    return renderer->cameraCache[0];
-}
+    string path;
+    RenderTexture* target;
+};
 
-Camera::Camera()
+CaptureWriter captureWriter;
+std::vector<CaptureReadback> captureReadbacks;
+std::vector<CaptureRequest> captureRequests;
+
+string captureDirectory;
+RenderTexture* captureTarget = nullptr;
+bool capturing = false;
+u32 captureFrameIndex = 0;
+
+// Blits are issued on this view, so it has to come after every camera's. 0 until the first capture
+tmgl::ViewId captureView = 0;
+
+CaptureWrite::Kind getCaptureKind(const string& path)
 {
-    renderer->cameraCache.push_back(this);
+    if (path.ends_with(".raw"))
+        return CaptureWrite::Raw;
+    if (path.ends_with(".exr"))
+        return CaptureWrite::Exr;
+    if (path.ends_with(".hdr"))
+        return CaptureWrite::Hdr;
+
+    return CaptureWrite::Png;
 }
 
-Camera::~Camera()
+// Reserved in the view cache like a RenderTexture's view. Moved to the end again when RenderTextures were
+// created after it, the old slot stays reserved so no live view id is handed out twice
+tmgl::ViewId getCaptureView()
 {
-    renderer->cameraCache.erase(VEC_FIND(renderer->cameraCache, this));
-    if (renderTexture)
+    var& views = renderer->viewCache;
+
+    if (captureView == 0 || captureView + 1 != views.size())
     {
-        delete renderTexture;
+        captureView = views.size();
+        views.push_back(nullptr);
+
+        tmgl::setViewName(captureView, "Capture");
     }
+
+    return captureView;
 }
 
-Color Color::FromHex(string hex)
+// Backbuffer captures come through here, everything else matches tmgl's default callback
+struct CaptureCallback : tmgl::CallbackI
 {
-    if (hex.starts_with("#"))
+    void fatal(const char* filePath, u16 line, tmgl::Fatal::Enum code, const char* str) override
     {
-        hex = hex.substr(1);
+        std::cout << "Renderer error at " << filePath << ":" << line << ": " << str << std::endl;
+
+        if (code != tmgl::Fatal::DebugCheck)
+            abort();
     }
 
-    int r, g, b;
-    sscanf(hex.c_str(), "%02x%02x%02x", &r, &g, &b);
+    // Dropped like the default release callback, printing every trace line floods the console while capturing
+    void traceVargs(const char* filePath, u16 line, const char* format, va_list argList) override {}
 
-    Color c{};
-    c.r = r / 255.0f;
-    c.g = g / 255.0f;
-    c.b = b / 255.0f;
+    void profilerBegin(const char* name, u32 abgr, const char* filePath, u16 line) override {}
+    void profilerBeginLiteral(const char* name, u32 abgr, const char* filePath, u16 line) override {}
+    void profilerEnd() override {}
 
-    return c;
-}
+    // No shader cache, same as the default
+    u32 cacheReadSize(u64 id) override { return 0; }
+    bool cacheRead(u64 id, void* data, u32 size) override { return false; }
+    void cacheWrite(u64 id, const void* data, u32 size) override {}
 
-tmgl::VertexLayout Vertex::getVertexLayout()
-{
-    var layout = tmgl::VertexLayout();
-    layout.begin()
-          .add(tmgl::Attrib::Position, 3, tmgl::AttribType::Float)
-          .add(tmgl::Attrib::Normal, 3, tmgl::AttribType::Float)
-          .add(tmgl::Attrib::TexCoord0, 2, tmgl::AttribType::Float)
-          .add(tmgl::Attrib::Indices, 4, tmgl::AttribType::Float, false, false)
-          .add(tmgl::Attrib::Weight, 4, tmgl::AttribType::Float, true)
-          .end();
+    // Runs on the render thread, copy and get out of the way
+    void screenShot(const char* filePath, u32 width, u32 height, u32 pitch, const void* data, u32 size,
+                    bool yflip) override
+    {
+        PushFrame(filePath, width, height, pitch, tmgl::TextureFormat::BGRA8, yflip, data, size);
+    }
 
-    return layout;
-}
+    // Continuous backbuffer capture, enabled with TMGL_RESET_CAPTURE while capturing without a target
+    void captureBegin(u32 width, u32 height, u32 pitch, tmgl::TextureFormat::Enum format, bool yflip) override
+    {
+        stream = {width, height, pitch, format, yflip};
+    }
 
-void Vertex::SetBoneData(int boneId, float boneWeight)
-{
-    if (boneWeight <= 0.01)
-        return;
-    for (int i = 0; i < 4; ++i)
+    void captureEnd() override {}
+
+    void captureFrame(const void* data, u32 size) override
     {
-        if (boneIds[i] < 0)
+        char name[32];
+        snprintf(name, sizeof(name), "frame_%06u.raw", captureFrameIndex++);
+
+        PushFrame(captureDirectory + "/" + name, stream.width, stream.height, stream.pitch, stream.format,
+                  stream.yflip, data, size);
+    }
+
+private:
+    struct Stream
+    {
+        u32 width = 0, height = 0, pitch = 0;
+        tmgl::TextureFormat::Enum format = tmgl::TextureFormat::BGRA8;
+        bool yflip = false;
+    } stream;
+
+    static void PushFrame(const string& path, u32 width, u32 height, u32 pitch, tmgl::TextureFormat::Enum format,
+                          bool yflip, const void* data, u32 size)
+    {
+        if (captureWriter.pending >= MAX_CAPTURE_READBACKS)
         {
-            boneIds[i] = static_cast<s16>(boneId);
-            boneWeights[i] = boneWeight;
-            break;
+            std::cout << "Capture writes are all in flight, dropping " << path << std::endl;
+            return;
+        }
+
+        if (getCaptureBytesPerPixel(format) == 0)
+        {
+            std::cout << "Can't capture the backbuffer, its format isn't supported" << std::endl;
+            return;
         }
+
+        CaptureWrite write;
+        write.path = path;
+        write.kind = getCaptureKind(write.path);
+        write.data.assign(static_cast<const u8*>(data), static_cast<const u8*>(data) + size);
+        write.width = width;
+        write.height = height;
+        write.pitch = pitch;
+        write.format = format;
+        write.yflip = yflip;
+
+        captureWriter.Push(std::move(write));
     }
-}
+};
 
-float DrawCall::getDistance(Camera* cam)
-{
-    return glm::length(cam->position - sortedPosition);
-}
+CaptureCallback captureCallback;
 
-MatrixArray tmt::render::GetMatrixArray(glm::mat4 m)
+// Everything the cameras recorded this frame, stable across runs for headless comparisons
+string describeFrame()
 {
-    MatrixArray mat(16, 0.0f);
-    for (int x = 0; x < 4; ++x)
+    std::stringstream out;
+    out << std::fixed << std::setprecision(4);
+
+    out << "frame " << counterTime << "\n";
+
+    for (u32 i = 0; i < renderer->cameraCache.size(); ++i)
     {
-        for (int y = 0; y < 4; ++y)
+        var camera = renderer->cameraCache[i];
+        const var& commands = camera->GetCommands();
+        const var& stats = commands.stats;
+
+        out << "camera " << i << " view " << camera->renderTexture->viewId << " position " << camera->position.x
+            << " " << camera->position.y << " " << camera->position.z << " rotation " << camera->rotation.w << " "
+            << camera->rotation.x << " " << camera->rotation.y << " " << camera->rotation.z << "\n";
+
+        out << "  culled frustum " << stats.frustumCulled << " cell " << stats.cellCulled << " occlusion "
+            << stats.occlusionCulled << "\n";
+
+        for (const auto& entry : commands.entries)
         {
-            mat[x * 4 + y] = m[x][y];
+            const var& call = *entry.call;
+            const var& material = entry.list->materials[call.material];
+
+            out << "  draw mesh " << call.mesh << " program " << (material.program ? material.program->name : "none")
+                << " layer " << call.renderLayer << " state " << std::hex << call.state << std::dec;
+
+            if (call.instances != static_cast<u32>(-1))
+                out << " instances " << entry.list->instanceBatches[call.instances].count;
+
+            out << " transform";
+
+            const var& transform = entry.list->transforms[call.transform];
+            for (int c = 0; c < 4; ++c)
+            {
+                for (int r = 0; r < 4; ++r)
+                {
+                    out << " " << transform[c][r];
+                }
+            }
+
+            out << "\n";
         }
     }
 
-    return mat;
+    return out.str();
 }
 
-Mesh* tmt::render::createMesh(Vertex* data, u16* indices, u32 vertCount, u32 triSize,
-                              tmgl::VertexLayout layout, Model* model, string name)
+void requestReadback(const CaptureRequest& request)
 {
-    u32 stride = layout.getStride();
-    u32 vertS = stride * vertCount;
-
-    u32 indeS = sizeof(u16) * triSize;
+    var texture = request.target->realTexture;
+    if (!texture)
+        return;
 
-    if (name == "none")
+    var bytesPerPixel = getCaptureBytesPerPixel(texture->format);
+    if (bytesPerPixel == 0)
     {
-        name = std::generateRandomString(12);
-        name += std::to_string(vertCount);
-        name += std::to_string(triSize);
+        std::cout << "Can't capture " << request.target->name
+            << ", only RGBA8, BGRA8, RGBA16F and RGBA32F targets are supported" << std::endl;
+        return;
     }
 
-    var mesh = new Mesh();
-    //memcpy(mesh->vertices, data, sizeof(data));
-    //memcpy(mesh->indices, indices, sizeof(indices));
-    mesh->indices = indices;
-    mesh->vertices = data;
-    mesh->model = model;
-    mesh->name = name;
-    if (model)
+    CaptureReadback* readback = nullptr;
+    u32 busy = 0;
+
+    for (auto& r : captureReadbacks)
     {
-        mesh->idx = model->meshes.size();
+        if (r.busy)
+            busy++;
+        else if (!readback || (r.width == texture->width && r.height == texture->height && r.format == texture->format))
+            readback = &r;
     }
 
+    // Readbacks already handed to the writer still hold their pixels until they're encoded
+    if (busy + captureWriter.pending >= MAX_CAPTURE_READBACKS)
     {
-        const tmgl::Memory* mem = tmgl::alloc(vertS);
+        std::cout << "Capture readbacks are all in flight, dropping " << request.path << std::endl;
+        return;
+    }
 
-        bx::memCopy(mem->data, data, vertS);
+    if (!readback)
+        readback = &captureReadbacks.emplace_back();
 
-        tmgl::VertexBufferHandle vbh = createVertexBuffer(mem, layout);
-        mesh->vbh = vbh;
-        mesh->vertexCount = vertCount;
+    if (readback->width != texture->width || readback->height != texture->height || readback->format != texture->format)
+    {
+        if (isValid(readback->texture))
+            destroy(readback->texture);
+
+        readback->texture = tmgl::createTexture2D(texture->width, texture->height, false, 1, texture->format,
+                                                  TMGL_TEXTURE_BLIT_DST | TMGL_TEXTURE_READ_BACK);
+        readback->width = texture->width;
+        readback->height = texture->height;
+        readback->format = texture->format;
     }
 
+    var& write = readback->write;
+    write.kind = getCaptureKind(request.path);
+    write.path = request.path;
+    write.width = texture->width;
+    write.height = texture->height;
+    write.pitch = texture->width * bytesPerPixel;
+    write.format = texture->format;
+    write.yflip = false;
+    write.data.resize(write.pitch * write.height);
+
+    tmgl::blit(getCaptureView(), readback->texture, 0, 0, texture->handle);
+    readback->readyFrame = tmgl::readTexture(readback->texture, write.data.data());
+    readback->busy = true;
+}
+
+// After the cameras have recorded, before the draw lists are cleared
+void processCaptures()
+{
+    var noop = tmgl::getRendererType() == tmgl::RendererType::Noop;
+
+    // The backbuffer streams through CaptureCallback::captureFrame instead
+    if (capturing && (captureTarget || noop))
     {
-        const tmgl::Memory* mem = tmgl::alloc(indeS);
+        char name[32];
+        snprintf(name, sizeof(name), "frame_%06u.raw", captureFrameIndex++);
 
-        bx::memCopy(mem->data, indices, indeS);
+        captureRequests.push_back({captureDirectory + "/" + name, captureTarget});
+    }
 
-        tmgl::IndexBufferHandle ibh = createIndexBuffer(mem);
+    for (const auto& request : captureRequests)
+    {
+        if (noop)
+        {
+            var description = describeFrame();
 
-        mesh->ibh = ibh;
-        mesh->indexCount = triSize;
+            CaptureWrite write;
+            write.kind = CaptureWrite::Text;
+            write.path = std::filesystem::path(request.path).replace_extension(".txt").string();
+            write.data.assign(description.begin(), description.end());
+
+            captureWriter.Push(std::move(write));
+        }
+        else if (request.target)
+        {
+            requestReadback(request);
+        }
+        else if (captureWriter.pending < MAX_CAPTURE_READBACKS)
+        {
+            tmgl::requestScreenShot(TMGL_INVALID_HANDLE, request.path.c_str());
+        }
+        else
+        {
+            std::cout << "Capture writes are all in flight, dropping " << request.path << std::endl;
+        }
     }
 
-    ResMgr->loaded_meshes[name] = mesh;
+    captureRequests.clear();
+}
 
-    return mesh;
+// After tmgl::frame(), hands finished readbacks to the writer
+void pollCaptures()
+{
+    for (auto& readback : captureReadbacks)
+    {
+        if (readback.busy && frameTime >= readback.readyFrame)
+        {
+            captureWriter.Push(std::move(readback.write));
+            readback.write = CaptureWrite();
+            readback.busy = false;
+        }
+    }
 }
 
-void tmt::render::pushDrawCall(DrawCall d)
+void tmt::render::takeScreenshot(string path, RenderTexture* target)
 {
+    if (path == "null")
+    {
+        path = "Screenshot.png";
+    }
 
-    u32 l1, l2;
+    captureRequests.push_back({path, target});
+}
 
-    math::unpackU64ToU32(d.layer, l1, l2);
+void tmt::render::beginCapture(string directory, RenderTexture* target)
+{
+    std::filesystem::create_directories(directory);
 
-    d.renderLayer = l2;
-    d.layer = l1;
+    captureDirectory = directory;
+    captureTarget = target;
+    captureFrameIndex = 0;
+    capturing = true;
 
-    drawCalls.push_back(d);
+    // The renderer hands every backbuffer frame to the callback, pixels are never read back on our side
+    if (!target && tmgl::getRendererType() != tmgl::RendererType::Noop)
+    {
+        tmgl::reset(renderer->windowWidth, renderer->windowHeight, TMGL_RESET_CAPTURE);
+    }
 }
 
-void tmt::render::takeScreenshot(string path)
+void tmt::render::endCapture()
 {
-    if (path == "null")
+    if (capturing && !captureTarget && tmgl::getRendererType() != tmgl::RendererType::Noop)
     {
-        path = "Screenshot.png";
+        tmgl::reset(renderer->windowWidth, renderer->windowHeight, TMGL_RESET_NONE);
     }
+
+    capturing = false;
 }
 
 void tmt::render::pushLight(light::Light* light)
@@ -3487,6 +7850,7 @@ RendererInfo* tmt::render::init(int width, int height)
 #endif
 
     tmgl::Init init;
+    init.callback = &captureCallback;
 
 
 #ifdef WIN32
@@ -3550,8 +7914,24 @@ RendererInfo* tmt::render::init(int width, int height)
     return renderer;
 }
 
+RendererInfo* tmt::render::initHeadless()
+{
+    renderer = new RendererInfo();
+    renderer->window = nullptr;
+    renderer->windowWidth = 0;
+    renderer->windowHeight = 0;
+    renderer->useImgui = false;
+    renderer->headless = true;
+    renderer->meshCpuData = mc_keepAll;
+
+    return renderer;
+}
+
 void tmt::render::update()
 {
+    // Palettes have to be ready before anything is recorded
+    evaluateAnimators();
+    skinMeshCaches();
 
     u8 btn = ((input::Mouse::GetMouseButton(input::Mouse::Left, true) == input::Mouse::Hold) ? IMGUI_MBUT_LEFT : 0) |
         ((input::Mouse::GetMouseButton(input::Mouse::Right, true) == input::Mouse::Hold) ? IMGUI_MBUT_RIGHT : 0) |
@@ -3589,26 +7969,49 @@ void tmt::render::update()
         subHandlesLoaded = true;
     }
 
-    std::sort(drawCalls.begin(), drawCalls.end(),
-              [](const DrawCall& a, const DrawCall& b) { return a.layer < b.layer; });
+    for (auto arena : geometryArenas)
+    {
+        if (arena->NeedsDefragment())
+            arena->Defragment();
+    }
+
+    debug::Gizmos::Flush();
+    flushTransientGeometry();
+
+    flushRenderProxies();
 
-    for (auto cameraCache : renderer->cameraCache)
+    drawList.Sort();
+    buildDrawBuckets();
+
+    var& cameras = renderer->cameraCache;
+
+    for (auto camera : cameras)
     {
-        cameraCache->redraw();
+        camera->prepare();
     }
 
-    for (auto drawCall : drawCalls)
+    // Visible cells and occlusion buffer per distinct view, built before any camera tests against them
+    job::parallelFor(cullResultCount, [](u32 i) { buildCullResult(cullResults[i]); });
+
+    // Recording only reads this frame's lists, submission stays on the thread that owns the context
+    job::parallelFor(cameras.size(), [&cameras](u32 i) { cameras[i]->record(); });
+
+    for (auto camera : cameras)
     {
-        drawCall.clean();
+        camera->execute();
     }
 
-    drawCalls.clear();
+    processCaptures();
+
+    drawList.Clear();
 
     debugCalls.clear();
     debugFuncs.clear();
     lights.clear();
 
     frameTime = tmgl::frame();
+    advanceTransientGeometry();
+    pollCaptures();
     lastKey = -1;
 
     glfwPollEvents();
@@ -3625,13 +8028,17 @@ void tmt::render::update()
 
 }
 
-void DrawCall::clean()
-{
-    delete[] overrides;
-}
-
 void tmt::render::shutdown()
 {
+    // Readbacks still in flight are lost, anything already read is written out
+    captureWriter.Stop();
+
+    for (auto& readback : captureReadbacks)
+    {
+        if (isValid(readback.texture))
+            destroy(readback.texture);
+    }
+
     tmgl::shutdown();
     glfwTerminate();
 }
@@ -5,6 +5,7 @@
 
 #include "utils.hpp"
 #include "Fs/fs.hpp"
+#include "Math/math.hpp"
 #include "Obj/obj.hpp"
 
 
@@ -50,6 +51,20 @@ namespace tmt::render
     struct Camera;
     struct Color;
     struct DrawCall;
+    struct DrawMaterial;
+    struct DrawList;
+    struct RenderProxy;
+    struct GeometryArena;
+    struct CellGraph;
+
+    // What a mesh keeps in system memory once it is on the GPU
+    enum MeshCpuData
+    {
+        mc_keepAll,
+        mc_keepPositions, // positions and indices, enough for mesh colliders and picking
+        mc_keepQuantized, // 16-bit positions inside the mesh bounds and indices
+        mc_keepNone
+    };
 
     struct RendererInfo
     {
@@ -58,6 +73,17 @@ namespace tmt::render
         int windowWidth, windowHeight;
         bool useImgui = true;
         bool usePosAnim = true;
+        // Split meshes with more than 65536 vertices into 16-bit chunks instead of using 32-bit indices
+        bool splitLargeMeshes = false;
+        // Applied by createMesh after upload, meshes can also call ReleaseCpuData themselves
+        MeshCpuData meshCpuData = mc_keepAll;
+        // Test draws against the occluder proxies (RenderProxy::occluder) before submitting them
+        bool occlusionCulling = true;
+        // Portal visibility for indoor scenes, usually SceneDescription::cells. Proxies registered to
+        // cells the camera can't see through any portal are skipped, null disables it
+        CellGraph* cellGraph = nullptr;
+        // Set by initHeadless, meshes keep their CPU data and nothing is uploaded
+        bool headless = false;
         std::vector<RenderTexture*> viewCache;
         std::vector<Camera*> cameraCache;
 
@@ -74,6 +100,7 @@ namespace tmt::render
     {
         tmgl::UniformHandle handle = TMGL_INVALID_HANDLE;
         string name;
+        StringId id;
         tmgl::UniformType::Enum type = tmgl::UniformType::Count;
 
         glm::vec4 v4 = glm::vec4(-1000);
@@ -96,22 +123,51 @@ namespace tmt::render
             Compute
         } type;
 
+        // Keywords a shader source can be permuted on, must match scripts/buildShader.py
+        enum Feature : u32
+        {
+            Skinned         = BIT(0),
+            Instanced       = BIT(1),
+            Lit             = BIT(2),
+            AlphaTest       = BIT(3),
+            Quantized       = BIT(4),
+            VertexAnimation = BIT(5)
+        };
+
         tmgl::ShaderHandle handle;
         std::vector<ShaderUniform*> uniforms;
         std::vector<string> texSets;
         string name;
 
-        ShaderUniform* GetUniform(string name, bool force = false);
+        // Keywords this variant was compiled with
+        u32 features = 0;
+        // Keywords the source declares, 0 for shaders built without variants
+        u32 declaredFeatures = 0;
+
+        ShaderUniform* GetUniform(StringId id, bool force = false);
+        // Forced uniforms keep the caller's text as their name, release ids only print as a hash
+        ShaderUniform* GetUniform(const char* name, bool force = false);
+        ShaderUniform* GetUniform(const string& name, bool force = false);
 
         void Reload();
+        // Recreates the handle from an already read binary, used by hot reload
+        void Reload(const std::vector<u8>& binary);
+
+        // Compiled binary for the current renderer, empty when the renderer has no shader directory
+        string GetBinaryPath() const;
 
         ~SubShader();
 
-        static SubShader* CreateSubShader(string name, ShaderType type);
+        // Features the source does not declare are dropped, so this falls back to the base shader
+        static SubShader* CreateSubShader(string name, ShaderType type, u32 features = 0);
+
+        static string GetVariantName(const string& name, u32 features);
 
     private:
         bool isLoaded = false;
 
+        static string GetPath(const string& name);
+
         friend fs::ResourceManager;
         SubShader(string name, ShaderType type);
     };
@@ -121,12 +177,24 @@ namespace tmt::render
         tmgl::ProgramHandle program;
         std::vector<SubShader*> subShaders;
         string name;
+        u16 sortId = 0;
+
+        // Keywords compiled into this program, all bits for shaders built without variants
+        u32 features = -1;
+        u32 declaredFeatures = 0;
 
         void Push(int viewId = 0, MaterialOverride* overrides = nullptr, size_t overrideCount = 0);
 
+        bool HasFeature(u32 feature) const { return features & feature; }
+
+        // Returns the permutation compiled with the requested keywords, or this shader if it has none
+        Shader* GetVariant(u32 features);
+
         ~Shader();
 
         void Reload();
+        // Recreates the program from the sub shaders' current handles
+        void Relink();
 
         static Shader* CreateShader(ShaderInitInfo info);
         static Shader* CreateShader(string vertex, string fragment);
@@ -134,6 +202,9 @@ namespace tmt::render
     private:
         friend fs::ResourceManager;
 
+        Shader* base = nullptr;
+        std::map<u32, Shader*> variants;
+
         Shader(ShaderInitInfo info);
     };
 
@@ -161,6 +232,8 @@ namespace tmt::render
     struct MaterialOverride
     {
         std::string name;
+        // Matched against ShaderUniform::id when the material is pushed
+        StringId id;
         glm::vec4 v4 = glm::vec4(0);
         glm::mat3 m3 = glm::mat3(1.0);
         glm::mat4 m4 = glm::mat4(1.0);
@@ -214,6 +287,12 @@ namespace tmt::render
             None
         } matrixMode = ViewProj;
 
+        enum Primitive : u64
+        {
+            Triangles = 0,
+            Lines     = TMGL_STATE_PT_LINES
+        } primitive = Triangles;
+
 #ifdef TMT_EDITOR
 
         inline static std::map<DepthTest, const char*> depthNames = {
@@ -254,7 +333,13 @@ namespace tmt::render
         std::vector<MaterialOverride> overrides;
         string name = "Material";
 
-        MaterialOverride* GetUniform(string name, bool force = true);
+        // SubShader::Feature bits this material wants, mesh features are added per draw
+        u32 features = SubShader::Lit;
+
+        MaterialOverride* GetUniform(StringId id, bool force = true);
+        // Forced overrides keep the caller's text as their name, release ids only print as a hash
+        MaterialOverride* GetUniform(const char* name, bool force = true);
+        MaterialOverride* GetUniform(const string& name, bool force = true);
         u64 GetMaterialState();
 
         Material(Shader* shader = nullptr);
@@ -267,7 +352,8 @@ namespace tmt::render
     struct MaterialDescription
     {
         string Name;
-        std::map<string, string> Textures;
+        // Sampler uniform -> texture name
+        std::unordered_map<StringId, string> Textures;
     };
 
     enum MeshOrigin
@@ -283,25 +369,142 @@ namespace tmt::render
         std::vector<tmgl::DynamicVertexBufferHandle> vertexBuffers;
         tmgl::DynamicIndexBufferHandle indexBuffer;
         size_t vertexCount, indexCount;
-        Vertex* vertices;
-        u16* indices;
+        Vertex* vertices = nullptr;
+        // u16 or u32 depending on indexSize, use GetIndex to read it
+        void* indices = nullptr;
+        u8 indexSize = sizeof(u16);
         MeshOrigin origin;
 
+        // Index ranges submitted separately when a large mesh was split into 16-bit chunks.
+        // Chunk indices are relative to baseVertex
+        struct Chunk
+        {
+            u32 baseVertex, vertexCount;
+            u32 firstIndex, indexCount;
+        };
+
+        std::vector<Chunk> chunks;
+
+        // Set when the mesh lives in a shared arena instead of owning vbh/ibh
+        GeometryArena* arena = nullptr;
+        // False when vbh/ibh belong to someone else, like a Font's glyph quads, the destructor leaves them alone
+        bool ownsBuffers = true;
+        u32 baseVertex = 0, firstIndex = 0;
+
+        // Compact copies left behind by ReleaseCpuData, read them through GetPosition
+        glm::vec3* positions = nullptr;
+        u16* quantizedPositions = nullptr;
+
         std::vector<string> bones;
         string name;
 
         Model* model = nullptr;
         int idx = -1;
 
+        u32 handle = -1;
+
+        // Object space bounds, left invalid for meshes created without CPU vertices
+        math::AABB bounds;
+
         ~Mesh();
 
-        void use();
+        void use(u32 chunk = 0);
+
+        u32 GetIndex(size_t i) const;
+        glm::vec3 GetPosition(u32 vertex) const;
+
+        // Frees the full vertex array (and indices for KeepNone). Arena ranges of released
+        // meshes can no longer be moved by defragmentation
+        void ReleaseCpuData(MeshCpuData keep);
+        u32 GetChunkCount() const { return chunks.empty() ? 1 : chunks.size(); }
 
         virtual void draw(glm::mat4 t, Material* material, glm::vec3 spos, u32 layer = 0, u32 renderLayer = 0,
                           std::vector<glm::mat4> anims = std::vector<glm::mat4>());
+
+        // One draw for every transform through the material's Instanced variant. parameters holds one vec4 per
+        // instance, read by the shader as i_data4
+        void drawInstanced(const std::vector<glm::mat4>& transforms, const std::vector<glm::vec4>& parameters,
+                           Material* material, u32 layer = 0, u32 renderLayer = 0);
     };
 
 
+    /**
+     * Shared vertex/index buffers for all 16-bit indexed meshes with the same vertex layout.
+     * Each mesh owns a base-vertex/first-index range, so draws from one arena bind the same buffers.
+     */
+    struct GeometryArena
+    {
+        struct Range
+        {
+            u32 offset, count;
+        };
+
+        // First-fit offset allocator, free ranges are kept sorted by offset and coalesced
+        struct RangeAllocator
+        {
+            u32 capacity = 0;
+            std::vector<Range> freeRanges;
+
+            u32 Allocate(u32 count);
+            void Free(u32 offset, u32 count);
+            void Grow(u32 newCapacity);
+        };
+
+        tmgl::VertexLayout layout;
+        tmgl::DynamicVertexBufferHandle vertexBuffer;
+        tmgl::DynamicIndexBufferHandle indexBuffer;
+
+        RangeAllocator vertices, indices;
+        std::vector<Mesh*> meshes;
+
+        void Allocate(Mesh* mesh, const void* vertexData, const u16* indexData);
+        void Free(Mesh* mesh);
+
+        // Slides ranges down over freed holes, meshes without CPU copies stay where they are
+        void Defragment();
+        bool NeedsDefragment() const;
+
+        static GeometryArena* Get(const tmgl::VertexLayout& layout);
+
+    private:
+        // Holes the last Defragment couldn't close
+        size_t pinnedVertexHoles = 0, pinnedIndexHoles = 0;
+
+        GeometryArena(const tmgl::VertexLayout& layout);
+    };
+
+    /**
+     * A skinned mesh's vertices skinned on the CPU with one palette, for poses that are frozen or change
+     * every few seconds (corpses, statues, paused characters). The copy lives in the source's arena without
+     * bone data, so it is drawn through the static shader variant and sorts next to static geometry instead
+     * of uploading a palette every draw. Skinning runs across the job workers in render::update.
+     */
+    struct SkinnedMeshCache
+    {
+        Mesh* source = nullptr;
+
+        // Needs the source's CPU vertices and 16-bit indices, other meshes keep using the palette
+        static bool CanCache(const Mesh* mesh);
+
+        SkinnedMeshCache(Mesh* source);
+        ~SkinnedMeshCache();
+
+        // Queues a reskin unless palette matches the last one skinned, returns whether one was queued.
+        // Cheap to call every frame with the skeleton's palette, unchanged poses cost a compare
+        bool SetPalette(const std::vector<glm::mat4>& palette);
+
+        // Static mesh holding the skinned vertices, draw it without animation matrices
+        Mesh* GetMesh() const { return mesh; }
+
+    private:
+        Mesh* mesh = nullptr;
+        std::vector<glm::mat4> palette;
+        std::vector<Vertex> skinned;
+        bool queued = false;
+
+        friend void skinMeshCaches();
+    };
+
     struct BoneInfo
     {
         int id;
@@ -316,30 +519,63 @@ namespace tmt::render
         float duration;
         int ticksPerSecond;
 
+        // A channel's keys, as a slice of the clip's key arrays
+        struct KeyRange
+        {
+            u32 first = 0, count = 0;
+        };
+
         struct NodeChannel
         {
             string name;
             int id = -1;
 
-            template <typename T>
-            struct NodeKey
-            {
-                float time;
-                T value;
-            };
+            KeyRange positions, rotations, scales;
 
-            std::vector<NodeKey<glm::vec3>*> positions;
-            std::vector<NodeKey<glm::quat>*> rotations;
-            std::vector<NodeKey<glm::vec3>*> scales;
+            // Dequantizes compressed translations and scales, value = min + packed * step
+            glm::vec3 positionMin{0}, positionStep{0};
+            glm::vec3 scaleMin{0}, scaleStep{0};
+        };
 
+        struct CompressionSettings
+        {
+            // Largest distance a point may move from its uncompressed place at a key's time, in bone space
+            // units. Includes the 16-bit quantization. A track whose steps alone are coarser than this, like a
+            // translation spanning more than about 65535 * maxError, can only be held to half a step at its keys
+            float maxError = 0.0001f;
+            // Rotation and scale error are measured at this distance from the joint, about a bone's length
+            float boneLength = 1.0f;
         };
 
-        std::vector<NodeChannel*> nodeChannels;
+        // Every channel's keys packed back to back, times apart from values so seeking only touches times
+        std::vector<float> positionTimes, rotationTimes, scaleTimes;
+        std::vector<glm::vec3> positionValues, scaleValues;
+        std::vector<glm::quat> rotationValues;
+
+        // Replace the value arrays after Compress, three u16 per key. Rotations are smallest three,
+        // 15 bits per component with the dropped component's index in the top bits of the first two.
+        std::vector<u16> packedPositions, packedRotations, packedScales;
+        bool compressed = false;
+
+        std::vector<NodeChannel> nodeChannels;
 
         Animation(fs::BinaryReader* reader);
         Animation() = default;
 
-        static std::vector<Animation*> LoadAnimations(string path);
+        static std::vector<Animation*> LoadAnimations(string path, const CompressionSettings* compression = nullptr);
+
+        // Segment of range holding time, starting from cursor. Playback moves forward a key or two per frame,
+        // so that is checked first and anything further, or backwards, falls back to a binary search.
+        static u32 SeekKey(const std::vector<float>& times, KeyRange range, float time, u32 cursor);
+
+        // key is relative to the channel's range, works on compressed and uncompressed clips
+        glm::vec3 GetPosition(const NodeChannel& channel, u32 key) const;
+        glm::quat GetRotation(const NodeChannel& channel, u32 key) const;
+        glm::vec3 GetScale(const NodeChannel& channel, u32 key) const;
+
+        // Drops keys interpolation rebuilds within settings.maxError, collapses constant channels to one key
+        // and quantizes what is left. Meant for import time, the float values are freed afterwards.
+        void Compress(const CompressionSettings& settings = {});
 
         ~Animation();
 
@@ -376,13 +612,32 @@ namespace tmt::render
         };
 
         std::vector<Bone*> bones;
-        std::map<string, BoneInfo> boneInfoMap;
+        std::unordered_map<StringId, BoneInfo> boneInfoMap;
         string rootName;
         glm::mat4 inverseTransform;
 
+        // Joints compiled from the bones, every parent comes before its children so poses resolve in one
+        // forward pass. Indexed by joint, parents is -1 for roots and paletteIndices -1 for unweighted bones.
+        std::vector<Bone*> joints;
+        std::vector<StringId> jointNames;
+        std::vector<int> parents;
+        std::vector<int> paletteIndices;
+        std::vector<glm::mat4> offsets;
+        // Joints between each joint and its deepest descendant, 0 for leaves like finger tips
+        std::vector<u8> jointHeights;
+
         Bone* GetBone(string name);
         Bone* GetParent(Bone* b);
 
+        // -1 when the skeleton has no bone with that name
+        int FindJoint(StringId name) const;
+
+        // Per joint weights, 1 for the named joints and everything under them and 0 elsewhere
+        std::vector<float> CreateMask(const std::vector<string>& roots) const;
+
+        // Flattens bones and their children into the joint arrays, loaders call it once bones are final
+        void Compile();
+
         void CalculateBoneIds();
 
         Skeleton(fs::BinaryReader* reader);
@@ -419,7 +674,49 @@ namespace tmt::render
     private:
         void LoadFromAiScene(const aiScene* scene, SceneDescription* description = nullptr);
 
+        // Deletes its meshes, materials, animations and skeleton. Textures can be shared through
+        // loaded_textures, so they are left alone
         ~Model();
+
+        friend struct SceneDescription;
+    };
+
+    /**
+     * Rooms (cells) joined by portal quads. A camera inside a cell only sees the cells it can
+     * reach through portals in view, so proxies registered to any other cell are rejected
+     * without a bounds test.
+     */
+    struct CellGraph
+    {
+        struct Portal
+        {
+            u32 cells[2];
+            // Wound around the opening, in world space
+            glm::vec3 corners[4];
+        };
+
+        struct Cell
+        {
+            string name;
+            math::AABB bounds;
+            std::vector<u32> portals;
+        };
+
+        std::vector<Cell> cells;
+        std::vector<Portal> portals;
+
+        CellGraph() = default;
+        // Reads a TCEL section, the signature already consumed
+        CellGraph(fs::BinaryReader* reader);
+
+        void AddPortal(const Portal& portal);
+
+        // Smallest cell containing the point, -1 when it is outside every cell
+        u32 FindCell(const glm::vec3& point) const;
+
+        // Flood fills from the eye's cell, narrowing the frustum to each portal's clipped outline.
+        // visible is left empty when the eye is outside every cell, so nothing gets rejected.
+        void GatherVisible(const glm::vec3& eye, const math::Frustum& frustum, std::vector<u8>& visible) const;
     };
 
     struct SceneDescription
@@ -461,6 +758,8 @@ namespace tmt::render
         string name, path;
         std::vector<Model*> models;
         Node* rootNode = nullptr;
+        // From the optional TCEL section of a .tmdl, null when the scene has no cells
+        CellGraph* cells = nullptr;
 
         Model* GetModel(string name);
         Mesh* GetMesh(int idx);
@@ -478,13 +777,20 @@ namespace tmt::render
         static SceneDescription* CreateSceneDescription(string path);
 
     private:
-        SceneDescription(string path);
+        // imported is an already read Assimp scene, hot reload imports off the main thread
+        SceneDescription(string path, const aiScene* imported = nullptr);
+
+        // Moves a freshly loaded copy of the file into this description and its models, so pointers to them,
+        // their meshes, animations and skeletons stay valid. fresh is left holding the old data
+        void ReloadFrom(SceneDescription* fresh);
     };
 
 
     struct BoneObject : obj::Object
     {
         BoneObject* copyBone = nullptr;
+        // Joint this attachment follows, -1 for bones that aren't driven by a skeleton
+        int joint = -1;
 
         BoneObject() = default;
         BoneObject(Skeleton::Bone* bone);
@@ -495,17 +801,49 @@ namespace tmt::render
 
         void Update() override;
 
-        Skeleton::Bone* bone;
+        Skeleton::Bone* bone = nullptr;
+    };
+
+    // Local joint transforms of one skeleton, indexed by its joints
+    struct Pose
+    {
+        std::vector<glm::vec3> positions, scales;
+        std::vector<glm::quat> rotations;
+        // Joint to skeleton space, filled by Resolve
+        std::vector<glm::mat4> modelTransforms;
+
+        // Sets every joint to the skeleton's rest transform
+        void Reset(const Skeleton* skeleton);
+
+        // One forward pass over the joints filling modelTransforms and the skinning palette
+        void Resolve(const Skeleton* skeleton, std::vector<glm::mat4>& palette);
+
+        // out = lerp(a, b, weights[joint]) with rotations nlerped, out may be a or b
+        static void Blend(const Pose& a, const Pose& b, const float* weights, Pose& out);
+
+        // Applies the difference between additive and reference on top of this pose, scaled per joint
+        void Add(const Pose& additive, const Pose& reference, const float* weights);
     };
 
     struct SkeletonObject : obj::Object
     {
+        // Attachment points, the bones loaded with the scene plus any created on demand through GetBone
         std::vector<BoneObject*> bones;
 
+        // This instance's own palette, see GetPalette
         std::vector<glm::mat4> boneMatrices;
-        Animator* animator;
+        Animator* animator = nullptr;
 
-        Skeleton* skeleton;
+        Skeleton* skeleton = nullptr;
+
+        Pose pose;
+
+        // Palette to skin with this frame, the shared pose cache's when the animator got its pose from there
+        const std::vector<glm::mat4>& GetPalette() const;
+        const Pose& GetPose() const;
+
+        // Uses a pose owned by someone else until the next UpdatePalette, both must outlive the frame
+        void SharePose(const Pose* pose, const std::vector<glm::mat4>* palette);
 
         SkeletonObject() = default;
         SkeletonObject(Skeleton* skl);
@@ -516,11 +854,23 @@ namespace tmt::render
 
         void Load(SceneDescription::Node* node);
 
+        // Creates a BoneObject following the joint the first time a name is asked for
         BoneObject* GetBone(string name);
 
         bool IsSkeletonBone(BoneObject* bone);
 
-        void CalculateBoneTransform(const Skeleton::Bone* skeleBone, glm::mat4 parentTransform);
+        // Resets the pose to the skeleton's rest transforms
+        void ResetPose();
+
+        // Rebuilds boneMatrices from this instance's pose and stops sharing
+        void UpdatePalette();
+
+    private:
+        const Pose* sharedPose = nullptr;
+        const std::vector<glm::mat4>* sharedPalette = nullptr;
+
+        // Moves attachment bones to their joints
+        void UpdateAttachments();
     };
 
     struct Animator : obj::Object
@@ -528,15 +878,19 @@ namespace tmt::render
         std::vector<glm::mat4> pushBoneMatrices;
 
         Animator();
+        ~Animator();
 
         struct AnimationBone
         {
             Animation::NodeChannel* channel = nullptr;
             Animation* animation = nullptr;
-            glm::mat4 localTransform;
-            int boneId;
+            // Joint of the skeleton this channel drives, -1 when the skeleton doesn't have it
+            int joint = -1;
+
+            // Segment each channel sampled last, kept per instance so playback seeks incrementally
+            u32 positionCursor = 0, rotationCursor = 0, scaleCursor = 0;
 
-            glm::mat4 Update(float animationTime, Object* obj);
+            void Update(float animationTime, Pose& pose);
 
             int GetPositionIndex(float animationTime);
             int GetRotationIndex(float animationTime);
@@ -550,9 +904,28 @@ namespace tmt::render
             glm::vec3 InterpolateScaling(float animationTime);
         };
 
+        // A clip played over the base clip, in the order they were added
+        struct Layer
+        {
+            Animation* animation = nullptr;
+            float time = 0;
+            float weight = 1;
+            bool doLoop = true;
+
+            // Adds its motion relative to the clip's first frame instead of replacing the layers below
+            bool additive = false;
+
+            // Per joint weight from Skeleton::CreateMask, empty covers every joint
+            std::vector<float> mask;
+
+            std::vector<AnimationBone> bones;
+            Pose reference;
+        };
+
         SkeletonObject* skeleton = nullptr;
 
         std::vector<AnimationBone*> animationBones;
+        std::vector<Layer*> layers;
 
         AnimationBone* GetBone(string name);
 
@@ -560,14 +933,141 @@ namespace tmt::render
 
         bool doLoop = true;
 
+        // Samples per second of clip time to share poses at, 0 samples this animator on its own. Animators with
+        // the same skeleton, clip and quantized time share one pose from the cache, so crowds cost per unique pose.
+        u32 sharedPoseRate = 0;
+
+        // Picks how often the animator samples from the main camera each frame, frames in between blend
+        // toward the last sample
+        struct LodSettings
+        {
+            bool enabled = true;
+
+            // Camera distances past which the animator samples every 2nd and every 4th frame
+            float halfRateDistance = 20.0f;
+            float quarterRateDistance = 50.0f;
+
+            // Past this distance joints lower than reducedBoneHeight keep their last pose, 1 skips leaf joints
+            float reducedBoneDistance = 50.0f;
+            u8 reducedBoneHeight = 1;
+
+            // Sphere around the skeleton tested against the camera, stops sampling while it's outside
+            float boundsRadius = 2.0f;
+            bool pauseWhenInvisible = true;
+        } lod;
+
+        // Frames between samples picked last frame, 0 while paused
+        u32 GetUpdateInterval() const { return updateInterval; }
+
+        // Advances time and queues the animator, sampling happens later in Evaluate
         void Update() override;
 
+        // Samples the clip onto the skeleton's bones, or blends toward the last sample on frames the LOD skips,
+        // then rebuilds the palette. Touches nothing but this animator and its skeleton, so render::update runs
+        // every queued animator across the job workers.
+        void Evaluate();
+
         void LoadAnimationBones();
 
         void SetAnimation(Animation* animation);
 
+        // Switches to animation, blending out of the playing clip over duration seconds
+        void CrossFade(Animation* animation, float duration);
+
+        // maskRoots limits the layer to those bones and their children
+        Layer* AddLayer(Animation* animation, float weight = 1, bool additive = false,
+                        const std::vector<string>& maskRoots = {});
+        void RemoveLayer(Layer* layer);
+
         Animation* currentAnimation = nullptr;
 
+    private:
+        bool queued = false;
+
+        // Clip being faded out by CrossFade
+        Animation* fadeAnimation = nullptr;
+        std::vector<AnimationBone*> fadeBones;
+        float fadeTime = 0, fadeElapsed = 0, fadeDuration = 0;
+
+        // Scratch for Evaluate, kept to avoid allocating every frame
+        Pose blendPose;
+        std::vector<float> blendWeights;
+
+        u32 updateInterval = 1;
+        // Frames since the last sample, starts staggered so throttled animators don't all sample together
+        u32 framesSinceSample = 0;
+        bool reducedBones = false;
+        bool sampleDue = true;
+        // Last sample and the pose before it, frames in between blend from one to the other
+        Pose lodFrom, lodTo;
+
+        // Main thread, before the jobs run
+        void SelectLod(const math::Frustum* frustum, glm::vec3 eye);
+        void SamplePose();
+
+        static float AdvanceTime(const Animation* animation, float time, bool loop);
+
+        friend void evaluateAnimators();
+    };
+
+    /**
+     * A clip baked at a fixed rate into an RGBA32F texture, so crowds animate on the GPU without any per frame
+     * CPU animation. Bones mode stores the top three rows of every palette matrix, three texels per bone, and
+     * skins with the mesh's own bone ids. Vertices mode stores every vertex's skinned position and draws the
+     * mesh from CreateMesh, which has the vertex index in its first bone id. Each frame takes rowsPerFrame rows
+     * of width texels, frames follow each other down the texture.
+     */
+    struct VertexAnimationTexture
+    {
+        enum Mode : u8
+        {
+            Bones,
+            Vertices
+        };
+
+        Mode mode = Bones;
+        float frameRate = 30;
+        u32 frameCount = 0;
+        u32 texelsPerFrame = 0;
+        u32 width = 0, rowsPerFrame = 0;
+        std::vector<glm::vec4> texels;
+
+        // Created by CreateTexture, bakes that are only saved never touch the GPU
+        Texture* texture = nullptr;
+
+        // Samples animation on skeleton through the animators' channel sampling, Vertices mode also skins mesh
+        static VertexAnimationTexture* Bake(Skeleton* skeleton, Animation* animation, float frameRate, Mode mode,
+                                            const Mesh* mesh = nullptr);
+
+        // .tvat files written by Save
+        static VertexAnimationTexture* Load(string path);
+        void Save(string path) const;
+
+        u32 GetHeight() const { return frameCount * rowsPerFrame; }
+
+        // Read back the way the shader does, fractional frames lerp between the two nearest
+        glm::mat4 GetBoneMatrix(float frame, u32 bone) const;
+        glm::vec3 GetVertexPosition(float frame, u32 vertex) const;
+
+        // Largest distance between mesh's vertices posed from the texture and skinned from a fresh CPU pose.
+        // Checked samplesPerFrame times per baked frame, so the error between frames shows up too
+        float MeasureError(Skeleton* skeleton, Animation* animation, const Mesh* mesh, u32 samplesPerFrame = 4) const;
+
+        Texture* CreateTexture();
+
+        // Sets the texture and layout uniforms and the VertexAnimation feature, once per material
+        void Apply(Material* material);
+
+        // A crowd of mesh in one instanced draw, each instance playing from its own time in seconds
+        static void DrawInstances(Mesh* mesh, Material* material, const std::vector<glm::mat4>& transforms,
+                                  const std::vector<float>& times, u32 layer = 0, u32 renderLayer = 0);
+
+        // Playback time in seconds for the next single draws with material. Overrides are copied into every
+        // draw, so one material can be set and drawn several times
+        static void SetInstance(Material* material, float time);
+
+        // Copy of source with each vertex's index in its first bone id, for Vertices mode
+        static Mesh* CreateMesh(const Mesh* source);
     };
 
 
@@ -652,6 +1152,7 @@ namespace tmt::render
             unsigned int advance;
             Texture* handle;
             tmgl::VertexBufferHandle vbh;
+            Mesh* mesh;
         };
 
         std::map<char, Character> characters;
@@ -663,11 +1164,73 @@ namespace tmt::render
 
         float CalculateTextSize(string text, float fontSize, float forcedSpacing = FLT_MAX);
 
+        ~Font();
+
     private:
         Font(string path);
 
     };
 
+    /**
+     * Small CPU depth buffer for software occlusion culling. Occluder hulls are rasterized into it
+     * and draw bounds are tested against it before submission, without touching the GPU, so the
+     * result is the same on every run and available in headless tests.
+     */
+    struct OcclusionBuffer
+    {
+        static constexpr u32 Width = 256;
+        static constexpr u32 Height = 128;
+
+        // Clears to the far plane and sets the matrix used by the following calls
+        void Clear(const glm::mat4& viewProj);
+
+        // World space, triangles crossing the near plane are skipped since they can only shrink the result
+        void DrawTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c);
+        // Needs the mesh's CPU positions and indices, see MeshCpuData
+        void DrawMesh(const Mesh* mesh, const glm::mat4& transform);
+
+        // True when every pixel the box touches already holds something in front of the box
+        bool IsOccluded(const math::AABB& bounds) const;
+
+        u32 GetTriangleCount() const;
+        const float* GetDepth() const;
+
+    private:
+        glm::mat4 viewProj = glm::mat4(1);
+        std::vector<float> depth;
+        u32 triangleCount = 0;
+    };
+
+    struct CullStats
+    {
+        u32 submitted = 0;
+        u32 frustumCulled = 0;
+        u32 cellCulled = 0;
+        u32 occlusionCulled = 0;
+        u32 occluderTriangles = 0;
+    };
+
+    /**
+     * Draws a camera recorded for the frame. Recording only reads the frame's draw lists,
+     * so it can run on a worker; the entries are then submitted on the main thread.
+     */
+    struct CameraCommands
+    {
+        struct Entry
+        {
+            const DrawCall* call;
+            DrawList* list;
+        };
+
+        glm::mat4 view, projection, orthoProjection;
+        glm::vec4 viewPos;
+
+        u32 cullResult = -1;
+        std::vector<Entry> entries;
+
+        CullStats stats;
+    };
+
     struct Camera
     {
         glm::vec3 position = {0, 0, 0};
@@ -696,14 +1259,28 @@ namespace tmt::render
         glm::vec3 GetFront();
         glm::vec3 GetUp();
 
+        // Frame submission runs in three steps so cameras can record in parallel:
+        // prepare (main thread), record (any thread), execute (main thread, camera order)
+        void prepare();
+        void record();
+        void execute();
+
         void redraw();
 
+        // Counters from the last record()
+        const CullStats& GetCullStats() const;
+        const CameraCommands& GetCommands() const;
+
         static Camera* GetMainCamera();
 
     private:
         friend obj::CameraObject;
         friend obj::Scene;
 
+        void submit(const DrawCall& call, DrawList& list);
+
+        CameraCommands commands;
+
         Camera();
         ~Camera();
     };
@@ -777,33 +1354,124 @@ namespace tmt::render
 
     using MatrixArray = std::vector<float>;
 
+    /**
+     * Compact render packet. Everything heavy (matrices, bone palettes, uniform overrides)
+     * lives in the owning DrawList and is referenced by index, so sorting only moves 48 bytes.
+     */
     struct DrawCall
     {
-        u64 state;
-        u64 layer = 0;
+        // Callers pack (sort layer, render layer) here like Mesh::draw does, pushDrawCall
+        // splits it and rebuilds the key as sort layer | shader | mesh
+        u64 sortKey = 0;
+        u64 state = 0;
+
+        u32 renderLayer = 0;
+
+        u32 mesh = -1;
+        u32 material = -1;
+        u32 transform = -1;
+        u32 palette = -1;
+        // Instance batch of the list, the call then ignores transform when the program is Instanced
+        u32 instances = -1;
+
+        MaterialState::MatrixMode matrixMode = MaterialState::ViewProj;
+        bool visible = true;
+    };
 
-        u32 renderLayer;
+    struct DrawMaterial
+    {
+        Shader* program = nullptr;
 
-        MaterialOverride* overrides;
-        size_t overrideCt = 0;
+        // Retained draws read the material live, immediate draws snapshot into the list
+        Material* material = nullptr;
+        u32 overrideOffset = 0, overrideCount = 0;
+    };
 
-        Mesh* mesh;
+    struct DrawList
+    {
+        // Per instance transform columns then parameters, i_data0 to i_data4 in the shader
+        struct InstanceBatch
+        {
+            std::vector<glm::vec4> data;
+            u32 count = 0;
+            math::AABB bounds;
+        };
 
-        tmgl::VertexBufferHandle vbh;
-        tmgl::IndexBufferHandle ibh;
+        std::vector<DrawCall> calls;
+
+        std::vector<glm::mat4> transforms;
+        std::vector<DrawMaterial> materials;
+        std::vector<MaterialOverride> overrides;
+        std::vector<std::vector<glm::mat4>> palettes;
+        u32 paletteCount = 0;
+        std::vector<InstanceBatch> instanceBatches;
+        u32 instanceBatchCount = 0;
+
+        u32 PushTransform(const glm::mat4& transform);
+        u32 PushMaterial(Material* material, Shader* program);
+        u32 PushPalette(const std::vector<glm::mat4>& palette);
+        // bounds is every instance's bounds, culled as one
+        u32 PushInstances(const std::vector<glm::mat4>& transforms, const std::vector<glm::vec4>& parameters,
+                          const math::AABB& bounds);
+
+        MaterialOverride* GetOverrides(const DrawMaterial& material);
+        size_t GetOverrideCount(const DrawMaterial& material);
+
+        void Sort();
+        void Clear();
+    };
+
+    /**
+     * Retained draw for an object whose mesh and material outlive a single frame.
+     * The packet is only rebuilt when the proxy is marked dirty, so static
+     * objects cost nothing per frame beyond submission.
+     */
+    struct RenderProxy
+    {
+        enum DirtyFlags : u8
+        {
+            DirtyTransform = BIT(0),
+            DirtyMaterial  = BIT(1),
+            DirtyLayer     = BIT(2),
+            DirtyAll       = DirtyTransform | DirtyMaterial | DirtyLayer
+        };
+
+        u32 id = -1;
+
+        Mesh* mesh = nullptr;
+        Material* material = nullptr;
+
+        void SetTransform(const glm::mat4& transform);
+        // Follows a transform in the global transformHierarchy, picking up its world matrix on frames it
+        // changed. INVALID_HANDLE goes back to SetTransform
+        void SetTransform(math::TransformHierarchy::Handle transform);
+        void SetMaterial(Material* material);
+        void SetLayers(u32 layer, u32 renderLayer);
+        void SetAnimationMatrices(const std::vector<glm::mat4>& anims);
+        void SetVisible(bool visible);
+
+        // Call after editing the material's state in place, uniform values are read live
+        void MarkDirty(u8 flags = DirtyMaterial);
+
+        DrawCall& GetDrawCall();
 
-        u32 vertexCount, indexCount;
+        u32 layer = 0, renderLayer = 0;
 
-        glm::vec3 sortedPosition = glm::vec3(0);
-        glm::mat4 transformMatrix;
-        std::vector<glm::mat4> animationMatrices;
-        //float animationMatrices[4][4][MAX_BONE_MATRICES];
-        int matrixCount = 0;
-        Shader* program;
-        MaterialState::MatrixMode matrixMode;
+        // World space bounds, refreshed with the transform when the proxy is flushed
+        math::AABB bounds;
 
-        float getDistance(Camera* cam);
-        void clean();
+        // Index into RendererInfo::cellGraph, -1 for proxies drawn from every cell
+        u32 cell = -1;
+
+        math::TransformHierarchy::Handle transform = math::TransformHierarchy::INVALID_HANDLE;
+
+        // Simplified hull drawn into the occlusion buffer with the proxy's transform, usually the
+        // walls of a room or a building's box. It has to stay inside the visible mesh, and needs
+        // CPU positions (see MeshCpuData). Leave null for proxies that don't hide anything.
+        Mesh* occluder = nullptr;
+
+        u8 dirty = DirtyAll;
+        bool alive = false;
     };
 
 
@@ -812,14 +1480,70 @@ namespace tmt::render
     Mesh* createMesh(Vertex* data, u16* indices, u32 vertSize, u32 triSize, tmgl::VertexLayout pcvDecl,
                      Model* model = nullptr, string name = "none");
 
-    void pushDrawCall(DrawCall d);
+    // Stores 16-bit indices whenever every index fits, otherwise 32-bit or 16-bit chunks
+    // depending on RendererInfo::splitLargeMeshes
+    Mesh* createMesh(Vertex* data, u32* indices, u32 vertSize, u32 triSize, tmgl::VertexLayout pcvDecl,
+                     Model* model = nullptr, string name = "none");
+
+    /**
+     * Writable geometry that is only valid for the current frame. Indices are relative to the
+     * first vertex of the allocation, draw it through mesh like any other mesh.
+     */
+    struct TransientGeometry
+    {
+        std::span<u8> vertices;
+        std::span<u16> indices;
+        Mesh* mesh = nullptr;
+
+        bool IsValid() const { return mesh != nullptr; }
+
+        template <typename T>
+        std::span<T> GetVertices()
+        {
+            return {reinterpret_cast<T*>(vertices.data()), vertices.size() / sizeof(T)};
+        }
+    };
+
+    // Triple-buffered per-layout ring, returns an invalid allocation when this frame's slot is full
+    TransientGeometry allocateTransient(u32 vertexCount, u32 indexCount, tmgl::VertexLayout layout);
+
+    void pushDrawCall(DrawCall d, Material* material, const glm::mat4& transform,
+                      const std::vector<glm::mat4>& anims = std::vector<glm::mat4>());
 
-    void takeScreenshot(string path = "null");
+    // Falls back to one pushDrawCall per transform when the shader has no Instanced variant, parameters are
+    // lost then
+    void pushInstancedDrawCall(DrawCall d, Material* material, const std::vector<glm::mat4>& transforms,
+                               const std::vector<glm::vec4>& parameters);
+
+    u32 createRenderProxy(Mesh* mesh, Material* material, u32 layer = 0, u32 renderLayer = 0);
+    RenderProxy* getRenderProxy(u32 handle);
+    void destroyRenderProxy(u32 handle);
+
+    // Queued for the end of this frame. The pixels arrive a few frames later and are encoded on a background
+    // thread, so the frame never waits. No target captures the backbuffer. The extension picks the encoding:
+    // .png, .exr, .hdr or .raw (unencoded RGBA8). The Noop renderer writes a text description of the recorded
+    // draws next to path instead
+    void takeScreenshot(string path = "null", RenderTexture* target = nullptr);
+
+    // Captures every frame to directory/frame_NNNNNN.raw (.txt on Noop) until endCapture. The backbuffer is
+    // streamed by the renderer's capture callback. Frames that would exceed the in-flight readbacks and writes
+    // are dropped rather than waited for
+    void beginCapture(string directory, RenderTexture* target = nullptr);
+    void endCapture();
 
     void pushLight(light::Light* light);
 
+    // Evaluates every animator queued this frame across the job workers, called at the start of update
+    void evaluateAnimators();
+
+    // Reskins and uploads every SkinnedMeshCache whose palette changed, called after evaluateAnimators
+    void skinMeshCaches();
+
     RendererInfo* init(int width, int height);
 
+    // For tools that load models without a window or GPU, only CPU side data is built
+    RendererInfo* initHeadless();
+
     void update();
 
     void shutdown();
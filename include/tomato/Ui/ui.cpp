@@ -217,9 +217,8 @@ void SpriteObject::Update()
 
     var drawCall = render::DrawCall();
 
-    drawCall.layer = math::packU32ToU64(spriteLayer + 1, layer);
-    drawCall.mesh = spriteMesh;
-    drawCall.state = material->GetMaterialState();
+    drawCall.sortKey = math::packU32ToU64(spriteLayer + 1, layer);
+    drawCall.mesh = spriteMesh->handle;
     drawCall.matrixMode = render::MaterialState::OrthoProj;
 
     var og_pos = position;
@@ -278,22 +277,7 @@ void SpriteObject::Update()
 
     position = og_pos;
 
-    drawCall.transformMatrix = transform;
-
-    drawCall.program = material->shader;
-    if (material->overrides.size() > 0)
-    {
-        auto _overrides = new render::MaterialOverride[material->overrides.size()];
-
-        std::copy(material->overrides.begin(), material->overrides.end(), _overrides);
-
-        drawCall.overrides = _overrides;
-        drawCall.overrideCt = material->overrides.size();
-    }
-    else
-        drawCall.overrides = nullptr;
-
-    pushDrawCall(drawCall);
+    pushDrawCall(drawCall, material, transform);
 
     for (auto child : children)
     {
@@ -662,39 +646,20 @@ void TextObject::Update()
 
         var drawCall = render::DrawCall();
 
-        drawCall.layer = math::packU32ToU64(spriteLayer + 1, layer);
-        drawCall.state = material->GetMaterialState();
+        drawCall.sortKey = math::packU32ToU64(spriteLayer + 1, layer);
         drawCall.matrixMode = render::MaterialState::OrthoProj;
 
-        drawCall.transformMatrix = transform;
-        drawCall.transformMatrix = glm::scale(drawCall.transformMatrix, glm::vec3(-1, 1, 0));
-        drawCall.transformMatrix = translate(drawCall.transformMatrix, glm::vec3(xPos, yPos, 0));
-        drawCall.transformMatrix = glm::scale(drawCall.transformMatrix, glm::vec3(scl, scl, 0));
+        var glyphTransform = transform;
+        glyphTransform = glm::scale(glyphTransform, glm::vec3(-1, 1, 0));
+        glyphTransform = translate(glyphTransform, glm::vec3(xPos, yPos, 0));
+        glyphTransform = glm::scale(glyphTransform, glm::vec3(scl, scl, 0));
 
-        drawCall.vbh = c.vbh;
-        drawCall.ibh = font->ibh;
-
-        drawCall.vertexCount = 4;
-        drawCall.indexCount = 6;
+        drawCall.mesh = c.mesh->handle;
 
         var uni = material->GetUniform("s_fontTex", true);
         uni->tex = c.handle;
 
-        drawCall.program = material->shader;
-        if (material->overrides.size() > 0)
-        {
-
-            auto _overrides = new render::MaterialOverride[material->overrides.size()];
-
-            std::copy(material->overrides.begin(), material->overrides.end(), _overrides);
-
-            drawCall.overrides = _overrides;
-            drawCall.overrideCt = material->overrides.size();
-        }
-        else
-            drawCall.overrides = nullptr;
-
-        pushDrawCall(drawCall);
+        pushDrawCall(drawCall, material, glyphTransform);
 
         textIdx++;
     }
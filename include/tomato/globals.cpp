@@ -14,6 +14,10 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb/stb_image.h"
 
+// Enable STB_IMAGE_WRITE implementation (for screenshots and frame captures)
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "glfw/deps/stb_image_write.h"
+
 // Enable PAR_SHAPES implementation (for procedural geometry generation)
 #define PAR_SHAPES_IMPLEMENTATION
 #include "par_shapes.h"
@@ -38,7 +42,13 @@ void glfw_errorCallback(int error, const char* description)
 // Core engine state
 tmt::render::RendererInfo* renderer;
 std::vector<tmt::debug::DebugCall> debugCalls;
-std::vector<tmt::render::DrawCall> drawCalls;
+tmt::render::DrawList drawList;
+tmt::render::DrawList proxyDrawList;
+std::vector<tmt::render::RenderProxy> renderProxies;
+std::vector<u32> renderProxyIndices;
+std::vector<u32> dirtyRenderProxies;
+std::vector<tmt::render::Mesh*> meshTable;
+std::vector<tmt::render::GeometryArena*> geometryArenas;
 std::vector<tmt::light::Light*> lights;
 std::vector<std::function<void()>> debugFuncs;
 glm::vec2 mousep;
@@ -47,6 +57,7 @@ glm::vec2 mousescrl;
 int lastKey;
 tmt::render::Camera* mainCamera;
 tmt::obj::Scene* mainScene = nullptr;
+tmt::math::TransformHierarchy transformHierarchy;
 tmt::render::Shader* defaultShader;
 tmt::engine::Application* application;
 
@@ -497,14 +508,14 @@ btCollisionShape* ShapeFromInfo(tmt::physics::ColliderInitInfo i)
             auto indices = new int[i.mesh->indexCount];
             for (int j = 0; j < i.mesh->indexCount; ++j)
             {
-                indices[j] = i.mesh->indices[j];
+                indices[j] = i.mesh->GetIndex(j);
             }
 
             // Copy vertices (positions only) from mesh
             auto vertices = new glm::vec3[i.mesh->vertexCount];
             for (int j = 0; j < i.mesh->vertexCount; ++j)
             {
-                var vert = i.mesh->vertices[j].position;
+                var vert = i.mesh->GetPosition(j);
                 vertices[j] = vert;
             }
 
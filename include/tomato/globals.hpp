@@ -41,10 +41,17 @@ extern tmt::render::RendererInfo* renderer;              ///< Main renderer inst
 extern tmt::engine::Application* application;            ///< Current application instance
 extern tmt::obj::Scene* mainScene;                       ///< Main scene containing game objects
 extern tmt::obj::CameraObject* mainCameraObject;         ///< Main camera object for rendering
+extern tmt::math::TransformHierarchy transformHierarchy; ///< Local and cached world transforms of scene objects
 
 // === Rendering State ===
 extern std::vector<tmt::debug::DebugCall> debugCalls;    ///< Debug draw calls (lines, spheres, etc.)
-extern std::vector<tmt::render::DrawCall> drawCalls;     ///< Queued rendering draw calls
+extern tmt::render::DrawList drawList;                  ///< Immediate draw calls queued this frame
+extern tmt::render::DrawList proxyDrawList;             ///< Retained proxy draws, calls kept sorted by key
+extern std::vector<tmt::render::RenderProxy> renderProxies; ///< Proxy state indexed by handle
+extern std::vector<u32> renderProxyIndices;              ///< Proxy handle -> index into proxyDrawList.calls
+extern std::vector<tmt::render::Mesh*> meshTable;        ///< Mesh handle -> mesh
+extern std::vector<tmt::render::GeometryArena*> geometryArenas; ///< Shared mesh buffers, one per vertex layout
+extern std::vector<u32> dirtyRenderProxies;              ///< Handles of proxies changed since last frame
 extern std::vector<tmt::light::Light*> lights;           ///< Active lights in the scene
 extern tmt::render::Shader* defaultShader;               ///< Default shader used for rendering
 extern tmt::light::LightUniforms* lightUniforms;         ///< Uniform buffer for lighting data
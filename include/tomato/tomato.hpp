@@ -8,6 +8,7 @@
 #include ".//Engine/engine.hpp"
 #include ".//Fs/fs.hpp"
 #include ".//Input/input.hpp"
+#include ".//Job/job.hpp"
 #include ".//Light/light.hpp"
 #include ".//Math/math.hpp"
 #include ".//Obj/obj.hpp"
@@ -9,14 +9,17 @@
 #include <iostream>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <numeric>
 #include <random>
 #include <span>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <tuple>
 #include <typeinfo>
+#include <unordered_map>
 #include <vector>
 
 #include <tmgl/tmgl.h>
@@ -102,8 +105,98 @@ inline void CombineVectors(std::vector<glm::vec3>& v1, std::vector<glm::vec3>& v
 
 using string = std::string;
 
+/**
+ * Interned name: a 64-bit FNV-1a hash that compares and hashes as an integer.
+ * Literals hash at compile time through _sid. Debug builds remember the text of every
+ * id built at runtime so it can be printed back, release builds only keep the hash.
+ */
+struct StringId
+{
+    u64 hash = 0;
+
+    constexpr StringId() = default;
+    constexpr explicit StringId(u64 hash) : hash(hash) {}
+
+    constexpr StringId(const char* str) : StringId(std::string_view(str)) {}
+    StringId(const string& str) : StringId(std::string_view(str)) {}
+
+    constexpr StringId(std::string_view str) : hash(Hash(str))
+    {
+        if (!std::is_constant_evaluated())
+            Register(str, hash);
+    }
+
+    constexpr bool operator==(const StringId& other) const = default;
+    constexpr bool operator<(const StringId& other) const { return hash < other.hash; }
+
+    // The original text in debug builds, the hash in hex otherwise
+    string GetString() const
+    {
+#ifdef DEBUG
+        std::lock_guard lock(GetTableMutex());
+        var& table = GetTable();
+        if (table.contains(hash))
+            return table[hash];
+#endif
+        std::stringstream out;
+        out << "#" << std::hex << hash;
+        return out.str();
+    }
+
+    static constexpr u64 Hash(std::string_view str)
+    {
+        u64 hash = 0xcbf29ce484222325ull;
+        for (char c : str)
+        {
+            hash ^= static_cast<u8>(c);
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+private:
+    static void Register(std::string_view str, u64 hash)
+    {
+#ifdef DEBUG
+        std::lock_guard lock(GetTableMutex());
+        var& table = GetTable();
+
+        var it = table.find(hash);
+        if (it == table.end())
+            table.emplace(hash, string(str));
+        else if (it->second != str)
+            std::cout << "StringId collision: " << it->second << " and " << str << std::endl;
+#endif
+    }
+
+#ifdef DEBUG
+    static std::unordered_map<u64, string>& GetTable()
+    {
+        static std::unordered_map<u64, string> table;
+        return table;
+    }
+
+    static std::mutex& GetTableMutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+#endif
+};
+
+consteval StringId operator""_sid(const char* str, size_t length)
+{
+    return StringId(StringId::Hash(std::string_view(str, length)));
+}
+
 namespace std
 {
+    template <>
+    struct hash<StringId>
+    {
+        size_t operator()(const StringId& id) const noexcept { return id.hash; }
+    };
+
     inline string to_string(glm::vec3 v)
     {
         return "(" + std::to_string(v.x) + "," + std::to_string(v.y) + "," + std::to_string(v.z) + ")";
@@ -6,11 +6,49 @@ import shutil
 
 shaderc = "D:/Code/ImportantRepos/TomatoEngine/vendor/bgfx/.build/win64_vs2022/bin/shadercRelease.exe"
 
+# Bit order must match SubShader::Feature
+FEATURES = ["SKINNED", "INSTANCED", "LIT", "ALPHA_TEST", "QUANTIZED", "VERTEX_ANIMATION"]
+
 def convertPosix(path):
     p = pathlib.PureWindowsPath(path)
     return p.as_posix()
 
-def buildShader(path,type, args, outPath):
+def readVariants(path):
+    # Sources opt into permutations with a "//#variants KEYWORD ..." line
+    mask = 0
+    with open(path, "r") as file:
+        for line in file:
+            line = line.strip()
+            if line.startswith("//#variants"):
+                for keyword in line.split()[1:]:
+                    if keyword in FEATURES:
+                        mask |= 1 << FEATURES.index(keyword)
+                    else:
+                        print(f"Unknown shader keyword {keyword} in {path}")
+    return mask
+
+def buildVariants(path, type, args, outPath):
+    declared = readVariants(path)
+
+    buildShader(path, type, args, outPath)
+
+    if declared == 0:
+        return
+
+    parName = os.path.basename(os.path.dirname(path))
+    name = os.path.splitext(os.path.basename(path))[0]
+
+    with open(convertPosix(f"{outPath}/{parName}/{name}.variants"), "w") as file:
+        file.write(str(declared))
+
+    # Every subset of the declared keywords, the empty one is the base shader built above
+    mask = declared
+    while mask > 0:
+        defines = ";".join(f for i, f in enumerate(FEATURES) if mask & (1 << i))
+        buildShader(path, type, args + f" --define {defines}", outPath, f"_v{mask}")
+        mask = (mask - 1) & declared
+
+def buildShader(path,type, args, outPath, suffix = ""):
     parName = os.path.basename(os.path.dirname(path))
 
 
@@ -24,7 +62,7 @@ def buildShader(path,type, args, outPath):
     elif (type == "compute"):
         ext = "ccbsh"
 
-    out = outPath + "/" + parName + "/" +  os.path.splitext(os.path.basename(path))[0] + f".{ext}"
+    out = outPath + "/" + parName + "/" +  os.path.splitext(os.path.basename(path))[0] + suffix + f".{ext}"
     out = convertPosix(out)
 
     if not os.path.exists(os.path.dirname(out)):
@@ -81,9 +119,9 @@ def build(platform):
             file_path = os.path.join(root, file)
             file_path = convertPosix(file_path)
             if (file.endswith(".vbsh") ):
-                buildShader(file_path, "vertex",vsf, outPath)
+                buildVariants(file_path, "vertex",vsf, outPath)
             if (file.endswith(".fbsh") ):
-                buildShader(file_path, "fragment",fsf, outPath)
+                buildVariants(file_path, "fragment",fsf, outPath)
             if (file.endswith(".cbsh") ):
                 buildShader(file_path, "compute",csf, outPath)
     